@@ -0,0 +1,87 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// Times the file loaders: benchmarkloaders [file ...]. Each file is loaded
+// several times and the best times are reported: the whole load, the part of it
+// spent building mipmaps, and the parse rate of the rest.
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include "defs.h"
+#include "utilities.h"
+#include "image.h"
+
+const int NUM_RUNS = 5;
+
+/**
+ * @fn	size_t fileSize(const string &fileName)
+ * @brief	Size of a file, in bytes.
+ * @param	fileName	Name of the file.
+ * @return	Its size, or 0 if it cannot be opened.
+ */
+
+size_t fileSize(const string& fileName) {
+	std::ifstream input(fileName.c_str(), std::ios::binary | std::ios::ate);
+	return input ? (size_t)input.tellg() : 0;
+}
+
+/**
+ * @fn	double secondsFor(const std::function<void()> &work)
+ * @brief	Times a piece of work.
+ * @param	work	The work.
+ * @return	The time it took, in seconds.
+ */
+
+double secondsFor(const std::function<void()>& work) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	work();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+/**
+ * @fn	void report(const string &fileName)
+ * @brief	Times loading an image and prints the best times. Loading includes building
+ * 			the mipmaps, so they are then built again, on their own, and that time is
+ * 			left out of the parse rate.
+ * @param	fileName	The file being loaded.
+ */
+
+void report(const string& fileName) {
+	double bestLoad = 1e30, bestMipmaps = 1e30;
+	for (int run = 0; run < NUM_RUNS; run++) {
+		std::unique_ptr<Image> image;
+		bestLoad = glm::min(bestLoad, secondsFor([&]() { image.reset(new Image(fileName)); }));
+		bestMipmaps = glm::min(bestMipmaps, secondsFor([&]() { image->buildMipmaps(); }));
+	}
+	double megabytes = fileSize(fileName) / 1.0e6;
+	double parse = glm::max(bestLoad - bestMipmaps, 1e-9);
+	cout << std::left << std::setw(20) << fileName << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(10) << megabytes << " MB"
+		<< std::setw(10) << bestLoad * 1000 << " ms load"
+		<< std::setw(10) << bestMipmaps * 1000 << " ms mipmaps"
+		<< std::setw(10) << megabytes / parse << " MB/s parsed" << endl;
+}
+
+int main(int argc, char* argv[]) {
+	vector<string> images;
+	for (int i = 1; i < argc; i++) {
+		images.push_back(argv[i]);
+	}
+	if (images.empty()) {
+		images = { "blackbuck.ppm", "snail.ppm", "usflag.ppm" };
+	}
+	cout << "Loading with " << numWorkerThreads() << " threads" << endl;
+	for (const string& fileName : images) {
+		report(fileName);
+	}
+	return 0;
+}
@@ -19,10 +19,91 @@
   */
 
 RaytracingCamera::RaytracingCamera(const dvec3& viewingPos, const dvec3& lookAtPt, const dvec3& up,
-	int width, int height) {
+	int width, int height) : nx(width), ny(height), revision(0) {
 	setupFrame(viewingPos, lookAtPt, up);
 }
 
+/**
+ * @fn	void RaytracingCamera::setFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up)
+ * @brief	Moves and/or reorients an existing camera. Moving the camera without turning
+ *			it does not invalidate any cached ray directions.
+ * @param	pos			The new viewing position.
+ * @param	lookAtPt	A new focus point.
+ * @param	up			Up vector.
+ */
+
+void RaytracingCamera::setFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up) {
+	dvec3 oldU = cameraFrame.u, oldV = cameraFrame.v, oldW = cameraFrame.w;
+	setupFrame(pos, lookAtPt, up);
+	if (cameraFrame.u != oldU || cameraFrame.v != oldV || cameraFrame.w != oldW) {
+		revision++;
+	}
+}
+
+/**
+ * @fn	void RaytracingCamera::setSize(int width, int height)
+ * @brief	Changes the size of the window this camera renders into.
+ * @param	width 	Width of window.
+ * @param	height	Height of window.
+ */
+
+void RaytracingCamera::setSize(int width, int height) {
+	if (width != nx || height != ny) {
+		setupViewingParameters(width, height);
+		revision++;
+	}
+}
+
+/**
+ * @fn	double RaytracingCamera::subpixelOffset(int i, int N)
+ * @brief	Offset of the i-th of N evenly spaced subpixel samples within a pixel.
+ * @param	i	Index of the sample along one axis, in [0, N).
+ * @param	N	Number of samples along one axis.
+ * @return	The offset, in (0, 1).
+ */
+
+double RaytracingCamera::subpixelOffset(int i, int N) {
+	return (1.0 / (2.0 * N)) + ((1.0 / N) * i);
+}
+
+/**
+ * @fn	Ray RaytracingCamera::getSubpixelRay(int x, int y, int i, int j, int N) const
+ * @brief	Returns the ray through subpixel (i, j) of pixel (x, y), when each pixel is
+ *			sampled N x N times.
+ * @param	x	The pixel's x coordinate.
+ * @param	y	The pixel's y coordinate.
+ * @param	i	Subpixel index in x, in [0, N).
+ * @param	j	Subpixel index in y, in [0, N).
+ * @param	N	Number of samples along each axis.
+ * @return	The ray.
+ */
+
+Ray RaytracingCamera::getSubpixelRay(int x, int y, int i, int j, int N) const {
+	return getRay(x + subpixelOffset(i, N), y + subpixelOffset(j, N));
+}
+
+/**
+ * @fn	RayDifferential RaytracingCamera::getRayDifferential(double x, double y) const
+ * @brief	Returns how the ray through (x, y) changes from one pixel to the next. This
+ * 			version uses the rays through the neighboring pixels, which is exact for
+ * 			cameras whose rays vary linearly (such as orthographic cameras).
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The ray differential.
+ */
+
+RayDifferential RaytracingCamera::getRayDifferential(double x, double y) const {
+	Ray ray = getRay(x, y);
+	Ray rayX = getRay(x + 1, y);
+	Ray rayY = getRay(x, y + 1);
+	RayDifferential d;
+	d.dOdx = rayX.origin - ray.origin;
+	d.dOdy = rayY.origin - ray.origin;
+	d.dDdx = rayX.dir - ray.dir;
+	d.dDdy = rayY.dir - ray.dir;
+	return d;
+}
+
 /**
  * @fn	void RaytracingCamera::setupFrame(const dvec3& viewingPos, const dvec3& lookAtPt, const dvec3& up)
  * @brief	Change configuration parameters of this camera. This is called to update
@@ -54,11 +135,25 @@ void RaytracingCamera::setupFrame(const dvec3& viewingPos, const dvec3& lookAtPt
 PerspectiveCamera::PerspectiveCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 	double FOVRads,
 	int width, int height)
-	: RaytracingCamera(pos, lookAtPt, up, width, height) {
+	: RaytracingCamera(pos, lookAtPt, up, width, height), rayDirsN(0), rayDirsRevision(0) {
 	fov = FOVRads;
 	setupViewingParameters(width, height);
 }
 
+/**
+ * @fn	void PerspectiveCamera::setFOV(double FOVRads)
+ * @brief	Changes the field of view of an existing camera.
+ * @param	FOVRads	The field of view in radians.
+ */
+
+void PerspectiveCamera::setFOV(double FOVRads) {
+	if (FOVRads != fov) {
+		fov = FOVRads;
+		setupViewingParameters(nx, ny);
+		revision++;
+	}
+}
+
 /**
  * @fn	OrthographicCamera::OrthographicCamera(const dvec3 &pos, const dvec3 &lookAtPt,
  *												const dvec3 &up, double ppwu)
@@ -172,6 +267,75 @@ Ray PerspectiveCamera::getRay(double x, double y) const {
 	return Ray(cameraFrame.origin, rayDirection);
 }
 
+/**
+ * @fn	RayDifferential PerspectiveCamera::getRayDifferential(double x, double y) const
+ * @brief	Returns how the ray through (x, y) changes from one pixel to the next: the
+ * 			derivative of getRay's normalized direction with respect to x and y.
+ * @param	x	The x coordinate.
+ * @param	y	The y coordinate.
+ * @return	The ray differential. The origin does not change.
+ */
+
+RayDifferential PerspectiveCamera::getRayDifferential(double x, double y) const {
+	dvec2 uv = getProjectionPlaneCoordinates(x, y);
+	dvec3 p = -distToPlane * cameraFrame.w + uv.x * cameraFrame.u + uv.y * cameraFrame.v;
+	double length = glm::length(p);
+	dvec3 dir = p / length;
+	dvec3 dPdx = ((right - left) / nx) * cameraFrame.u;
+	dvec3 dPdy = ((top - bottom) / ny) * cameraFrame.v;
+	RayDifferential d;
+	d.dDdx = (dPdx - glm::dot(dir, dPdx) * dir) / length;
+	d.dDdy = (dPdy - glm::dot(dir, dPdy) * dir) / length;
+	return d;
+}
+
+/**
+ * @fn	void PerspectiveCamera::cacheSubpixelRays(int N) const
+ * @brief	Precomputes the direction of every subpixel ray. The table is only rebuilt
+ *			when N, the window size, the field of view or the camera's orientation
+ *			changes. Should be called once per frame, before any calls to getSubpixelRay.
+ * @param	N	Number of samples along each axis of a pixel.
+ */
+
+void PerspectiveCamera::cacheSubpixelRays(int N) const {
+	if (rayDirsN == N && rayDirsRevision == revision) {
+		return;
+	}
+	rayDirs.resize(nx * ny * N * N);
+	int k = 0;
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++) {
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < N; j++) {
+					rayDirs[k++] = RaytracingCamera::getSubpixelRay(x, y, i, j, N).dir;
+				}
+			}
+		}
+	}
+	rayDirsN = N;
+	rayDirsRevision = revision;
+}
+
+/**
+ * @fn	Ray PerspectiveCamera::getSubpixelRay(int x, int y, int i, int j, int N) const
+ * @brief	Returns the ray through subpixel (i, j) of pixel (x, y). Uses the table built
+ *			by cacheSubpixelRays when it is current.
+ * @param	x	The pixel's x coordinate.
+ * @param	y	The pixel's y coordinate.
+ * @param	i	Subpixel index in x, in [0, N).
+ * @param	j	Subpixel index in y, in [0, N).
+ * @param	N	Number of samples along each axis.
+ * @return	The ray.
+ */
+
+Ray PerspectiveCamera::getSubpixelRay(int x, int y, int i, int j, int N) const {
+	if (rayDirsN == N && rayDirsRevision == revision &&
+		x >= 0 && x < nx && y >= 0 && y < ny) {
+		return Ray(cameraFrame.origin, rayDirs[((y * nx + x) * N + i) * N + j], true);
+	}
+	return RaytracingCamera::getSubpixelRay(x, y, i, j, N);
+}
+
 /**
 * @fn	ostream &operator << (ostream &os, const RaytracingCamera &camera)
 * @brief	Output stream for cameras.
@@ -9,6 +9,7 @@
 
 #pragma once
 #include <iostream>
+#include <vector>
 #include "ishape.h"
 
  /**
@@ -20,17 +21,25 @@ struct RaytracingCamera {
 	RaytracingCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const = 0;
-	Frame getFrame() const { return cameraFrame; }
+	virtual Ray getSubpixelRay(int x, int y, int i, int j, int N) const;
+	virtual void cacheSubpixelRays(int /*N*/) const {}
+	virtual RayDifferential getRayDifferential(double x, double y) const;
+	void setFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up);
+	void setSize(int width, int height);
+	const Frame& getFrame() const { return cameraFrame; }
 	int getNX() const { return nx; }
 	int getNY() const { return ny; }
 	double getLeft() const { return left; }
 	double getRight() const { return right; }
 	double getBottom() const { return bottom; }
 	double getTop() const { return top; }
+	unsigned int getRevision() const { return revision; }
+	static double subpixelOffset(int i, int N);
 protected:
 	Frame cameraFrame;					//!< The camera's frame
 	int nx, ny;							//!< Window size
 	double left, right, bottom, top;	//!< The camera's vertical field of view
+	unsigned int revision;				//!< Bumped whenever the ray directions change.
 
 	void setupFrame(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up);
 	virtual void setupViewingParameters(int width, int height) = 0;
@@ -49,10 +58,17 @@ struct PerspectiveCamera : public RaytracingCamera {
 	PerspectiveCamera(const dvec3& pos, const dvec3& lookAtPt, const dvec3& up, double FOVRads,
 		int width, int height);
 	virtual Ray getRay(double x, double y) const;
+	virtual Ray getSubpixelRay(int x, int y, int i, int j, int N) const;
+	virtual void cacheSubpixelRays(int N) const;
+	virtual RayDifferential getRayDifferential(double x, double y) const;
+	void setFOV(double FOVRads);
 	double getDistToPlane() const { return distToPlane; }
 private:
 	double fov;						//!< The camera's field of view
 	double distToPlane;				//!< Distance to image plane
+	mutable vector<dvec3> rayDirs;	//!< Direction of every subpixel ray, N*N per pixel.
+	mutable int rayDirsN;			//!< N used to build rayDirs (0 if not built).
+	mutable unsigned int rayDirsRevision;	//!< Camera revision used to build rayDirs.
 	virtual void setupViewingParameters(int width, int height);
 };
 
@@ -9,7 +9,13 @@
 
 #include <fstream>
 #include <sstream>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
 #include "eshape.h"
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "utilities.h"
  /**
   * @fn	EShapeData EShape::createEDisk(const Material &mat, int slices)
   * @brief	Creates a disk with radius 1, centered on origin and lying at z = 0
@@ -144,61 +150,289 @@ EShapeData EShape::createECheckerBoard(const Material& mat1, const Material& mat
 	return result;
 }
 
-// This code provided by Jack Duval
-EShapeData EShape::createEObj(const string& filename) {
+const size_t MIN_OBJ_CHUNK = 1 << 18;	//!< Smallest piece of an OBJ file parsed by one job.
+const int OBJ_FACES_PER_JOB = 4096;		//!< Faces handled by one job after parsing.
+
+/**
+ * @struct	ObjChunk
+ * @brief	The vertices and faces found in one piece of an OBJ file.
+ */
+
+struct ObjChunk {
+	vector<dvec4> vertices;		//!< "v" lines, in order.
+	vector<glm::ivec3> faces;	//!< "f" lines, in order: the first three vertex indices.
+};
+
+static bool isObjSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * @fn	static const char* parseObjNumber(const char *p, const char *end, T &value)
+ * @brief	Reads a number after optional spaces, as operator >> would. A face index
+ * 			such as "7/2/5" reads as 7. If there is no number, value is set to 0.
+ * @param 		  	p	 	Where to start.
+ * @param 		  	end  	End of the line.
+ * @param [in,out]	value	The number.
+ * @return	The first character after the token.
+ */
+
+template <class T>
+static const char* parseObjNumber(const char* p, const char* end, T& value) {
+	while (p < end && isObjSpace(*p)) {
+		p++;
+	}
+	const char* start = p < end && *p == '+' ? p + 1 : p;
+	std::from_chars_result result = std::from_chars(start, end, value);
+	if (result.ec != std::errc()) {
+		value = 0;
+	}
+	while (p < end && !isObjSpace(*p)) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @fn	static void parseObjChunk(const char *p, const char *end, ObjChunk &chunk)
+ * @brief	Parses the "v" and "f" lines of a piece of an OBJ file that starts at the
+ * 			beginning of a line. Everything else is ignored.
+ * @param 		  	p	 	Start of the piece.
+ * @param 		  	end  	End of the piece.
+ * @param [in,out]	chunk	The vertices and faces found.
+ */
+
+static void parseObjChunk(const char* p, const char* end, ObjChunk& chunk) {
+	while (p < end) {
+		const char* eol = (const char*)std::memchr(p, '\n', end - p);
+		if (eol == nullptr) {
+			eol = end;
+		}
+		if (eol - p >= 2 && p[1] == ' ') {
+			if (p[0] == 'v') {
+				double x, y, z;
+				const char* q = parseObjNumber(p + 2, eol, x);
+				q = parseObjNumber(q, eol, y);
+				parseObjNumber(q, eol, z);
+				chunk.vertices.push_back(dvec4(x, y, z, 1.0));
+			} else if (p[0] == 'f') {
+				// Faces are f v1/vt1/vn1 v2/vt2/vn2 v3/vt3/vn3; only v1, v2 and v3 matter.
+				glm::ivec3 face(0, 0, 0);
+				const char* q = p + 2;
+				for (int i = 0; i < 3; i++) {
+					q = parseObjNumber(q, eol, face[i]);
+				}
+				chunk.faces.push_back(face);
+			}
+		}
+		p = eol + 1;
+	}
+}
+
+/**
+ * @fn	static vector<ObjChunk> parseObjText(const char *text, size_t size)
+ * @brief	Splits OBJ text that starts at the beginning of a line into chunks at line
+ * 			boundaries, and parses the chunks in parallel.
+ * @param	text	The text.
+ * @param	size	Its length, in bytes.
+ * @return	The chunks, in file order.
+ */
+
+static vector<ObjChunk> parseObjText(const char* text, size_t size) {
+	const int NUM_CHUNKS = (int)glm::clamp(size / MIN_OBJ_CHUNK, (size_t)1, (size_t)numWorkerThreads() * 4);
+	vector<size_t> chunkStart(NUM_CHUNKS + 1, 0);
+	for (int c = 1; c <= NUM_CHUNKS; c++) {
+		size_t pos = c == NUM_CHUNKS ? size : glm::max(size / NUM_CHUNKS * c, chunkStart[c - 1]);
+		while (pos < size && text[pos - 1] != '\n') {
+			pos++;
+		}
+		chunkStart[c] = pos;
+	}
+	vector<ObjChunk> chunks(NUM_CHUNKS);
+	parallelFor(0, NUM_CHUNKS, [&](int c) {
+		parseObjChunk(text + chunkStart[c], text + chunkStart[c + 1], chunks[c]);
+	});
+	return chunks;
+}
+
+/**
+ * @fn	static EShapeData objTriangles(int numFaces, const double *positions, const double *normals,
+ *										const uint32_t *indices)
+ * @brief	Expands an indexed mesh into three vertices per face. Every face gets
+ * 			material 0, redPlastic, the only one OBJ files are given so far.
+ * @param	numFaces 	Number of faces.
+ * @param	positions	x, y and z of each vertex.
+ * @param	normals  	x, y and z of each face's normal.
+ * @param	indices  	Three 0-based vertex indices per face.
+ * @return	The triangles.
+ */
+
+static EShapeData objTriangles(int numFaces, const double* positions, const double* normals,
+	const uint32_t* indices) {
+	const Material mat = redPlastic;
 	EShapeData result;
-	std::ifstream in(filename);
-	if (!in.is_open()) {
+	result.assign(3 * (size_t)numFaces, VertexData(dvec4(0.0, 0.0, 0.0, 1.0)));
+	parallelFor(0, (numFaces + OBJ_FACES_PER_JOB - 1) / OBJ_FACES_PER_JOB, [&](int job) {
+		int last = glm::min(numFaces, (job + 1) * OBJ_FACES_PER_JOB);
+		for (int i = job * OBJ_FACES_PER_JOB; i < last; i++) {
+			dvec4 n(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2], 0.0);
+			for (int j = 0; j < 3; j++) {
+				const double* p = positions + 3 * (size_t)indices[3 * i + j];
+				result[3 * i + j] = VertexData(dvec4(p[0], p[1], p[2], 1.0), n, mat);
+			}
+		}
+	});
+	return result;
+}
+
+/**
+ * @fn	EShapeData EShape::createEObj(const string &filename, bool usesCache)
+ * @brief	Creates the triangles of a Wavefront OBJ file (see readObj). An up to date
+ * 			MeshCache is expanded straight from its mapping.
+ * @param	filename 	Name of the file.
+ * @param	usesCache	false to neither read nor write the cache.
+ * @return	Three vertices per face, with flat normals.
+ */
+
+EShapeData EShape::createEObj(const string& filename, bool usesCache) {
+	if (usesCache) {
+		MeshCache cache(filename);
+		if (cache.isValid()) {
+			return objTriangles(cache.getNumFaces(), cache.getPositions(), cache.getNormals(),
+								cache.getIndices());
+		}
+	}
+	vector<double> positions, normals;
+	vector<uint32_t> indices;
+	if (!readObj(filename, positions, normals, indices, usesCache)) {
+		return EShapeData();
+	}
+	return objTriangles((int)indices.size() / 3, positions.data(), normals.data(), indices.data());
+}
+
+/**
+ * @fn	bool EShape::readObj(const string &filename, vector<double> &positions,
+ *							vector<double> &normals, vector<uint32_t> &indices, bool usesCache)
+ * @brief	Reads the indexed mesh in a Wavefront OBJ file. Only the vertex positions
+ * 			and the first three vertices of each face are used. The file is mapped into
+ * 			memory and split at line boundaries into chunks that are parsed in parallel;
+ * 			the chunks are then joined in file order, so the result does not depend on
+ * 			the number of threads. The parsed mesh is saved in a MeshCache, which later
+ * 			calls read instead of parsing the file again, for as long as it is unchanged.
+ * @param 		  	filename 	Name of the file.
+ * @param [in,out]	positions	x, y and z of each vertex.
+ * @param [in,out]	normals  	x, y and z of each face's normal.
+ * @param [in,out]	indices  	Three 0-based vertex indices per face.
+ * @param 		  	usesCache	false to neither read nor write the cache.
+ * @return	true iff the file could be read.
+ */
+
+// Based on code provided by Jack Duval
+bool EShape::readObj(const string& filename, vector<double>& positions,
+	vector<double>& normals, vector<uint32_t>& indices, bool usesCache) {
+	if (usesCache) {
+		MeshCache cache(filename);
+		if (cache.isValid()) {
+			const size_t NUM_VERTICES = cache.getNumVertices(), NUM_FACES = cache.getNumFaces();
+			positions.assign(cache.getPositions(), cache.getPositions() + 3 * NUM_VERTICES);
+			normals.assign(cache.getNormals(), cache.getNormals() + 3 * NUM_FACES);
+			indices.assign(cache.getIndices(), cache.getIndices() + 3 * NUM_FACES);
+			return true;
+		}
+	}
+	MeshSourceStamp source;
+	const bool isStamped = usesCache && MeshCache::stampFile(filename, source);
+	MappedFile file(filename);
+	if (!file.isOpen()) {
 		cout << "Error: Cannot open file " << filename << endl;
-		return result;
+		return false;
 	}
 
-	// Loads all the vertices into a vector and faces into a vector
+	vector<ObjChunk> chunks = parseObjText(file.getData(), file.getSize());
+
+	// Join the chunks. Indices are 1-based and refer to the whole file.
 	vector<dvec4> vertices;
 	vector<glm::ivec3> faces;
-	std::string line;
-	int faceCount = 0;
-	while (std::getline(in, line)) {
-		if (line.substr(0, 2) == "v ") {
-			std::istringstream s(line.substr(2));
-			double x, y, z;
-			s >> x >> y >> z;
-			vertices.push_back(dvec4(x, y, z, 1.0));
-		} else if (line.substr(0, 2) == "f ") {
-			// Splits the line into a vector of strings
-			std::istringstream s(line.substr(2));
-			std::vector<std::string> face;
-			std::string temp;
-			while (s >> temp) {
-				face.push_back(temp);
+	for (ObjChunk& chunk : chunks) {
+		vertices.insert(vertices.end(), chunk.vertices.begin(), chunk.vertices.end());
+		faces.insert(faces.end(), chunk.faces.begin(), chunk.faces.end());
+	}
+	const int NUM_VERTICES = (int)vertices.size();
+	for (const glm::ivec3& face : faces) {
+		for (int i = 0; i < 3; i++) {
+			if (face[i] < 1 || face[i] > NUM_VERTICES) {
+				throw std::out_of_range("readObj: face refers to a missing vertex in " + filename);
 			}
+		}
+	}
 
-			// Faces are read as f v1/vt1/vn1 v2/vt2/vn2 v3/vt3/vn3. 
-			// We need to convert them to f v1 v2 v3
-			for (int i = 0; i < face.size(); i++) {
-				std::istringstream s(face[i]);
-				int v;
-				s >> v;
-				if (i == 0) {
-					faces.push_back(glm::ivec3(v, 0, 0));
-				} else if (i == 1) {
-					faces.at(faceCount) = glm::ivec3(faces.at(faceCount).x, v, 0);
-				} else if (i == 2) {
-					faces.at(faceCount) = glm::ivec3(faces.at(faceCount).x, faces.at(faceCount).y, v);
-				}
+	// Flatten into the cache's layout and compute the face normals.
+	const int NUM_FACES = (int)faces.size();
+	positions.resize(3 * vertices.size());
+	for (int i = 0; i < NUM_VERTICES; i++) {
+		positions[3 * i] = vertices[i].x;
+		positions[3 * i + 1] = vertices[i].y;
+		positions[3 * i + 2] = vertices[i].z;
+	}
+	normals.resize(3 * faces.size());
+	indices.resize(3 * faces.size());
+	vector<uint32_t> materialIds(faces.size(), 0);
+	parallelFor(0, (NUM_FACES + OBJ_FACES_PER_JOB - 1) / OBJ_FACES_PER_JOB, [&](int job) {
+		int last = glm::min(NUM_FACES, (job + 1) * OBJ_FACES_PER_JOB);
+		for (int i = job * OBJ_FACES_PER_JOB; i < last; i++) {
+			const dvec4& A = vertices[faces[i].x - 1];
+			const dvec4& B = vertices[faces[i].y - 1];
+			const dvec4& C = vertices[faces[i].z - 1];
+			dvec3 n = normalFrom3Points(A.xyz(), B.xyz(), C.xyz());
+			for (int j = 0; j < 3; j++) {
+				normals[3 * i + j] = n[j];
+				indices[3 * i + j] = (uint32_t)(faces[i][j] - 1);
 			}
-			faceCount++;
 		}
+	});
+	if (isStamped && file.getSize() == source.size) {
+		source.hash = MeshCache::hashBytes(file.getData(), file.getSize());
+		MeshCache::write(filename, source, positions, normals, indices, materialIds);
 	}
+	return true;
+}
 
-	// Constructs the triangles from the vertices
-	for (int i = 0; i < faces.size(); i++) {
-		Material mat = redPlastic;
-		dvec4 A = vertices.at(faces.at(i).x - 1);
-		dvec4 B = vertices.at(faces.at(i).y - 1);
-		dvec4 C = vertices.at(faces.at(i).z - 1);
-		VertexData::addTriVertsAndComputeNormal(result, A, B, C, mat);
-	}
+/**
+ * @fn	bool EShape::scanObj(const string &filename, const ObjVisitor &visit, size_t windowSize)
+ * @brief	Reads a Wavefront OBJ file of any size, a window of about windowSize bytes at a
+ * 			time, and hands each parsed piece to visit, in file order. Each window is
+ * 			parsed in parallel as readObj parses a whole file, but nothing is kept after
+ * 			it has been visited, so memory use depends on the window and not the file.
+ * 			Face indices are not checked.
+ * @param	filename  	Name of the file.
+ * @param	visit	  	Called with each piece.
+ * @param	windowSize	Bytes read at a time. A line longer than this is still read whole.
+ * @return	true iff the file could be read.
+ */
 
-	return result;
+bool EShape::scanObj(const string& filename, const ObjVisitor& visit, size_t windowSize) {
+	std::ifstream in(filename, std::ios::binary);
+	if (!in) {
+		cout << "Error: Cannot open file " << filename << endl;
+		return false;
+	}
+	vector<char> window;
+	size_t carried = 0;		// Bytes of an unfinished line left over from the last window.
+	bool isAtEnd = false;
+	while (!isAtEnd) {
+		window.resize(carried + windowSize);
+		in.read(window.data() + carried, windowSize);
+		const size_t size = carried + (size_t)in.gcount();
+		isAtEnd = size < window.size();
+		size_t end = size;
+		while (!isAtEnd && end > 0 && window[end - 1] != '\n') {
+			end--;
+		}
+		for (const ObjChunk& chunk : parseObjText(window.data(), end)) {
+			visit(chunk.vertices, chunk.faces);
+		}
+		std::memmove(window.data(), window.data() + end, size - end);
+		carried = size - end;
+	}
+	return !in.bad();
 }
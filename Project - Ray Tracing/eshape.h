@@ -11,12 +11,25 @@
 
 #include <utility>
 #include <iostream>
+#include <cstdint>
+#include <functional>
 #include "vertexdata.h"
 #include "framebuffer.h"
 #include "light.h"
 
 typedef vector<VertexData> EShapeData;
 
+/**
+ * @typedef	ObjVisitor
+ * @brief	Receives consecutive pieces of an OBJ file from EShape::scanObj: the "v" lines
+ * 			of the piece, and the first three vertex indices of its "f" lines. Indices are
+ * 			1-based and count vertices from the start of the file, not of the piece.
+ */
+
+typedef std::function<void(const vector<dvec4>& vertices, const vector<glm::ivec3>& faces)> ObjVisitor;
+
+const size_t OBJ_WINDOW_SIZE = (size_t)1 << 26;	//!< Bytes of an OBJ file scanObj holds at once.
+
 /**
  * @struct	EShape
  * @brief	This class contains functions that create explicitly represented shapes.
@@ -32,5 +45,8 @@ struct EShape {
 	static EShapeData createECylinder(const Material& mat, int slices = DEFAULT_SLICES);
 	static EShapeData createECone(const Material& mat, int slices = DEFAULT_SLICES);
 	static EShapeData createECheckerBoard(const Material& mat1, const Material& mat2, double WIDTH, double HEIGHT, int DIV);
-	static EShapeData createEObj(const string& filename);
+	static EShapeData createEObj(const string& filename, bool usesCache = true);
+	static bool readObj(const string& filename, vector<double>& positions,
+		vector<double>& normals, vector<uint32_t>& indices, bool usesCache = true);
+	static bool scanObj(const string& filename, const ObjVisitor& visit, size_t windowSize = OBJ_WINDOW_SIZE);
 };
@@ -53,7 +53,7 @@ void renderObjects() {
 }
 
 static void render() {
-	frameBuffer.clearColorAndDepthBuffers();
+	frameBuffer.clearColorAndDepthBuffers(true);
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 	viewingMatrix = glm::lookAt(position, ORIGIN3D, Y_AXIS);
@@ -122,6 +122,7 @@ int main(int argc, char *argv[]) {
 	glutTimerFunc(100, timer, 0);
 	glutMouseFunc(mouseUtility);
 	frameBuffer.setClearColor(lightGray);
+	frameBuffer.setFormats(ColorFormat::RGBA8, DepthFormat::FLOAT32);
 		
 	glutMainLoop();
 
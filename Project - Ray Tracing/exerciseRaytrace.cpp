@@ -29,18 +29,22 @@ dvec3 cameraPos(0, 5, 10);
 dvec3 cameraFocus(0, 5, 0);
 dvec3 cameraUp = Y_AXIS;
 double cameraFOV = PI_2;
+PerspectiveCamera pCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, WINDOW_WIDTH, WINDOW_HEIGHT);
 
 IScene scene;
 
 void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+	int frameStartTime = elapsedMilliseconds();
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 
-	scene.camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height);
+	pCamera.setFrame(cameraPos, cameraFocus, cameraUp);
+	pCamera.setFOV(cameraFOV);
+	pCamera.setSize(width, height);
+	scene.camera = &pCamera;
 	rayTrace.raytraceScene(frameBuffer, 0, scene, 3);
 
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
+	int frameEndTime = elapsedMilliseconds(); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
 }
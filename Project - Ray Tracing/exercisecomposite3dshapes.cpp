@@ -34,14 +34,17 @@ PerspectiveCamera pCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, WINDOW_WI
 IScene scene;
 
 void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+	int frameStartTime = elapsedMilliseconds();
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 
-	scene.camera = new PerspectiveCamera(cameraPos, cameraFocus, cameraUp, cameraFOV, width, height);
+	pCamera.setFrame(cameraPos, cameraFocus, cameraUp);
+	pCamera.setFOV(cameraFOV);
+	pCamera.setSize(width, height);
+	scene.camera = &pCamera;
 	rayTrace.raytraceScene(frameBuffer, 0, scene, 3);
 
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
+	int frameEndTime = elapsedMilliseconds(); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
 }
@@ -19,18 +19,21 @@
 #include "raytracer.h"
 #include "camera.h"
 #include "image.h"
+#include "textureregistry.h"
 #include <ctime>
 #include <utility>
 #include <cctype>
 #include <ctime> 
 
 FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
-Image im("usflag.ppm");
+TextureRegistry textures;
+Image* im = textures.get("usflag.ppm");
 
 double angle = 0.0;
 bool isAnimated = true;
 
 double cameraFOV = PI_2;
+PerspectiveCamera pCamera(ORIGIN3D, -Z_AXIS, Y_AXIS, cameraFOV, WINDOW_WIDTH, WINDOW_HEIGHT);
 
 IScene theScene;
 
@@ -45,16 +48,16 @@ void buildScene() {
 	IShapePtr disk1 = new IDisk(dvec3(-5, 0, 6), dvec3(0, 0, 1), 3);
 	IShapePtr disk2 = new IDisk(dvec3(-9, 0, 5), dvec3(0, 0, 1), 3);
 
-	theScene.addOpaqueObject(new VisibleIShape(cylinder1, gold, &im));
+	theScene.addOpaqueObject(new VisibleIShape(cylinder1, gold, im));
 	theScene.addOpaqueObject(new VisibleIShape(cylinder2, brass));
-	theScene.addOpaqueObject(new VisibleIShape(cylinder3, gold, &im));
-	theScene.addOpaqueObject(new VisibleIShape(disk1, gold, &im));
+	theScene.addOpaqueObject(new VisibleIShape(cylinder3, gold, im));
+	theScene.addOpaqueObject(new VisibleIShape(disk1, gold, im));
 	theScene.addOpaqueObject(new VisibleIShape(disk2, brass));
 
 	theScene.addLight(posLight);
 }
 void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+	int frameStartTime = elapsedMilliseconds();
 
 	double R = 9;
 	double rads = glm::radians(angle);
@@ -62,11 +65,14 @@ void render() {
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
 
-	theScene.camera = new PerspectiveCamera(cameraPos, ORIGIN3D, Y_AXIS, cameraFOV, width, height);
+	pCamera.setFrame(cameraPos, ORIGIN3D, Y_AXIS);
+	pCamera.setFOV(cameraFOV);
+	pCamera.setSize(width, height);
+	theScene.camera = &pCamera;
 
 	frameBuffer.clearColorBuffer();
 	rayTrace.raytraceScene(frameBuffer, 0, theScene, 3);
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME);
+	int frameEndTime = elapsedMilliseconds();
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
@@ -7,10 +7,17 @@
  * permission is granted.
  ****************************************************/
 
+#include <thread>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <new>
 #include "defs.h"
 #include "utilities.h"
 #include "framebuffer.h"
 
+enum { TILE_CLEAN, TILE_CLEARING, TILE_PENDING };	//!< States of a lazily cleared tile.
+
  /**
   * @fn	FrameBuffer::FrameBuffer(const int width, const int height)
   * @brief	Constructor
@@ -18,7 +25,12 @@
   * @param	height	The height.
   */
 
-FrameBuffer::FrameBuffer(const int width, const int height) {
+FrameBuffer::FrameBuffer(const int width, const int height)
+	: colorBuffer(nullptr), depthBuffer(nullptr),
+	colorFormat(ColorFormat::RGB8), depthFormat(DepthFormat::DOUBLE), isTiled(false),
+	colorTileState(nullptr), depthTileState(nullptr), colorTileChanged(nullptr),
+	colorTileWriters(nullptr), frameNumber(0) {
+	setClearColor(black);
 	setFrameBufferSize(width, height);
 }
 
@@ -28,8 +40,11 @@ FrameBuffer::FrameBuffer(const int width, const int height) {
  */
 
 FrameBuffer::~FrameBuffer() {
-	delete[] colorBuffer;
-	delete[] depthBuffer;
+	freeBuffers();
+	delete[] colorTileState;
+	delete[] depthTileState;
+	delete[] colorTileChanged;
+	delete[] colorTileWriters;
 }
 
 /**
@@ -43,11 +58,457 @@ FrameBuffer::~FrameBuffer() {
 void FrameBuffer::setFrameBufferSize(int width, int height) {
 	this->width = width;
 	this->height = height;
-	int area = width * height;
-	delete[] colorBuffer;
-	delete[] depthBuffer;
-	colorBuffer = new GLubyte[area * BYTES_PER_PIXEL];
-	depthBuffer = new double[area];
+	tilesWide = (width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	tilesHigh = (height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	allocateBuffers();
+
+	delete[] colorTileState;
+	delete[] depthTileState;
+	delete[] colorTileChanged;
+	delete[] colorTileWriters;
+	colorTileState = new std::atomic<unsigned char>[tilesWide * tilesHigh];
+	depthTileState = new std::atomic<unsigned char>[tilesWide * tilesHigh];
+	colorTileChanged = new std::atomic<unsigned char>[tilesWide * tilesHigh];
+	colorTileWriters = new std::atomic<int>[tilesWide * tilesHigh];
+	for (int t = 0; t < tilesWide * tilesHigh; t++) {
+		colorTileState[t] = TILE_CLEAN;
+		depthTileState[t] = TILE_CLEAN;
+		colorTileChanged[t] = 1;
+		colorTileWriters[t] = NO_WRITES_EXPECTED;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::allocateBuffers()
+ * @brief	(Re)allocates the color and depth buffers for the current size, layout and
+ * 			formats. Both buffers start on a FRAMEBUFFER_ALIGNMENT byte boundary. With
+ * 			RGBA8 color the row pitch is padded so that every row does too. The contents
+ * 			are left uninitialized.
+ */
+
+void FrameBuffer::allocateBuffers() {
+	freeBuffers();
+	bytesPerColor = colorFormat == ColorFormat::RGBA8 ? 4 : BYTES_PER_PIXEL;
+	bytesPerDepth = depthFormat == DepthFormat::DOUBLE ? sizeof(double) : sizeof(float);
+	const int PIXELS_PER_ALIGNED_ROW = FRAMEBUFFER_ALIGNMENT / 4;
+	if (colorFormat == ColorFormat::RGBA8) {
+		pitch = (width + PIXELS_PER_ALIGNED_ROW - 1) / PIXELS_PER_ALIGNED_ROW * PIXELS_PER_ALIGNED_ROW;
+	} else {
+		pitch = width;
+	}
+	bufferSize = tilesWide * tilesHigh * FRAMEBUFFER_TILE_AREA;
+	colorBuffer = (GLubyte*)::operator new[](bufferSize * bytesPerColor,
+											std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+	depthBuffer = (GLubyte*)::operator new[](bufferSize * bytesPerDepth,
+											std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+}
+
+/**
+ * @fn	void FrameBuffer::freeBuffers()
+ * @brief	Releases the color and depth buffers.
+ */
+
+void FrameBuffer::freeBuffers() {
+	if (colorBuffer != nullptr) {
+		::operator delete[](colorBuffer, std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+	}
+	if (depthBuffer != nullptr) {
+		::operator delete[](depthBuffer, std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+	}
+	colorBuffer = nullptr;
+	depthBuffer = nullptr;
+}
+
+/**
+ * @fn	void FrameBuffer::setFormats(ColorFormat colorFormat, DepthFormat depthFormat)
+ * @brief	Chooses how colors and depths are stored. The defaults, RGB8 and DOUBLE,
+ * 			are the most exact. FLOAT32 and FIXED24 halve the bytes of each depth.
+ * 			RGBA8 makes each color one aligned 32-bit word, which setColors stores a
+ * 			whole row at a time. Single pixels (setColor, setDepth) are converted one
+ * 			at a time in any format. Colors are converted to packed RGB only when shown
+ * 			or saved. The buffers are reallocated, so clear them before use.
+ * @param	colorFormat	The color format.
+ * @param	depthFormat	The depth format.
+ */
+
+void FrameBuffer::setFormats(ColorFormat colorFormat, DepthFormat depthFormat) {
+	if (colorFormat == this->colorFormat && depthFormat == this->depthFormat) {
+		return;
+	}
+	this->colorFormat = colorFormat;
+	this->depthFormat = depthFormat;
+	allocateBuffers();
+	for (int t = 0; t < tilesWide * tilesHigh; t++) {
+		colorTileState[t] = TILE_CLEAN;
+		depthTileState[t] = TILE_CLEAN;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::setTiledLayout(bool isTiled)
+ * @brief	Chooses how pixels are stored. Row-major order matches the screen. In the
+ * 			tiled layout each 16x16 tile is a contiguous block, so a thread rendering a
+ * 			tile writes to a few cache lines of its own instead of 16 separate rows
+ * 			shared with its neighbours. Tiled buffers are converted to row-major order
+ * 			only when shown or saved. The current contents are kept.
+ * @param	isTiled	true for the tiled layout, false for row-major.
+ */
+
+void FrameBuffer::setTiledLayout(bool isTiled) {
+	if (isTiled == this->isTiled) {
+		return;
+	}
+	finishClears();
+	GLubyte* oldColors = colorBuffer;
+	GLubyte* oldDepths = depthBuffer;
+	colorBuffer = depthBuffer = nullptr;
+	allocateBuffers();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int from = pixelIndex(x, y);
+			int to = layoutIndex(x, y, isTiled);
+			std::memcpy(colorBuffer + bytesPerColor * to, oldColors + bytesPerColor * from, bytesPerColor);
+			std::memcpy(depthBuffer + bytesPerDepth * to, oldDepths + bytesPerDepth * from, bytesPerDepth);
+		}
+	}
+	::operator delete[](oldColors, std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+	::operator delete[](oldDepths, std::align_val_t(FRAMEBUFFER_ALIGNMENT));
+	this->isTiled = isTiled;
+}
+
+/**
+ * @fn	BoundingBoxi FrameBuffer::getTileBounds(int tile) const
+ * @brief	The pixels covered by a tile. Tiles on the right and top edges may be
+ * 			smaller than 16x16.
+ * @param	tile	The tile's index.
+ * @return	The tile's bounds.
+ */
+
+BoundingBoxi FrameBuffer::getTileBounds(int tile) const {
+	int lx = (tile % tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	int ly = (tile / tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	return BoundingBoxi(lx, glm::min(FRAMEBUFFER_TILE_SIZE, width - lx),
+						ly, glm::min(FRAMEBUFFER_TILE_SIZE, height - ly));
+}
+
+/**
+ * @fn	void FrameBuffer::setColors(const BoundingBoxi &block, const color *colors)
+ * @brief	Writes a block of colors at once, as a tile renderer would when it has
+ * 			finished a tile. Pixels outside of the window are skipped. The block is
+ * 			written a tile at a time. When a tile's lazy clear is pending, only the
+ * 			pixels of the tile that the block does not cover are cleared, so a tile
+ * 			that the block covers whole is never cleared at all. If the block's writes
+ * 			were announced with expectTileWrites, each tile is counted as done.
+ * @param	block 	Where the colors go.
+ * @param	colors	block.width * block.height colors, bottom row first.
+ */
+
+void FrameBuffer::setColors(const BoundingBoxi& block, const color* colors) {
+	const int LX = glm::max(block.lx, 0);
+	const int LY = glm::max(block.ly, 0);
+	const int RX = glm::min(block.lx + block.width, width);
+	const int RY = glm::min(block.ly + block.height, height);
+	if (LX >= RX || LY >= RY) {
+		return;
+	}
+	for (int ty = LY / FRAMEBUFFER_TILE_SIZE; ty <= (RY - 1) / FRAMEBUFFER_TILE_SIZE; ty++) {
+		for (int tx = LX / FRAMEBUFFER_TILE_SIZE; tx <= (RX - 1) / FRAMEBUFFER_TILE_SIZE; tx++) {
+			const int tile = ty * tilesWide + tx;
+			const BoundingBoxi TB = getTileBounds(tile);
+			const int lx = glm::max(LX, TB.lx), rx = glm::min(RX, TB.lx + TB.width);
+			const int ly = glm::max(LY, TB.ly), ry = glm::min(RY, TB.ly + TB.height);
+			unsigned char expected = TILE_PENDING;
+			bool isClearing = colorTileState[tile].load(std::memory_order_acquire) == TILE_PENDING &&
+				colorTileState[tile].compare_exchange_strong(expected, TILE_CLEARING, std::memory_order_acq_rel);
+			if (isClearing) {
+				for (int y = TB.ly; y < TB.ly + TB.height; y++) {
+					if (y < ly || y >= ry) {
+						fillClearColor(colorBuffer + bytesPerColor * pixelIndex(TB.lx, y), TB.width);
+						continue;
+					}
+					if (lx > TB.lx) {
+						fillClearColor(colorBuffer + bytesPerColor * pixelIndex(TB.lx, y), lx - TB.lx);
+					}
+					if (rx < TB.lx + TB.width) {
+						fillClearColor(colorBuffer + bytesPerColor * pixelIndex(rx, y), TB.lx + TB.width - rx);
+					}
+				}
+			} else {
+				finishTileClear(colorTileState, tile, true);
+			}
+			for (int y = ly; y < ry; y++) {
+				writeColors(pixelIndex(lx, y), colors + (y - block.ly) * block.width + (lx - block.lx), rx - lx);
+			}
+			if (isClearing) {
+				colorTileState[tile].store(TILE_CLEAN, std::memory_order_release);
+			}
+			markTileChanged(tile);
+			if (colorTileWriters[tile].load(std::memory_order_relaxed) > 0) {
+				colorTileWriters[tile].fetch_sub(1, std::memory_order_release);
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::expectTileWrites(const BoundingBoxi &block)
+ * @brief	Announces that a block will be written with setColors during this frame, so
+ * 			that isTileFinished can tell when a tile has no writers left. A frame's
+ * 			blocks must all be announced after the color buffer is cleared and before
+ * 			any of them is written, from one thread. Once a tile has an announced
+ * 			block, every write into it during the frame must be an announced setColors.
+ * @param	block	The block that will be written.
+ */
+
+void FrameBuffer::expectTileWrites(const BoundingBoxi& block) {
+	const int LX = glm::max(block.lx, 0);
+	const int LY = glm::max(block.ly, 0);
+	const int RX = glm::min(block.lx + block.width, width);
+	const int RY = glm::min(block.ly + block.height, height);
+	if (LX >= RX || LY >= RY) {
+		return;
+	}
+	for (int ty = LY / FRAMEBUFFER_TILE_SIZE; ty <= (RY - 1) / FRAMEBUFFER_TILE_SIZE; ty++) {
+		for (int tx = LX / FRAMEBUFFER_TILE_SIZE; tx <= (RX - 1) / FRAMEBUFFER_TILE_SIZE; tx++) {
+			std::atomic<int>& writers = colorTileWriters[ty * tilesWide + tx];
+			int n = writers.load(std::memory_order_relaxed);
+			writers.store(n == NO_WRITES_EXPECTED ? 1 : n + 1, std::memory_order_relaxed);
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::markAllTilesChanged()
+ * @brief	Flags every tile as changed (see takeTileChange).
+ */
+
+void FrameBuffer::markAllTilesChanged() {
+	for (int t = 0; t < tilesWide * tilesHigh; t++) {
+		colorTileChanged[t].store(1, std::memory_order_relaxed);
+	}
+}
+
+/**
+ * @fn	bool FrameBuffer::takeTileChange(int tile) const
+ * @brief	Reports whether a tile's colors may have changed since the last call for
+ * 			that tile, and resets the flag. Used to stream only the changed parts of an
+ * 			image while it is being rendered; may be called from another thread.
+ * @param	tile	The tile's index.
+ * @return	true iff the tile was written or cleared since the last call.
+ */
+
+bool FrameBuffer::takeTileChange(int tile) const {
+	return colorTileChanged[tile].exchange(0, std::memory_order_acq_rel) != 0;
+}
+
+/**
+ * @fn	bool FrameBuffer::isTileFinished(int tile) const
+ * @brief	Reports whether every block announced for a tile (see expectTileWrites) has
+ * 			been written, in which case nothing will write to the tile again until the
+ * 			next clear, and it may be copied while the rest of the frame renders. A tile
+ * 			with no announced blocks is never finished. May be called from another
+ * 			thread.
+ * @param	tile	The tile's index.
+ * @return	true iff the tile's colors for this frame are complete.
+ */
+
+bool FrameBuffer::isTileFinished(int tile) const {
+	return colorTileWriters[tile].load(std::memory_order_acquire) == 0;
+}
+
+/**
+ * @fn	void FrameBuffer::copyTileRGB(int tile, GLubyte *rgb) const
+ * @brief	Copies one tile's colors out as packed RGB, bottom row first. A tile whose
+ * 			lazy clear is still pending reads as the clear color. May be called from
+ * 			another thread only while nothing writes to the tile: once isTileFinished
+ * 			says so, or between frames. It must not race with resizing or clearing.
+ * @param	tile	The tile's index.
+ * @param	rgb 	Receives getTileBounds(tile).width * height pixels.
+ */
+
+void FrameBuffer::copyTileRGB(int tile, GLubyte* rgb) const {
+	BoundingBoxi bounds = getTileBounds(tile);
+	bool isPending = colorTileState[tile].load(std::memory_order_acquire) != TILE_CLEAN;
+	for (int y = bounds.ly; y < bounds.ly + bounds.height; y++) {
+		for (int x = bounds.lx; x < bounds.lx + bounds.width; x++) {
+			const GLubyte* src = isPending ? clearColorUB : colorBuffer + bytesPerColor * pixelIndex(x, y);
+			std::memcpy(rgb, src, BYTES_PER_PIXEL);
+			rgb += BYTES_PER_PIXEL;
+		}
+	}
+}
+
+/**
+ * @fn	const GLubyte* FrameBuffer::getRowMajorColors(vector<GLubyte> &scratch) const
+ * @brief	The color buffer as packed RGB in row-major order, bottom row first. Unless
+ * 			the buffer is already stored that way, this is a copy, made on demand into
+ * 			the caller's scratch buffer, so that several threads can read the same
+ * 			framebuffer at once (as a SwapChain's presenter and display may).
+ * @param [in,out]	scratch	Holds the copy, if one is needed.
+ * @return	Pointer to width * height pixels.
+ */
+
+const GLubyte* FrameBuffer::getRowMajorColors(vector<GLubyte>& scratch) const {
+	finishClears();
+	if (!isTiled && colorFormat == ColorFormat::RGB8) {
+		return colorBuffer;
+	}
+	scratch.resize(width * height * BYTES_PER_PIXEL);
+	for (int y = 0; y < height; y++) {
+		GLubyte* dest = &scratch[BYTES_PER_PIXEL * y * width];
+		// Runs of up to one tile width are contiguous in either layout.
+		for (int x = 0; x < width; x += FRAMEBUFFER_TILE_SIZE) {
+			int run = glm::min(FRAMEBUFFER_TILE_SIZE, width - x);
+			const GLubyte* src = colorBuffer + bytesPerColor * pixelIndex(x, y);
+			if (bytesPerColor == BYTES_PER_PIXEL) {
+				std::memcpy(dest + BYTES_PER_PIXEL * x, src, BYTES_PER_PIXEL * run);
+			} else {
+				for (int i = 0; i < run; i++) {
+					std::memcpy(dest + BYTES_PER_PIXEL * (x + i), src + bytesPerColor * i, BYTES_PER_PIXEL);
+				}
+			}
+		}
+	}
+	return scratch.data();
+}
+
+/**
+ * @fn	void FrameBuffer::writeColor(int index, const color &rgb)
+ * @brief	Stores a color, in the buffer's format.
+ * @param	index	Index of the pixel (see pixelIndex).
+ * @param	rgb  	The color. Clamped to [0, 1].
+ */
+
+void FrameBuffer::writeColor(int index, const color& rgb) {
+	color clampedColor = glm::clamp(rgb, 0.0, 1.0);
+	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
+					(GLubyte)(clampedColor.g * 255),
+					(GLubyte)(clampedColor.b * 255),
+					255 };
+	std::memcpy(colorBuffer + bytesPerColor * index, c, bytesPerColor);
+}
+
+/**
+ * @fn	void FrameBuffer::writeColors(int index, const color *colors, int n)
+ * @brief	Stores consecutive colors, in the buffer's format. The format is checked
+ * 			once, and each loop has a fixed pixel size, so the compiler can unroll and
+ * 			vectorize it; for RGBA8 each pixel is one aligned 32-bit store.
+ * @param	index 	Index of the first pixel (see pixelIndex).
+ * @param	colors	The colors. Clamped to [0, 1].
+ * @param	n	  	The number of colors.
+ */
+
+void FrameBuffer::writeColors(int index, const color* colors, int n) {
+	if (colorFormat == ColorFormat::RGBA8) {
+		uint32_t* dest = (uint32_t*)colorBuffer + index;
+		for (int i = 0; i < n; i++) {
+			color clampedColor = glm::clamp(colors[i], 0.0, 1.0);
+			GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
+							(GLubyte)(clampedColor.g * 255),
+							(GLubyte)(clampedColor.b * 255),
+							255 };
+			std::memcpy(dest + i, c, 4);
+		}
+	} else {
+		GLubyte* dest = colorBuffer + 3 * index;
+		for (int i = 0; i < n; i++) {
+			color clampedColor = glm::clamp(colors[i], 0.0, 1.0);
+			dest[3 * i] = (GLubyte)(clampedColor.r * 255);
+			dest[3 * i + 1] = (GLubyte)(clampedColor.g * 255);
+			dest[3 * i + 2] = (GLubyte)(clampedColor.b * 255);
+		}
+	}
+}
+
+const double FIXED24_MAX = 16777215.0;	//!< Largest 24-bit depth (represents 1.0).
+
+/**
+ * @fn	static unsigned int toFixed24(double depth)
+ * @brief	Converts a window depth to 24-bit fixed point. Window depths keep the NDC
+ * 			range, [-1, 1] (see VertexOps::getViewportTransformation), which is mapped
+ * 			onto [0, FIXED24_MAX]. Depths outside of it are clamped.
+ * @param	depth	The depth.
+ * @return	The fixed point depth.
+ */
+
+static unsigned int toFixed24(double depth) {
+	return (unsigned int)((glm::clamp(depth, -1.0, 1.0) + 1.0) / 2.0 * FIXED24_MAX + 0.5);
+}
+
+/**
+ * @fn	static double fromFixed24(unsigned int depth)
+ * @brief	Inverse of toFixed24.
+ * @param	depth	The fixed point depth.
+ * @return	The depth, in [-1, 1].
+ */
+
+static double fromFixed24(unsigned int depth) {
+	return depth / FIXED24_MAX * 2.0 - 1.0;
+}
+
+/**
+ * @fn	double FrameBuffer::readDepth(int index) const
+ * @brief	Reads a depth stored in the buffer's format.
+ * @param	index	Index of the pixel (see pixelIndex).
+ * @return	The depth.
+ */
+
+double FrameBuffer::readDepth(int index) const {
+	switch (depthFormat) {
+	case DepthFormat::FLOAT32:
+		return ((const float*)depthBuffer)[index];
+	case DepthFormat::FIXED24:
+		return fromFixed24(((const unsigned int*)depthBuffer)[index]);
+	default:
+		return ((const double*)depthBuffer)[index];
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::writeDepth(int index, double depth)
+ * @brief	Stores a depth in the buffer's format. 24-bit depths are clamped to [-1, 1]
+ * 			(see toFixed24).
+ * @param	index	Index of the pixel (see pixelIndex).
+ * @param	depth	The depth.
+ */
+
+void FrameBuffer::writeDepth(int index, double depth) {
+	switch (depthFormat) {
+	case DepthFormat::FLOAT32:
+		((float*)depthBuffer)[index] = (float)depth;
+		break;
+	case DepthFormat::FIXED24:
+		((unsigned int*)depthBuffer)[index] = toFixed24(depth);
+		break;
+	default:
+		((double*)depthBuffer)[index] = depth;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::fillClearDepth(int first, int numPixels) const
+ * @brief	Sets consecutive depths to the clear depth, 1.0.
+ * @param	first	 	Index of the first pixel.
+ * @param	numPixels	The number of pixels to fill.
+ */
+
+void FrameBuffer::fillClearDepth(int first, int numPixels) const {
+	switch (depthFormat) {
+	case DepthFormat::FLOAT32: {
+		float* depths = (float*)depthBuffer + first;
+		std::fill(depths, depths + numPixels, 1.0f);
+		break;
+	}
+	case DepthFormat::FIXED24: {
+		unsigned int* depths = (unsigned int*)depthBuffer + first;
+		std::fill(depths, depths + numPixels, toFixed24(1.0));
+		break;
+	}
+	default: {
+		double* depths = (double*)depthBuffer + first;
+		std::fill(depths, depths + numPixels, 1.0);
+	}
+	}
 }
 
 /**
@@ -61,51 +522,246 @@ void FrameBuffer::setClearColor(const color& clear) {
 	clearColorUB[0] = (GLubyte)(clear.r * 255.0);
 	clearColorUB[1] = (GLubyte)(clear.g * 255.0);
 	clearColorUB[2] = (GLubyte)(clear.b * 255.0);
+	clearColorUB[3] = 255;
 }
 
 /**
- * @fn	void FrameBuffer::clearColorAndDepthBuffers()
+ * @fn	void FrameBuffer::clearColorAndDepthBuffers(bool lazily)
  * @brief	Clears the color and depth buffers
+ * @param	lazily	If true, see clearColorBuffer.
  */
 
-void FrameBuffer::clearColorAndDepthBuffers() {
-	clearColorBuffer();
-	clearDepthBuffer();
+void FrameBuffer::clearColorAndDepthBuffers(bool lazily) {
+	clearColorBuffer(lazily);
+	clearDepthBuffer(lazily);
 }
 
 /**
- * @fn	void FrameBuffer::clearColorBuffer()
- * @brief	Clears the color buffer
+ * @fn	void FrameBuffer::fillClearColor(GLubyte *dest, int numPixels) const
+ * @brief	Fills consecutive pixels with the clear color. One pixel is written and
+ * 			then the filled region is repeatedly doubled with memcpy, so nearly all of
+ * 			the work is done by wide block copies.
+ * @param	dest	 	The first pixel to fill.
+ * @param	numPixels	The number of pixels to fill.
  */
 
-void FrameBuffer::clearColorBuffer() {
-	for (int y = 0; y < height; ++y) {		// can be made faster
-		for (int x = 0; x < width; ++x) {
-			std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width),
-											clearColorUB, BYTES_PER_PIXEL);
+void FrameBuffer::fillClearColor(GLubyte* dest, int numPixels) const {
+	if (numPixels <= 0) {
+		return;
+	}
+	const int TOTAL = numPixels * bytesPerColor;
+	std::memcpy(dest, clearColorUB, bytesPerColor);
+	int filled = bytesPerColor;
+	while (filled < TOTAL) {
+		int n = glm::min(filled, TOTAL - filled);
+		std::memcpy(dest + filled, dest, n);
+		filled += n;
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearColorBuffer(bool lazily)
+ * @brief	Clears the color buffer. A lazy clear only marks every tile as needing a
+ * 			clear. A tile is then cleared just before the first write into it, and any
+ * 			tile that is never written is cleared by finishClears (which is called by
+ * 			showColorBuffer). setColor still clears a whole tile on its first write, but
+ * 			setColors clears only the part of a tile that its block leaves uncovered, so
+ * 			a renderer that writes whole tiles with it, like the ray tracer, never
+ * 			clears them.
+ * @param	lazily	true to defer clearing until tiles are used.
+ */
+
+void FrameBuffer::clearColorBuffer(bool lazily) {
+	const int NUM_TILES = tilesWide * tilesHigh;
+	for (int t = 0; t < NUM_TILES; t++) {
+		colorTileWriters[t].store(NO_WRITES_EXPECTED, std::memory_order_relaxed);
+	}
+	markAllTilesChanged();
+	if (lazily) {
+		for (int t = 0; t < NUM_TILES; t++) {
+			colorTileState[t].store(TILE_PENDING, std::memory_order_relaxed);
+		}
+	} else {
+		fillClearColor(colorBuffer, bufferSize);
+		for (int t = 0; t < NUM_TILES; t++) {
+			colorTileState[t].store(TILE_CLEAN, std::memory_order_relaxed);
 		}
 	}
+	// Last, so that a thread that sees the new frame number also sees the above.
+	frameNumber++;
 }
 
 /**
- * @fn	void FrameBuffer::clearDepthBuffer()
+ * @fn	void FrameBuffer::clearDepthBuffer(bool lazily)
  * @brief	Clears the depth buffer
+ * @param	lazily	true to defer clearing until tiles are used (see clearColorBuffer).
  */
 
-void FrameBuffer::clearDepthBuffer() {
-	int area = width * height;
-	const int SZ = area;
-	std::fill(depthBuffer, depthBuffer + SZ, 1.0);
+void FrameBuffer::clearDepthBuffer(bool lazily) {
+	const int NUM_TILES = tilesWide * tilesHigh;
+	if (lazily) {
+		for (int t = 0; t < NUM_TILES; t++) {
+			depthTileState[t].store(TILE_PENDING, std::memory_order_relaxed);
+		}
+	} else {
+		fillClearDepth(0, bufferSize);
+		for (int t = 0; t < NUM_TILES; t++) {
+			depthTileState[t].store(TILE_CLEAN, std::memory_order_relaxed);
+		}
+	}
 }
+
+/**
+ * @fn	void FrameBuffer::clearColorTile(int tile) const
+ * @brief	Fills one tile of the color buffer with the clear color.
+ * @param	tile	The tile's index.
+ */
+
+void FrameBuffer::clearColorTile(int tile) const {
+	if (isTiled) {
+		fillClearColor(colorBuffer + bytesPerColor * tile * FRAMEBUFFER_TILE_AREA, FRAMEBUFFER_TILE_AREA);
+		return;
+	}
+	int lx = (tile % tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	int ly = (tile / tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	int w = glm::min(FRAMEBUFFER_TILE_SIZE, width - lx);
+	int h = glm::min(FRAMEBUFFER_TILE_SIZE, height - ly);
+	GLubyte* firstRow = colorBuffer + bytesPerColor * (lx + ly * pitch);
+	fillClearColor(firstRow, w);
+	for (int y = 1; y < h; y++) {
+		std::memcpy(firstRow + bytesPerColor * y * pitch, firstRow, bytesPerColor * w);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::clearDepthTile(int tile) const
+ * @brief	Fills one tile of the depth buffer with the clear depth.
+ * @param	tile	The tile's index.
+ */
+
+void FrameBuffer::clearDepthTile(int tile) const {
+	if (isTiled) {
+		fillClearDepth(tile * FRAMEBUFFER_TILE_AREA, FRAMEBUFFER_TILE_AREA);
+		return;
+	}
+	int lx = (tile % tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	int ly = (tile / tilesWide) * FRAMEBUFFER_TILE_SIZE;
+	int w = glm::min(FRAMEBUFFER_TILE_SIZE, width - lx);
+	int h = glm::min(FRAMEBUFFER_TILE_SIZE, height - ly);
+	for (int y = ly; y < ly + h; y++) {
+		fillClearDepth(lx + y * pitch, w);
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::finishTileClear(std::atomic<unsigned char> *states, int tile, bool isColor) const
+ * @brief	Makes sure a tile has been cleared before it is written. Safe to call from
+ * 			several threads at once: one thread clears the tile while any others that
+ * 			need the same tile wait for it.
+ * @param	states 	colorTileState or depthTileState.
+ * @param	tile   	The tile's index.
+ * @param	isColor	true for the color buffer, false for the depth buffer.
+ */
+
+void FrameBuffer::finishTileClear(std::atomic<unsigned char>* states, int tile, bool isColor) const {
+	if (states[tile].load(std::memory_order_acquire) == TILE_CLEAN) {
+		return;
+	}
+	unsigned char expected = TILE_PENDING;
+	if (states[tile].compare_exchange_strong(expected, TILE_CLEARING, std::memory_order_acq_rel)) {
+		if (isColor) {
+			clearColorTile(tile);
+		} else {
+			clearDepthTile(tile);
+		}
+		states[tile].store(TILE_CLEAN, std::memory_order_release);
+	} else {
+		while (states[tile].load(std::memory_order_acquire) != TILE_CLEAN) {
+			std::this_thread::yield();
+		}
+	}
+}
+
+/**
+ * @fn	void FrameBuffer::finishClears() const
+ * @brief	Clears every tile that still has a lazy clear pending. Must be called before
+ * 			the color or depth buffer is read directly.
+ */
+
+void FrameBuffer::finishClears() const {
+	for (int t = 0; t < tilesWide * tilesHigh; t++) {
+		finishTileClear(colorTileState, t, true);
+		finishTileClear(depthTileState, t, false);
+	}
+}
+
 /**
  * @fn	void FrameBuffer::showColorBuffer() const
- * @brief	Shows the contents of the color buffer to screen.
+ * @brief	Shows the contents of the color buffer to screen. When compiled with
+ * 			CONSOLE_ONLY there is no screen; the image stays in memory and can be
+ * 			saved with writePPM or writePAM.
  */
 
 void FrameBuffer::showColorBuffer() const {
+	vector<GLubyte> scratch;
+	const GLubyte* pixels = getRowMajorColors(scratch);
+#ifndef CONSOLE_ONLY
 	glRasterPos2d(-1, -1);
-	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, colorBuffer);
+	glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
 	glFlush();
+#endif
+}
+
+/**
+ * @fn	bool FrameBuffer::writePPM(const std::string &fileName) const
+ * @brief	Writes the color buffer to a binary (P6) PPM file.
+ * @param	fileName	Name of the file.
+ * @return	true iff the file was written.
+ */
+
+bool FrameBuffer::writePPM(const std::string& fileName) const {
+	std::ostringstream header;
+	header << "P6\n" << width << " " << height << "\n255\n";
+	return writeImage(fileName, header.str());
+}
+
+/**
+ * @fn	bool FrameBuffer::writePAM(const std::string &fileName) const
+ * @brief	Writes the color buffer to a PAM (P7) file with tuple type RGB.
+ * @param	fileName	Name of the file.
+ * @return	true iff the file was written.
+ */
+
+bool FrameBuffer::writePAM(const std::string& fileName) const {
+	std::ostringstream header;
+	header << "P7\nWIDTH " << width << "\nHEIGHT " << height
+		<< "\nDEPTH " << BYTES_PER_PIXEL << "\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n";
+	return writeImage(fileName, header.str());
+}
+
+/**
+ * @fn	bool FrameBuffer::writeImage(const std::string &fileName, const std::string &header) const
+ * @brief	Writes a header followed by the color buffer's rows. Image files list the
+ * 			top row first, while row 0 of the framebuffer is the bottom row.
+ * @param	fileName	Name of the file.
+ * @param	header  	The complete file header.
+ * @return	true iff the file was written.
+ */
+
+bool FrameBuffer::writeImage(const std::string& fileName, const std::string& header) const {
+	vector<GLubyte> scratch;
+	const GLubyte* pixels = getRowMajorColors(scratch);
+	std::ofstream output(fileName.c_str(), std::ios::binary);
+	if (!output) {
+		std::cerr << "Unable to open " << fileName << endl;
+		return false;
+	}
+	output << header;
+	const int ROW_BYTES = BYTES_PER_PIXEL * width;
+	for (int y = height - 1; y >= 0; y--) {
+		output.write((const char*)(pixels + y * ROW_BYTES), ROW_BYTES);
+	}
+	return (bool)output;
 }
 
 /**
@@ -130,13 +786,9 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 		return;
 	}
 
-	color clampedColor = glm::clamp(rgb, 0.0, 1.0);
-
-	GLubyte c[] = { (GLubyte)(clampedColor.r * 255),
-					(GLubyte)(clampedColor.g * 255),
-					(GLubyte)(clampedColor.b * 255) };
-
-	std::memcpy(colorBuffer + BYTES_PER_PIXEL * (x + y * width), c, BYTES_PER_PIXEL);
+	finishTileClear(colorTileState, tileIndex(x, y), true);
+	writeColor(pixelIndex(x, y), rgb);
+	markTileChanged(tileIndex(x, y));
 }
 
 /**
@@ -150,11 +802,12 @@ void FrameBuffer::setColor(int x, int y, const color& rgb) {
 color FrameBuffer::getColor(int x, int y) const {
 	double red, green, blue;
 
-	if (checkInWindow(x, y)) {
+	if (checkInWindow(x, y) &&
+		colorTileState[tileIndex(x, y)].load(std::memory_order_acquire) == TILE_CLEAN) {
 		GLubyte c[BYTES_PER_PIXEL];
 
 		// Retrieve color values from the color buffer
-		std::memcpy(c, colorBuffer + BYTES_PER_PIXEL * (x + y * width), BYTES_PER_PIXEL);
+		std::memcpy(c, colorBuffer + bytesPerColor * pixelIndex(x, y), BYTES_PER_PIXEL);
 
 		// Convert individual color components back to double values
 		red = c[0] / 255.0;
@@ -190,7 +843,8 @@ void FrameBuffer::setDepth(double x, double y, double depth) {
 
 void FrameBuffer::setDepth(int x, int y, double depth) {
 	if (checkInWindow(x, y)) {
-		depthBuffer[y * width + x] = depth;
+		finishTileClear(depthTileState, tileIndex(x, y), false);
+		writeDepth(pixelIndex(x, y), depth);
 	}
 }
 
@@ -204,7 +858,10 @@ void FrameBuffer::setDepth(int x, int y, double depth) {
 
 double FrameBuffer::getDepth(int x, int y) const {
 	if (checkInWindow(x, y)) {
-		return depthBuffer[y * width + x];
+		if (depthTileState[tileIndex(x, y)].load(std::memory_order_acquire) != TILE_CLEAN) {
+			return 1.0;
+		}
+		return readDepth(pixelIndex(x, y));
 	} else {
 		return 0.0;
 	}
@@ -314,10 +971,44 @@ double solve(double A, double B, double C) {
  */
 
 void FrameBuffer::showAxes(int x, int y, const Ray& ray, double thickness) {
-	color currColor = getColor(x, y);
-	static const QuadricParameters X = QuadricParameters::cylinderXQParams(thickness);
-	static const QuadricParameters Y = QuadricParameters::cylinderYQParams(thickness);
-	static const QuadricParameters Z = QuadricParameters::cylinderZQParams(thickness);
+	int axis = axisHitAt(x, y, ray, thickness);
+	if (axis != NO_AXIS) {
+		setColor(x, y, axisColor(axis));
+	}
+}
+
+/**
+ * @fn	color FrameBuffer::axisColor(int axis)
+ * @brief	The color used to draw an axis.
+ * @param	axis	X_AXIS_HIT, Y_AXIS_HIT or Z_AXIS_HIT.
+ * @return	Red, green or blue (black for NO_AXIS).
+ */
+
+color FrameBuffer::axisColor(int axis) {
+	static const color COLORS[] = { black, red, green, blue };
+	return COLORS[axis];
+}
+
+/**
+ * @fn	int FrameBuffer::axisHitAt(int x, int y, const Ray &ray, double thickness)
+ * @brief	Determines which axis, if any, showAxes would draw for a ray. Only every
+ * 			other pixel in each direction is ever drawn. Depends only on the ray, so
+ * 			the results can be cached for as long as the camera stays put.
+ * @param	x		  	The x coordinate in the framebuffer
+ * @param	y		  	The y coordinate in the framebuffer
+ * @param	ray		  	The viewing ray
+ * @param	thickness 	how wide the axes should appear
+ * @return	NO_AXIS, X_AXIS_HIT, Y_AXIS_HIT or Z_AXIS_HIT.
+ */
+
+int FrameBuffer::axisHitAt(int x, int y, const Ray& ray, double thickness) {
+	const int W = 2;
+	if (x % W != 0 || y % W != 0) {		// color every other pixel
+		return NO_AXIS;
+	}
+	const QuadricParameters X = QuadricParameters::cylinderXQParams(thickness);
+	const QuadricParameters Y = QuadricParameters::cylinderYQParams(thickness);
+	const QuadricParameters Z = QuadricParameters::cylinderZQParams(thickness);
 	const double AqX = computeAq(X, ray);
 	const double BqX = computeBq(X, ray);
 	const double CqX = computeCq(X, ray);
@@ -333,20 +1024,18 @@ void FrameBuffer::showAxes(int x, int y, const Ray& ray, double thickness) {
 	const dvec3 interceptWithXTube = ray.getPoint(tX);
 	const dvec3 interceptWithYTube = ray.getPoint(tY);
 	const dvec3 interceptWithZTube = ray.getPoint(tZ);
-	const int W = 2;
 	bool inXTube = glm::sqrt(glm::pow(ray.origin.y, 2.0) + glm::pow(ray.origin.z, 2.0)) <= thickness;
 	bool inYTube = glm::sqrt(glm::pow(ray.origin.x, 2.0) + glm::pow(ray.origin.z, 2.0)) <= thickness;
 	bool inZTube = glm::sqrt(glm::pow(ray.origin.x, 2.0) + glm::pow(ray.origin.y, 2.0)) <= thickness;
 
-	if (x % W == 0 && y % W == 0) {		// color every other pixel
-		if (tX >= 0 && interceptWithXTube.x >= 0 && !inXTube) {
-			setColor(x, y, red);
-		} else if (tY > 0 && interceptWithYTube.y >= 0 && !inYTube) {
-			setColor(x, y, green);
-		} else if (tZ > 0 && interceptWithZTube.z >= 0 && !inZTube) {
-			setColor(x, y, blue);
-		}
+	if (tX >= 0 && interceptWithXTube.x >= 0 && !inXTube) {
+		return X_AXIS_HIT;
+	} else if (tY > 0 && interceptWithYTube.y >= 0 && !inYTube) {
+		return Y_AXIS_HIT;
+	} else if (tZ > 0 && interceptWithZTube.z >= 0 && !inZTube) {
+		return Z_AXIS_HIT;
 	}
+	return NO_AXIS;
 }
 
 void dot(FrameBuffer& fb, int x, int y, int W, const color& C, double Z) {
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <atomic>
 #include "defs.h"
 #include "ishape.h"
 #include "colorandmaterials.h"
@@ -18,6 +19,29 @@
 #endif
 
 const int BYTES_PER_PIXEL = 3;			//!< RGB requires 3 bytes.
+const int FRAMEBUFFER_ALIGNMENT = 32;	//!< Byte alignment of the buffers (and of RGBA rows).
+
+enum { NO_AXIS, X_AXIS_HIT, Y_AXIS_HIT, Z_AXIS_HIT };	//!< Results of FrameBuffer::axisHitAt.
+const int FRAMEBUFFER_TILE_SIZE = 16;	//!< Width and height of a tile (lazy clears, tiled layout).
+const int FRAMEBUFFER_TILE_AREA = FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE;	//!< Pixels per tile.
+const int NO_WRITES_EXPECTED = -1;		//!< Tile writer count when no blocks were announced (see expectTileWrites).
+
+/**
+ * @enum	ColorFormat
+ * @brief	How the color buffer stores each pixel. RGBA8 spends a byte per pixel on an
+ * 			unused alpha channel so that every pixel is one aligned 32-bit word.
+ */
+
+enum class ColorFormat { RGB8, RGBA8 };
+
+/**
+ * @enum	DepthFormat
+ * @brief	How the depth buffer stores each pixel: 64-bit double, 32-bit float,
+ * 			or 24-bit fixed point spanning the window depth range, [-1, 1] (held in the
+ * 			low bits of a 32-bit word).
+ */
+
+enum class DepthFormat { DOUBLE, FLOAT32, FIXED24 };
 
 /**
  * @struct	FrameBuffer
@@ -30,17 +54,33 @@ struct FrameBuffer {
 	FrameBuffer(const int width, const int height);
 	~FrameBuffer();
 	void setFrameBufferSize(int width, int height);
+	void setTiledLayout(bool isTiled);
+	bool hasTiledLayout() const { return isTiled; }
+	void setFormats(ColorFormat colorFormat, DepthFormat depthFormat);
+	ColorFormat getColorFormat() const { return colorFormat; }
+	DepthFormat getDepthFormat() const { return depthFormat; }
 	void setClearColor(const color& clearColor);
 	void setColor(int x, int y, const color& C);
 	color getClearColor();
 	color getColor(int x, int y) const;
 
-	void clearColorAndDepthBuffers();
-	void clearColorBuffer();
-	void clearDepthBuffer();
+	void clearColorAndDepthBuffers(bool lazily = false);
+	void clearColorBuffer(bool lazily = false);
+	void clearDepthBuffer(bool lazily = false);
+	void finishClears() const;
 	void showColorBuffer() const;
+	bool writePPM(const std::string& fileName) const;
+	bool writePAM(const std::string& fileName) const;
 	int getWindowWidth() const { return width; }
 	int getWindowHeight() const { return height; }
+	int getNumTiles() const { return tilesWide * tilesHigh; }
+	BoundingBoxi getTileBounds(int tile) const;
+	void setColors(const BoundingBoxi& block, const color* colors);
+	unsigned int getFrameNumber() const { return frameNumber; }
+	bool takeTileChange(int tile) const;
+	void expectTileWrites(const BoundingBoxi& block);
+	bool isTileFinished(int tile) const;
+	void copyTileRGB(int tile, GLubyte* rgb) const;
 
 	void setDepth(double x, double y, double depth);
 	void setDepth(int x, int y, double depth);
@@ -48,6 +88,8 @@ struct FrameBuffer {
 	double getDepth(double x, double y) const;
 
 	void showAxes(int x, int y, const Ray& ray, double thickness);
+	static int axisHitAt(int x, int y, const Ray& ray, double thickness);
+	static color axisColor(int axis);
 	void showAxes(const dmat4& VM, const dmat4& PM, const dmat4& VPM,
 		const BoundingBoxi& viewport);
 	void setPixel(int x, int y, const color& C, double depth);
@@ -55,8 +97,48 @@ protected:
 	bool checkInWindow(int x, int y) const;
 	int width;								//!< width of framebuffer
 	int height;								//!< height of framebuffer
-	GLubyte clearColorUB[BYTES_PER_PIXEL];	//!< Clear color, as unsigned bytes
+	GLubyte clearColorUB[4];				//!< Clear color, as unsigned bytes (alpha is 255)
 	color clearColor;						//!< Clear color
 	GLubyte* colorBuffer;					//!< 2D array for holding colors
-	double* depthBuffer;					//!< 2D array for holding depths
+	GLubyte* depthBuffer;					//!< 2D array for holding depths, in depthFormat
+	ColorFormat colorFormat;				//!< Format of each color.
+	DepthFormat depthFormat;				//!< Format of each depth.
+	int bytesPerColor;						//!< 3 for RGB8, 4 for RGBA8.
+	int bytesPerDepth;						//!< 8 for DOUBLE, 4 otherwise.
+	bool isTiled;							//!< true if pixels are stored tile by tile.
+	int pitch;								//!< Pixels from one row to the next (row-major layout).
+	int tilesWide, tilesHigh;				//!< Number of tiles in each direction.
+	int bufferSize;							//!< Pixels allocated, a whole number of tiles.
+	std::atomic<unsigned char>* colorTileState;	//!< Lazy clear state of each color tile.
+	std::atomic<unsigned char>* depthTileState;	//!< Lazy clear state of each depth tile.
+	std::atomic<unsigned char>* colorTileChanged;	//!< Per tile, true if its colors changed.
+	std::atomic<int>* colorTileWriters;		//!< Per tile, announced blocks not yet written, or NO_WRITES_EXPECTED.
+	std::atomic<unsigned int> frameNumber;	//!< Incremented by every color clear.
+
+	int tileIndex(int x, int y) const { return (y / FRAMEBUFFER_TILE_SIZE) * tilesWide + x / FRAMEBUFFER_TILE_SIZE; }
+	void markTileChanged(int tile) {
+		colorTileChanged[tile].store(1, std::memory_order_release);
+	}
+	void markAllTilesChanged();
+	int pixelIndex(int x, int y) const { return layoutIndex(x, y, isTiled); }
+	int layoutIndex(int x, int y, bool tiled) const {
+		if (!tiled) {
+			return y * pitch + x;
+		}
+		return tileIndex(x, y) * FRAMEBUFFER_TILE_AREA +
+			(y % FRAMEBUFFER_TILE_SIZE) * FRAMEBUFFER_TILE_SIZE + x % FRAMEBUFFER_TILE_SIZE;
+	}
+	void allocateBuffers();
+	void freeBuffers();
+	void writeColor(int index, const color& rgb);
+	void writeColors(int index, const color* colors, int n);
+	double readDepth(int index) const;
+	void writeDepth(int index, double depth);
+	void fillClearDepth(int first, int numPixels) const;
+	const GLubyte* getRowMajorColors(vector<GLubyte>& scratch) const;
+	void fillClearColor(GLubyte* dest, int numPixels) const;
+	void clearColorTile(int tile) const;
+	void clearDepthTile(int tile) const;
+	void finishTileClear(std::atomic<unsigned char>* states, int tile, bool isColor) const;
+	bool writeImage(const std::string& fileName, const std::string& header) const;
 };
\ No newline at end of file
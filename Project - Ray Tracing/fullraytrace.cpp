@@ -8,6 +8,10 @@
  ****************************************************/
 
 #include <ctime>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "defs.h"
 #include "io.h"
 #include "ishape.h"
@@ -16,10 +20,14 @@
 #include "iscene.h"
 #include "light.h"
 #include "image.h"
+#include "textureregistry.h"
 #include "camera.h"
 #include "rasterization.h"
+#include "swapchain.h"
+#include "tilestream.h"
 
-Image im("usflag.ppm");
+TextureRegistry textures;
+Image* im = textures.get("usflag.ppm");
 int currLight = 0;
 double angle = 0.5;
 const int MAX = 10;
@@ -32,12 +40,17 @@ bool multiViewOn = false;
 double spotDirX = 0;
 double spotDirY = -1;
 double spotDirZ = 0;
+bool shadowMapsOn = false;
+int shadowMapResolution = 256;
+double shadowMapBias = 0.05;
 
 dvec3 cameraPos1(5, 5, 5);
 dvec3 cameraFocus1(0, 5, 0);
 dvec3 cameraUp1 = Y_AXIS;
 
 double cameraFOV = glm::radians(120.0);
+PerspectiveCamera camera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, WINDOW_WIDTH, WINDOW_HEIGHT);
+OrthographicCamera orthoCamera(cameraPos1, cameraFocus1, cameraUp1, WINDOW_WIDTH / 2, WINDOW_HEIGHT, 0.1);
 
 vector<PositionalLightPtr> lights = {
 						new PositionalLight(dvec3(0, 20, 0), white),
@@ -50,26 +63,120 @@ vector<PositionalLightPtr> lights = {
 PositionalLightPtr posLight = lights[0];
 SpotLightPtr spotLight = (SpotLightPtr)lights[1];
 
-FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+SwapChain swapChain(WINDOW_WIDTH, WINDOW_HEIGHT, 3, true);
 RayTracer rayTrace(paleGreen);
 IScene scene;
 
-void render() {
-	int frameStartTime = glutGet(GLUT_ELAPSED_TIME);
+// If CSE386_TILE_SOCKET names a socket, frames are also streamed to a tileviewer
+// listening there, while they are rendered.
+const char* tileSocket = std::getenv("CSE386_TILE_SOCKET");
+TilePublisher* tilePublisher = tileSocket != nullptr ? new TilePublisher(tileSocket) : nullptr;
+
+// Frames are rendered on their own thread. sceneLock is held while a frame
+// renders and while the GLUT thread changes anything the renderer reads.
+std::mutex sceneLock;
+std::condition_variable frameWanted;
+bool frameRequested = false;
+bool isQuitting = false;
+int windowWidth = WINDOW_WIDTH;
+int windowHeight = WINDOW_HEIGHT;
+
+void render(FrameBuffer& frameBuffer) {
+	int frameStartTime = elapsedMilliseconds();
 	int width = frameBuffer.getWindowWidth();
 	int height = frameBuffer.getWindowHeight();
-	scene.camera = new PerspectiveCamera(cameraPos1, cameraFocus1, cameraUp1, cameraFOV, width, height);
-	rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	camera.setFrame(cameraPos1, cameraFocus1, cameraUp1);
+	camera.setFOV(cameraFOV);
+	if (multiViewOn) {
+		// Perspective on the left, orthographic on the right.
+		int leftWidth = width / 2;
+		camera.setSize(leftWidth, height);
+		orthoCamera.setFrame(cameraPos1, cameraFocus1, cameraUp1);
+		orthoCamera.setSize(width - leftWidth, height);
+		vector<RaytracingCamera*> cameras = { &camera, &orthoCamera };
+		vector<BoundingBoxi> viewports = { BoundingBoxi(0, leftWidth, 0, height),
+											BoundingBoxi(leftWidth, width - leftWidth, 0, height) };
+		rayTrace.raytraceViews(frameBuffer, scene, cameras, viewports, antiAliasing);
+	} else {
+		camera.setSize(width, height);
+		rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	}
 
-	int frameEndTime = glutGet(GLUT_ELAPSED_TIME); // Get end time
+	int frameEndTime = elapsedMilliseconds(); // Get end time
 	double totalTimeSec = (frameEndTime - frameStartTime) / 1000.0;
 	cout << "Render time: " << totalTimeSec << " sec." << endl;
+	textures.trim();
+}
+
+/**
+ * @fn	void renderAndStream(FrameBuffer& frameBuffer)
+ * @brief	Renders a frame into the swap chain's back buffer, streaming its tiles to the
+ * 			tile viewer (if any) as they are finished. The swap publishes the rest.
+ * @param	frameBuffer	The back buffer.
+ */
+
+void renderAndStream(FrameBuffer& frameBuffer) {
+	if (tilePublisher != nullptr) {
+		tilePublisher->beginFrame(frameBuffer, swapChain.getFrameCount() + 1);
+	}
+	render(frameBuffer);
+	if (tilePublisher != nullptr) {
+		tilePublisher->endFrame();
+	}
+}
+
+/**
+ * @fn	void requestFrame()
+ * @brief	Asks the render thread for a new frame. Requests made while a frame is
+ * 			rendering are combined into one.
+ */
+
+void requestFrame() {
+	{
+		std::lock_guard<std::mutex> guard(sceneLock);
+		frameRequested = true;
+	}
+	frameWanted.notify_one();
+}
+
+/**
+ * @fn	void renderLoop()
+ * @brief	Body of the render thread. Renders into the swap chain's back buffer
+ * 			whenever a frame is requested. Showing the frame is left to the GLUT
+ * 			thread, so the renderer never waits on the display.
+ */
+
+void renderLoop() {
+	std::unique_lock<std::mutex> guard(sceneLock);
+	while (true) {
+		frameWanted.wait(guard, []() { return frameRequested || isQuitting; });
+		if (isQuitting) {
+			return;
+		}
+		frameRequested = false;
+		renderAndStream(swapChain.getBackBuffer());
+		guard.unlock();
+		swapChain.swap();
+		guard.lock();
+	}
+}
+
+#ifndef CONSOLE_ONLY
+void display() {
+	swapChain.showFrontBuffer();
 }
 
 void resize(int width, int height) {
-	frameBuffer.setFrameBufferSize(width, height);
+	{
+		std::lock_guard<std::mutex> guard(sceneLock);
+		windowWidth = width;
+		windowHeight = height;
+	}
+	swapChain.setSize(width, height);
+	requestFrame();
 	glutPostRedisplay();
 }
+#endif
 
 IPlane* plane = new IPlane(dvec3(0.0, -2.0, 0.0), dvec3(0.0, 1.0, 0.0));
 ICylinderY* cylinderY = new ICylinderY(dvec3(5.0, 0.0, -5.0), 3.0, 5.0);
@@ -82,7 +189,7 @@ IPlane* clearPlane = new IPlane(dvec3(0.0, 0.0, 0.0), dvec3(0.0, 0.0, 1.0));
 
 void buildScene() {
     scene.addOpaqueObject(new VisibleIShape(plane, tin));
-    scene.addOpaqueObject(new VisibleIShape(cylinderY, silver, &im));
+    scene.addOpaqueObject(new VisibleIShape(cylinderY, silver, im));
     scene.addOpaqueObject(new VisibleIShape(cylinderZ, redPlastic));
     scene.addOpaqueObject(new VisibleIShape(closedCylinderY, cyanPlastic));
     scene.addOpaqueObject(new VisibleIShape(sphere1, gold));
@@ -92,6 +199,62 @@ void buildScene() {
 
 	scene.addLight(lights[0]);
 	scene.addLight(lights[1]);
+	scene.camera = &camera;
+}
+
+void setShadowMaps(bool isOn) {
+	for (PositionalLightPtr light : lights) {
+		light->shadowMap.isOn = isOn;
+		light->shadowMap.resolution = shadowMapResolution;
+		light->shadowMap.bias = shadowMapBias;
+	}
+}
+
+void compareShadowModes() {
+	const int W = windowWidth;
+	const int H = windowHeight;
+	static FrameBuffer frameBuffer(W, H);
+	frameBuffer.setFrameBufferSize(W, H);
+	camera.setSize(W, H);
+	vector<color> exactColors(W * H);
+
+	setShadowMaps(false);
+	int startTime = elapsedMilliseconds();
+	rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	double exactSec = (elapsedMilliseconds() - startTime) / 1000.0;
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			exactColors[y * W + x] = frameBuffer.getColor(x, y);
+		}
+	}
+
+	setShadowMaps(true);
+	for (PositionalLightPtr light : lights) {
+		light->shadowMap.invalidate();
+	}
+	startTime = elapsedMilliseconds();
+	rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	double buildSec = (elapsedMilliseconds() - startTime) / 1000.0;
+	startTime = elapsedMilliseconds();
+	rayTrace.raytraceScene(frameBuffer, 0, scene, antiAliasing);
+	double mapSec = (elapsedMilliseconds() - startTime) / 1000.0;
+
+	int numDifferent = 0;
+	for (int y = 0; y < H; y++) {
+		for (int x = 0; x < W; x++) {
+			if (!ave(exactColors[y * W + x], frameBuffer.getColor(x, y))) {
+				numDifferent++;
+			}
+		}
+	}
+	setShadowMaps(shadowMapsOn);
+
+	cout << "Shadow feelers: " << exactSec << " sec. Shadow maps ("
+		<< shadowMapResolution << "x" << shadowMapResolution << ", bias "
+		<< shadowMapBias << "): " << mapSec << " sec, or " << buildSec
+		<< " sec. when the maps are built." << endl;
+	cout << "Pixels that differ: " << numDifferent << " of " << W * H
+		<< " (" << 100.0 * numDifferent / (W * H) << "%)" << endl;
 }
 
 void incrementClamp(double& v, double delta, double lo, double hi) {
@@ -102,7 +265,7 @@ void incrementClamp(int& v, int delta, int lo, int hi) {
 	v = glm::clamp(v + delta, lo, hi);
 }
 
-void timer(int id) {
+void advanceAnimation() {
 	if (isAnimated) {
 		z += inc;
 		if (z <= -MAX) {
@@ -112,11 +275,21 @@ void timer(int id) {
 		}
 	}
 	clearPlane->a = dvec3(0, 0, z);
+}
+
+#ifndef CONSOLE_ONLY
+void timer(int id) {
+	std::unique_lock<std::mutex> guard(sceneLock);
+	advanceAnimation();
+	guard.unlock();
+	requestFrame();
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	glutPostRedisplay();
 }
+#endif
 
 void keyboard(unsigned char key, int x, int y) {
+	std::unique_lock<std::mutex> guard(sceneLock);
 	int W, H;
 	const double INC = 0.5;
 	switch (key) {
@@ -191,12 +364,14 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	case 'U':
 	case 'u':	incrementClamp(cameraFOV, isupper(key) ? 0.2 : -0.2, glm::radians(10.0), glm::radians(160.0));
-		W = frameBuffer.getWindowWidth();
-		H = frameBuffer.getWindowWidth();
+		W = windowWidth;
+		H = windowWidth;
 		cout << cameraFOV << endl;
 		break;
 	case 'M':
-	case 'm':	break;
+	case 'm':	rayTrace.filtersTextures = !rayTrace.filtersTextures;
+		cout << (rayTrace.filtersTextures ? "Filtered textures" : "Nearest texel textures") << endl;
+		break;
 	case '+':	antiAliasing = 3;
 		cout << "Anti aliasing: " << antiAliasing << endl;
 		break;
@@ -205,6 +380,33 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 
 	case '?':	multiViewOn = !multiViewOn;
+		cout << (multiViewOn ? "Multiple views" : "Single view") << endl;
+		break;
+	case 'S':
+	case 's':	shadowMapsOn = !shadowMapsOn;
+		setShadowMaps(shadowMapsOn);
+		cout << (shadowMapsOn ? "Shadow maps" : "Shadow feelers") << endl;
+		break;
+	case 'G':
+	case 'g':	incrementClamp(shadowMapResolution, isupper(key) ? shadowMapResolution : -shadowMapResolution / 2, 16, 4096);
+		setShadowMaps(shadowMapsOn);
+		cout << "Shadow map resolution: " << shadowMapResolution << endl;
+		break;
+	case 'H':
+	case 'h':	incrementClamp(shadowMapBias, isupper(key) ? 0.01 : -0.01, 0.0, 1.0);
+		setShadowMaps(shadowMapsOn);
+		cout << "Shadow map bias: " << shadowMapBias << endl;
+		break;
+	case 'N':
+	case 'n':	compareShadowModes();
+		break;
+	case 'I':
+	case 'i':	rayTrace.showsAxes = !rayTrace.showsAxes;
+		cout << (rayTrace.showsAxes ? "Axes shown" : "Axes hidden") << endl;
+		break;
+	case 'T':
+	case 't':	rayTrace.deferredShading = !rayTrace.deferredShading;
+		cout << (rayTrace.deferredShading ? "Deferred shading" : "Forward shading") << endl;
 		break;
 	case '0':
 	case '1':
@@ -213,27 +415,108 @@ void keyboard(unsigned char key, int x, int y) {
 		break;
 	case 'd':	isAnimated = !isAnimated;
 		break;
+#ifndef CONSOLE_ONLY
 	case ESCAPE:
 		glutLeaveMainLoop();
 		break;
+#endif
 	default:
 		cout << (int)key << "unmapped key pressed." << endl;
 	}
+	guard.unlock();
+	requestFrame();
 
+#ifndef CONSOLE_ONLY
 	glutPostRedisplay();
+#endif
 }
 
+#ifdef CONSOLE_ONLY
+/**
+ * @fn	int main(int argc, char* argv[])
+ * @brief	Headless batch render: fullraytrace [outputFile [keys [numFrames]]]. Each
+ * 			character of keys is handled as if it had been typed, then the frames are
+ * 			rendered and saved. With more than one frame, the animation advances
+ * 			between frames (if turned on with 'p') and the files are numbered. Each
+ * 			file is written on the swap chain's presenter thread while the next frame
+ * 			renders. A name ending in .pam gives PAM files; anything else gives PPMs.
+ * 			Frames are also streamed to a tileviewer if CSE386_TILE_SOCKET is set.
+ * 			No window is opened and no GL calls are made.
+ */
+
+int main(int argc, char* argv[]) {
+	buildScene();
+	string fileName = argc > 1 ? argv[1] : "fullraytrace.ppm";
+	if (argc > 2) {
+		for (const char* key = argv[2]; *key != '\0'; key++) {
+			keyboard(*key, 0, 0);
+		}
+	}
+	int numFrames = argc > 3 ? glm::max(1, std::atoi(argv[3])) : 1;
+
+	size_t dot = fileName.rfind('.');
+	string base = fileName.substr(0, dot);
+	string extension = dot == string::npos ? ".ppm" : fileName.substr(dot);
+	std::atomic<bool> allWritten(true);
+	swapChain.setPresenter([&](const FrameBuffer& frame, int frameNumber) {
+		string name = fileName;
+		if (numFrames > 1) {
+			std::ostringstream numbered;
+			numbered << base << "_" << std::setw(4) << std::setfill('0') << frameNumber << extension;
+			name = numbered.str();
+		}
+		if (tilePublisher != nullptr) {
+			tilePublisher->publish(frame, frameNumber);
+		}
+		bool wasWritten = extension == ".pam" ? frame.writePAM(name) : frame.writePPM(name);
+		if (wasWritten) {
+			cout << "Wrote " << name << endl;
+		} else {
+			allWritten = false;
+		}
+	});
+
+	rayTrace.showsFrames = false;
+	for (int i = 0; i < numFrames; i++) {
+		if (i > 0) {
+			advanceAnimation();
+		}
+		renderAndStream(swapChain.getBackBuffer());
+		swapChain.swap();
+	}
+	swapChain.finishPresenting();
+	return allWritten ? 0 : 1;
+}
+#else
 int main(int argc, char* argv[]) {
 	graphicsInit(argc, argv, __FILE__);
 
-	glutDisplayFunc(render);
+	rayTrace.showsFrames = false;
+	glutDisplayFunc(display);
 	glutReshapeFunc(resize);
 	glutKeyboardFunc(keyboard);
 	glutMouseFunc(mouseUtility);
 	glutTimerFunc(TIME_INTERVAL, timer, 0);
 	buildScene();
+	// Textures load in the background; frames drawn meanwhile show a placeholder
+	// and are redrawn once the texture arrives.
+	textures.setAsynchronous(true, [](const Image&) { requestFrame(); });
+	if (tilePublisher != nullptr) {
+		swapChain.setPresenter([](const FrameBuffer& frame, int frameNumber) {
+			tilePublisher->publish(frame, frameNumber);
+		});
+	}
 
+	std::thread renderThread(renderLoop);
+	requestFrame();
 	glutMainLoop();
 
+	{
+		std::lock_guard<std::mutex> guard(sceneLock);
+		isQuitting = true;
+	}
+	frameWanted.notify_one();
+	renderThread.join();
 	return 0;
 }
+#endif
@@ -15,6 +15,8 @@
 #include "image.h"
 #include "utilities.h"
 
+struct IShape;
+
 struct HitRecord {
 	double t;				//!< the t value where the intersection took place.
 	dvec3 interceptPt;		//!< the (x,y,z) value where the intersection took place.
@@ -34,6 +36,7 @@ struct HitRecord {
 struct OpaqueHitRecord : HitRecord {
 	Material material;		//!< the Material value of the object.
 	Image* texture;			//!< the texture associated with this object, if any (nullptr when not textured).
+	const IShape* shape;	//!< the shape that was hit (set along with texture).
 	double u, v;			//!< (u,v) correpsonding to intersection point.
 
 	/**
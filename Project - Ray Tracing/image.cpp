@@ -11,17 +11,301 @@
 #include <fstream>
 #include <utility>
 #include <set>
+#include <charconv>
+#include <cstring>
 #include "utilities.h"
 #include "image.h"
+#include "textureregistry.h"
 
-static unsigned int getNextChar(std::ifstream& input, string& str) {
-	const int N = 2000;
-	char buf;
-	input.read(&buf, 1);
-	unsigned int result = (unsigned char)buf;
-	return result;
+const color PLACEHOLDER_TEXEL(0.5, 0.5, 0.5);	//!< Sampled while a texture loads in the background.
+
+/**
+ * @fn	static float halfToFloat(unsigned short half)
+ * @brief	Converts a 16-bit floating point number to a float.
+ * @param	half	The IEEE 754 half precision bits.
+ * @return	The value.
+ */
+
+static float halfToFloat(unsigned short half) {
+	unsigned int sign = (unsigned int)(half & 0x8000) << 16;
+	int exponent = (half >> 10) & 0x1f;
+	unsigned int mantissa = half & 0x3ff;
+	unsigned int bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	} else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	} else if (mantissa == 0) {
+		bits = sign;
+	} else {
+		exponent = 113;
+		while ((mantissa & 0x400) == 0) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+	}
+	float f;
+	std::memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/**
+ * @fn	static unsigned short floatToHalf(float f)
+ * @brief	Converts a float to the nearest 16-bit floating point number.
+ * @param	f	The value.
+ * @return	The IEEE 754 half precision bits.
+ */
+
+static unsigned short floatToHalf(float f) {
+	unsigned int bits;
+	std::memcpy(&bits, &f, sizeof(f));
+	unsigned short sign = (bits >> 16) & 0x8000;
+	int biased = (bits >> 23) & 0xff;
+	int exponent = biased - 127 + 15;
+	unsigned int mantissa = bits & 0x7fffff;
+	if (biased == 0xff) {
+		return sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0);
+	} else if (exponent >= 0x1f) {
+		return sign | 0x7c00;
+	} else if (exponent <= 0) {
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		return sign | ((mantissa >> shift) + ((mantissa >> (shift - 1)) & 1));
+	}
+	unsigned short half = sign | (exponent << 10) | (mantissa >> 13);
+	return half + ((mantissa >> 12) & 1);
+}
+
+const int BC1_BLOCK_BYTES = 8;		//!< Size of one compressed tile.
+
+/**
+ * @fn	static void expand565(unsigned short packed, int rgb[3])
+ * @brief	Widens a 5:6:5 color to 8 bits per channel, as BC1 decoders do.
+ * @param 		  	packed	The color, red in the top 5 bits.
+ * @param [in,out]	rgb   	The 8-bit channels.
+ */
+
+static void expand565(unsigned short packed, int rgb[3]) {
+	int r = packed >> 11, g = (packed >> 5) & 0x3f, b = packed & 0x1f;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+/**
+ * @fn	static void bc1Palette(const unsigned char *block, int palette[4][3])
+ * @brief	Computes the four colors a BC1 block's indices choose from. If the first
+ * 			endpoint is not greater than the second, the block has three colors and
+ * 			black.
+ * @param 		  	block  	The compressed block.
+ * @param [in,out]	palette	The colors, 8 bits per channel.
+ */
+
+static void bc1Palette(const unsigned char* block, int palette[4][3]) {
+	unsigned short c0 = block[0] | (block[1] << 8);
+	unsigned short c1 = block[2] | (block[3] << 8);
+	expand565(c0, palette[0]);
+	expand565(c1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		} else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+/**
+ * @fn	static void decodeBC1(const unsigned char *block, int slot, int rgb[3])
+ * @brief	Decodes one texel of a BC1 block, computing only the color it uses.
+ * @param 		  	block	The compressed block.
+ * @param 		  	slot 	Position of the texel in the tile, 0 to 15.
+ * @param [in,out]	rgb  	The texel's 8-bit channels.
+ */
+
+static void decodeBC1(const unsigned char* block, int slot, int rgb[3]) {
+	unsigned short c0 = block[0] | (block[1] << 8);
+	unsigned short c1 = block[2] | (block[3] << 8);
+	int index = (block[4 + slot / 4] >> (2 * (slot % 4))) & 3;
+	if (index < 2) {
+		expand565(index == 0 ? c0 : c1, rgb);
+		return;
+	}
+	int e0[3], e1[3];
+	expand565(c0, e0);
+	expand565(c1, e1);
+	for (int c = 0; c < 3; c++) {
+		if (c0 > c1) {
+			rgb[c] = index == 2 ? (2 * e0[c] + e1[c] + 1) / 3 : (e0[c] + 2 * e1[c] + 1) / 3;
+		} else {
+			rgb[c] = index == 2 ? (e0[c] + e1[c]) / 2 : 0;
+		}
+	}
+}
+
+/**
+ * @fn	static int fitBC1(const unsigned char *const *texels, int count, const int *slots,
+ *						unsigned short c0, unsigned short c1, unsigned char *block)
+ * @brief	Fills in a BC1 block with the given endpoints, choosing the nearest of the
+ * 			four colors for each texel.
+ * @param 		  	texels	RGB8 texels of the tile that lie inside the image.
+ * @param 		  	count 	Number of texels, 1 to 16.
+ * @param 		  	slots 	Position of each texel in the tile, 0 to 15.
+ * @param 		  	c0	  	One endpoint, 5:6:5.
+ * @param 		  	c1	  	The other endpoint, 5:6:5.
+ * @param [in,out]	block 	The compressed block.
+ * @return	The sum of the squared errors of the texels.
+ */
+
+static int fitBC1(const unsigned char* const* texels, int count, const int* slots,
+	unsigned short c0, unsigned short c1, unsigned char* block) {
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+	block[0] = c0 & 0xff;
+	block[1] = c0 >> 8;
+	block[2] = c1 & 0xff;
+	block[3] = c1 >> 8;
+
+	int palette[4][3];
+	bc1Palette(block, palette);
+	unsigned int indices = 0;
+	int error = 0;
+	for (int i = 0; i < count; i++) {
+		int best = 0, bestDist = INT_MAX;
+		for (int p = 0; p < (c0 > c1 ? 4 : 3); p++) {
+			int dist = 0;
+			for (int c = 0; c < 3; c++) {
+				int d = texels[i][c] - palette[p][c];
+				dist += d * d;
+			}
+			if (dist < bestDist) {
+				bestDist = dist;
+				best = p;
+			}
+		}
+		indices |= best << (2 * slots[i]);
+		error += bestDist;
+	}
+	for (int b = 0; b < 4; b++) {
+		block[4 + b] = (indices >> (8 * b)) & 0xff;
+	}
+	return error;
 }
 
+/**
+ * @fn	static void encodeBC1(const unsigned char *const *texels, int count, const int *slots, unsigned char *block)
+ * @brief	Compresses one tile. The endpoints start as the texels lying furthest
+ * 			apart along the tile's principal axis (the direction in which its colors
+ * 			vary most), and are then refined by least squares.
+ * @param 		  	texels	RGB8 texels of the tile that lie inside the image.
+ * @param 		  	count 	Number of texels, 1 to 16.
+ * @param 		  	slots 	Position of each texel in the tile, 0 to 15.
+ * @param [in,out]	block 	The compressed block.
+ */
+
+static void encodeBC1(const unsigned char* const* texels, int count, const int* slots, unsigned char* block) {
+	dvec3 mean(0.0);
+	for (int i = 0; i < count; i++) {
+		mean += dvec3(texels[i][0], texels[i][1], texels[i][2]);
+	}
+	mean /= count;
+	double cov[3][3] = { { 0 } };
+	for (int i = 0; i < count; i++) {
+		dvec3 d = dvec3(texels[i][0], texels[i][1], texels[i][2]) - mean;
+		for (int r = 0; r < 3; r++) {
+			for (int c = 0; c < 3; c++) {
+				cov[r][c] += d[r] * d[c];
+			}
+		}
+	}
+	// A few steps of power iteration find the principal axis well enough.
+	dvec3 axis(1.0, 1.0, 1.0);
+	for (int step = 0; step < 8; step++) {
+		dvec3 next(cov[0][0] * axis.x + cov[0][1] * axis.y + cov[0][2] * axis.z,
+					cov[1][0] * axis.x + cov[1][1] * axis.y + cov[1][2] * axis.z,
+					cov[2][0] * axis.x + cov[2][1] * axis.y + cov[2][2] * axis.z);
+		double len = glm::length(next);
+		if (len < EPSILON) {
+			break;
+		}
+		axis = next / len;
+	}
+	int lo = 0, hi = 0;
+	double loDot = DBL_MAX, hiDot = -DBL_MAX;
+	for (int i = 0; i < count; i++) {
+		double d = texels[i][0] * axis.x + texels[i][1] * axis.y + texels[i][2] * axis.z;
+		if (d < loDot) {
+			loDot = d;
+			lo = i;
+		}
+		if (d > hiDot) {
+			hiDot = d;
+			hi = i;
+		}
+	}
+
+	auto pack565 = [](double r, double g, double b) {
+		return (unsigned short)(((int)(glm::clamp(r, 0.0, 255.0) * 31 / 255 + 0.5) << 11) |
+								((int)(glm::clamp(g, 0.0, 255.0) * 63 / 255 + 0.5) << 5) |
+								(int)(glm::clamp(b, 0.0, 255.0) * 31 / 255 + 0.5));
+	};
+	int error = fitBC1(texels, count, slots,
+						pack565(texels[hi][0], texels[hi][1], texels[hi][2]),
+						pack565(texels[lo][0], texels[lo][1], texels[lo][2]), block);
+	if (error == 0) {
+		return;
+	}
+
+	// Refine: given the chosen indices, the endpoints that minimize the squared
+	// error solve a 2x2 linear system per channel.
+	const double WEIGHTS[4] = { 1.0, 0.0, 2.0 / 3.0, 1.0 / 3.0 };
+	double aa = 0, ab = 0, bb = 0;
+	dvec3 ax(0.0), bx(0.0);
+	for (int i = 0; i < count; i++) {
+		double w = WEIGHTS[(block[4 + slots[i] / 4] >> (2 * (slots[i] % 4))) & 3];
+		dvec3 x(texels[i][0], texels[i][1], texels[i][2]);
+		aa += w * w;
+		ab += w * (1 - w);
+		bb += (1 - w) * (1 - w);
+		ax += w * x;
+		bx += (1 - w) * x;
+	}
+	double det = aa * bb - ab * ab;
+	if (block[0] + (block[1] << 8) <= block[2] + (block[3] << 8) || std::abs(det) < EPSILON) {
+		return;
+	}
+	dvec3 a = (bb * ax - ab * bx) / det;
+	dvec3 b = (aa * bx - ab * ax) / det;
+	unsigned char refined[BC1_BLOCK_BYTES];
+	if (fitBC1(texels, count, slots, pack565(a.x, a.y, a.z), pack565(b.x, b.y, b.z), refined) < error) {
+		std::memcpy(block, refined, BC1_BLOCK_BYTES);
+	}
+}
+
+static bool isSpace(char c) {
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+const size_t MIN_P3_CHUNK = 1 << 16;	//!< Smallest piece of a P3 file parsed by one job.
+
+/**
+ * @fn	static void p3(std::ifstream &input, Image &im)
+ * @brief	Reads the ASCII (P3) form of a PPM file. The payload is read at once and
+ * 			split into chunks at whitespace. One parallel pass counts the samples in
+ * 			each chunk, which tells every chunk where its first sample goes, and a
+ * 			second converts them with std::from_chars, storing them straight into
+ * 			the image. Pixels missing from a truncated file are black.
+ * @param [in,out]	input	The file, positioned after the magic number.
+ * @param [in,out]	im   	The image.
+ */
+
 static void p3(std::ifstream& input, Image& im) {
 	const int N = 100;
 	char buf[N + 1];
@@ -29,21 +313,77 @@ static void p3(std::ifstream& input, Image& im) {
 	int maxValue;
 	input >> im.W >> im.H >> maxValue;
 	input.getline(buf, N);
+	maxValue = glm::max(maxValue, 1);
+
+	std::streampos start = input.tellg();
+	input.seekg(0, std::ios::end);
+	size_t size = (size_t)(input.tellg() - start);
+	input.seekg(start);
+	string payload(size, ' ');
+	input.read(&payload[0], size);
+	size = (size_t)input.gcount();
+
+	const int NUM_CHUNKS = (int)glm::clamp(size / MIN_P3_CHUNK, (size_t)1, (size_t)numWorkerThreads() * 4);
+	vector<size_t> chunkStart(NUM_CHUNKS + 1, 0);
+	for (int c = 1; c <= NUM_CHUNKS; c++) {
+		size_t pos = c == NUM_CHUNKS ? size : size / NUM_CHUNKS * c;
+		while (pos < size && !isSpace(payload[pos])) {
+			pos++;
+		}
+		chunkStart[c] = pos;
+	}
 
-	im.pixels = new color[im.W * im.H];
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			input >> r >> g >> b;
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
+	// Pass 1: count the samples in each chunk, then turn the counts into the
+	// index of each chunk's first sample.
+	vector<int> firstSample(NUM_CHUNKS + 1, 0);
+	parallelFor(0, NUM_CHUNKS, [&](int c) {
+		int count = 0;
+		bool wasSpace = true;
+		for (size_t i = chunkStart[c]; i < chunkStart[c + 1]; i++) {
+			bool space = isSpace(payload[i]);
+			count += wasSpace && !space;
+			wasSpace = space;
 		}
+		firstSample[c + 1] = count;
+	});
+	for (int c = 0; c < NUM_CHUNKS; c++) {
+		firstSample[c + 1] += firstSample[c];
 	}
+
+	// Pass 2: convert.
+	const int NUM_SAMPLES = 3 * im.W * im.H;
+	im.allocate(im.W, im.H, maxValue);
+	parallelFor(0, NUM_CHUNKS, [&](int c) {
+		const char* p = payload.data() + chunkStart[c];
+		const char* end = payload.data() + chunkStart[c + 1];
+		for (int s = firstSample[c]; s < NUM_SAMPLES; s++) {
+			while (p < end && isSpace(*p)) {
+				p++;
+			}
+			if (p == end) {
+				break;
+			}
+			int value = 0;
+			std::from_chars_result result = std::from_chars(p, end, value);
+			p = result.ptr;
+			while (p < end && !isSpace(*p)) {
+				p++;
+			}
+			im.setSample(s, value);
+		}
+	});
 }
 
+/**
+ * @fn	static void p6(std::ifstream &input, Image &im)
+ * @brief	Reads the binary (P6) form of a PPM file. The whole payload is read at once,
+ * 			straight into the image when it is stored as RGB8. Samples are one byte if
+ * 			maxValue < 256, else two bytes, most significant first. Pixels missing
+ * 			from a truncated file are black.
+ * @param [in,out]	input	The file, positioned after the magic number.
+ * @param [in,out]	im   	The image.
+ */
+
 static void p6(std::ifstream& input, Image& im) {
 	const int N = 100;
 	char buf[N + 1];
@@ -51,39 +391,74 @@ static void p6(std::ifstream& input, Image& im) {
 	int maxValue;
 	input >> im.W >> im.H >> maxValue;
 	input.getline(buf, N);
+	maxValue = glm::clamp(maxValue, 1, 65535);
+	im.allocate(im.W, im.H, maxValue);
 
-	im.pixels = new color[im.W * im.H];
-	string buffer;
-	color* p = im.pixels;
-	for (int row = 0; row < im.H; row++) {
-		for (int col = 0; col < im.W; col++, p++) {
-			int r, g, b;
-			r = getNextChar(input, buffer);
-			g = getNextChar(input, buffer);
-			b = getNextChar(input, buffer);
-			double R = map((double)r, 0.0, (double)maxValue, 0.0, 1.0);
-			double G = map((double)g, 0.0, (double)maxValue, 0.0, 1.0);
-			double B = map((double)b, 0.0, (double)maxValue, 0.0, 1.0);
-			*p = color(R, G, B);
-		}
+	const int NUM_SAMPLES = 3 * im.W * im.H;
+	if (im.getFormat() == TexelFormat::RGB8) {
+		// The payload is already in the image's format.
+		vector<unsigned char> payload(NUM_SAMPLES, 0);
+		input.read((char*)payload.data(), NUM_SAMPLES);
+		im.setTexelsRGB8(payload.data());
+		return;
+	}
+	const int BYTES_PER_SAMPLE = maxValue < 256 ? 1 : 2;
+	vector<unsigned char> payload((size_t)NUM_SAMPLES * BYTES_PER_SAMPLE, 0);
+	input.read((char*)payload.data(), payload.size());
+
+	const unsigned char* in = payload.data();
+	for (int s = 0; s < NUM_SAMPLES; s++, in += BYTES_PER_SAMPLE) {
+		im.setSample(s, BYTES_PER_SAMPLE == 1 ? in[0] : (in[0] << 8) | in[1]);
 	}
 }
 
 /**
- * @fn	Image::Image(char *ppmFileName)
+ * @fn	Image::Image(char *ppmFileName, TexelFormat format)
  * @brief	Constructs and image given the name of a PPM file. The file must be
  * 			P3 or P6.
  * @param [in,out]	ppmFileName	Filename of the ppm file.
+ * @param 		  	format	   	How to store the texels. Files with more than 8 bits
+ * 								per sample are always stored as HALF.
+ */
+
+Image::Image(std::string ppmFileName, TexelFormat format)
+	: W(0), H(0), format(format), bytesPerTexel(0), maxValue(255),
+	fileName(ppmFileName), requestedFormat(format), registry(nullptr), useClock(nullptr),
+	residency(RESIDENT), lastUse(0) {
+	load();
+}
+
+/**
+ * @fn	Image::Image(TextureRegistry *registry, const std::atomic<unsigned int> *useClock,
+ *						const string &ppmFileName, TexelFormat format)
+ * @brief	Constructs an image that a registry loads when it is first sampled.
+ * @param [in,out]	registry   	The registry.
+ * @param 		  	useClock   	The registry's frame counter.
+ * @param 		  	ppmFileName	Filename of the ppm file.
+ * @param 		  	format	   	How to store the texels.
+ */
+
+Image::Image(TextureRegistry* registry, const std::atomic<unsigned int>* useClock,
+	const string& ppmFileName, TexelFormat format)
+	: W(0), H(0), format(format), bytesPerTexel(0), maxValue(255),
+	fileName(ppmFileName), requestedFormat(format), registry(registry), useClock(useClock),
+	residency(UNLOADED), lastUse(0) {
+}
+
+/**
+ * @fn	bool Image::load()
+ * @brief	Reads the texels from the file and builds the mipmaps. If the file cannot
+ * 			be read, the image becomes a single black texel.
+ * @return	true iff the file was read.
  */
 
-Image::Image(std::string ppmFileName) : W(0), H(0) {
+bool Image::load() {
 	const int N = 100;
-	char buf1[N + 1];
+	char buf1[N + 1] = "";
 	char buf2[N + 1];
-	std::ifstream input(ppmFileName.c_str(), std::ios::binary);
+	std::ifstream input(fileName.c_str(), std::ios::binary);
 	input.getline(buf1, N);
-	int type = 3;
-	pixels = nullptr;
+	format = requestedFormat;
 
 	while (input.peek() == '#') {
 		input.getline(buf2, N);
@@ -95,11 +470,38 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
 	} else if (header == "P6") {
 		p6(input, *this);
 	} else {
-		std::cerr << "Problem with PPM file: " << ppmFileName << "(" << header << ")" << endl;
-		return;
+		std::cerr << "Problem with PPM file: " << fileName << "(" << header << ")" << endl;
+		allocate(1, 1, 255);
+		buildMipmaps();
+		return false;
 	}
 
 	input.close();
+	buildMipmaps();
+	if (requestedFormat == TexelFormat::BC1 && format == TexelFormat::RGB8) {
+		compressBC1();
+	}
+	return true;
+}
+
+/**
+ * @fn	void Image::unload()
+ * @brief	Frees the texels. They are loaded again when next sampled.
+ */
+
+void Image::unload() {
+	residency.store(UNLOADED, std::memory_order_release);
+	vector<MipLevel>().swap(levels);
+}
+
+/**
+ * @fn	bool Image::requestResidency() const
+ * @brief	Slow path of makeResident: asks the registry to load the texels.
+ * @return	true iff the texels are now loaded.
+ */
+
+bool Image::requestResidency() const {
+	return registry != nullptr && registry->makeResident(const_cast<Image*>(this));
 }
 
 /**
@@ -113,7 +515,288 @@ Image::Image(std::string ppmFileName) : W(0), H(0) {
  */
 
 color Image::getPixelUV(double u, double v) const {
+	if (!makeResident()) {
+		return PLACEHOLDER_TEXEL;
+	}
 	int x = glm::clamp((int)(W * u), 0, W - 1);
 	int y = glm::clamp((int)(H * v), 0, H - 1);
-	return pixels[y * W + x];
+	return getTexel(x, y);
+}
+
+/**
+ * @fn	color Image::getTexel(int level, int x, int y) const
+ * @brief	Decodes one texel.
+ * @param	level	The mipmap level, 0 being the full size image.
+ * @param	x	 	The column.
+ * @param	y	 	The row, 0 being the bottom row.
+ * @return	The texel's color.
+ */
+
+color Image::getTexel(int level, int x, int y) const {
+	if (format == TexelFormat::BC1) {
+		const MipLevel& mip = levels[level];
+		size_t index = mip.texelIndex(x, y);
+		const int TILE_TEXELS = TEXEL_TILE_SIZE * TEXEL_TILE_SIZE;
+		const unsigned char* block = &mip.texels[index / TILE_TEXELS * BC1_BLOCK_BYTES];
+		int rgb[3];
+		decodeBC1(block, (int)(index % TILE_TEXELS), rgb);
+		return color(toIntensity[rgb[0]], toIntensity[rgb[1]], toIntensity[rgb[2]]);
+	}
+	const unsigned char* texel = texelAddress(level, x, y);
+	if (format == TexelFormat::HALF) {
+		unsigned short rgb[3];
+		std::memcpy(rgb, texel, sizeof(rgb));
+		return color(halfToFloat(rgb[0]), halfToFloat(rgb[1]), halfToFloat(rgb[2]));
+	}
+	return color(toIntensity[texel[0]], toIntensity[texel[1]], toIntensity[texel[2]]);
+}
+
+/**
+ * @fn	void Image::allocate(int width, int height, int maxValue)
+ * @brief	Sizes the image, with every texel black, before a loader fills it in with
+ * 			setSample. Switches to HALF if the samples do not fit in a byte, and from
+ * 			BC1 to RGB8 until the texels are compressed.
+ * @param	width   	The width.
+ * @param	height  	The height.
+ * @param	maxValue	The file's maximum sample value (intensity 1).
+ */
+
+void Image::allocate(int width, int height, int maxValue) {
+	W = width;
+	H = height;
+	this->maxValue = maxValue;
+	if (maxValue > 255) {
+		format = TexelFormat::HALF;
+	} else if (format == TexelFormat::BC1) {
+		// Filled in uncompressed, then compressed by compressBC1.
+		format = TexelFormat::RGB8;
+	}
+	bytesPerTexel = format == TexelFormat::RGB8 ? 3 : (format == TexelFormat::RGBA8 ? 4 : 6);
+	levels.resize(1);
+	levels[0].setSize(W, H, bytesPerTexel);
+	vector<unsigned char>& texels = levels[0].texels;
+	if (format == TexelFormat::RGBA8) {
+		for (size_t alpha = 3; alpha < texels.size(); alpha += 4) {
+			texels[alpha] = 255;
+		}
+	}
+	for (int i = 0; i < 256; i++) {
+		toIntensity[i] = map((double)i, 0.0, (double)maxValue, 0.0, 1.0);
+	}
+}
+
+/**
+ * @fn	void Image::setSample(int sample, int value)
+ * @brief	Stores one sample read from a file.
+ * @param	sample	Index of the sample: 3 * texel index + channel.
+ * @param	value 	The sample, in [0, maxValue].
+ */
+
+void Image::setSample(int sample, int value) {
+	const int index = sample / 3;
+	unsigned char* texel = texelAddress(0, index % W, index / W);
+	if (format == TexelFormat::HALF) {
+		unsigned short half = floatToHalf((float)map((double)value, 0.0, (double)maxValue, 0.0, 1.0));
+		std::memcpy(texel + sizeof(half) * (sample % 3), &half, sizeof(half));
+	} else {
+		texel[sample % 3] = (unsigned char)glm::clamp(value, 0, 255);
+	}
+}
+
+/**
+ * @fn	void Image::setTexelsRGB8(const unsigned char *rgb)
+ * @brief	Stores every texel of an RGB8 image at once, rearranging them into tiles.
+ * 			Faster than setSample.
+ * @param	rgb	3 * W * H samples, row by row, in the image's size.
+ */
+
+void Image::setTexelsRGB8(const unsigned char* rgb) {
+	for (int y = 0; y < H; y++) {
+		for (int x0 = 0; x0 < W; x0 += TEXEL_TILE_SIZE) {
+			// One row of one tile is contiguous in both layouts.
+			int count = glm::min(TEXEL_TILE_SIZE, W - x0);
+			std::memcpy(texelAddress(0, x0, y), rgb + 3 * ((size_t)y * W + x0), 3 * count);
+		}
+	}
+}
+
+/**
+ * @fn	void Image::MipLevel::setSize(int width, int height, int bytesPerTexel)
+ * @brief	Sizes a level, with every byte 0. The storage is rounded up to whole tiles.
+ * @param	width		 	The width.
+ * @param	height		 	The height.
+ * @param	bytesPerTexel	Size of each texel.
+ */
+
+void Image::MipLevel::setSize(int width, int height, int bytesPerTexel) {
+	W = width;
+	H = height;
+	tilesAcross = (W + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_SHIFT;
+	int tilesDown = (H + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_SHIFT;
+	texels.assign((size_t)tilesAcross * tilesDown * TEXEL_TILE_SIZE * TEXEL_TILE_SIZE * bytesPerTexel, 0);
+}
+
+/**
+ * @fn	size_t Image::getTexelBytes() const
+ * @brief	Memory used by the texels of every mipmap level.
+ * @return	The number of bytes.
+ */
+
+size_t Image::getTexelBytes() const {
+	size_t bytes = 0;
+	for (const MipLevel& mip : levels) {
+		bytes += mip.texels.size();
+	}
+	return bytes;
+}
+
+/**
+ * @fn	void Image::buildMipmaps()
+ * @brief	Rebuilds the mipmap chain from level 0. Each level is half the width and
+ * 			height of the one before (rounded down, but at least 1), and each of its
+ * 			texels is the average of a 2x2 block. The chain ends with a 1x1 level.
+ */
+
+void Image::buildMipmaps() {
+	if (levels.empty() || format == TexelFormat::BC1) {
+		return;
+	}
+	levels.resize(1);
+	while (levels.back().W > 1 || levels.back().H > 1) {
+		const int level = (int)levels.size() - 1;
+		const int srcW = levels[level].W;
+		const int srcH = levels[level].H;
+		MipLevel mip;
+		mip.setSize(glm::max(srcW / 2, 1), glm::max(srcH / 2, 1), bytesPerTexel);
+		for (int y = 0; y < mip.H; y++) {
+			int y0 = glm::min(2 * y, srcH - 1);
+			int y1 = glm::min(2 * y + 1, srcH - 1);
+			for (int x = 0; x < mip.W; x++) {
+				unsigned char* dest = &mip.texels[mip.texelIndex(x, y) * bytesPerTexel];
+				int x0 = glm::min(2 * x, srcW - 1);
+				int x1 = glm::min(2 * x + 1, srcW - 1);
+				const unsigned char* block[4] = { texelAddress(level, x0, y0), texelAddress(level, x1, y0),
+												texelAddress(level, x0, y1), texelAddress(level, x1, y1) };
+				if (format == TexelFormat::HALF) {
+					for (int c = 0; c < 3; c++) {
+						float sum = 0.0f;
+						for (const unsigned char* texel : block) {
+							unsigned short half;
+							std::memcpy(&half, texel + sizeof(half) * c, sizeof(half));
+							sum += halfToFloat(half);
+						}
+						unsigned short average = floatToHalf(sum / 4.0f);
+						std::memcpy(dest + sizeof(average) * c, &average, sizeof(average));
+					}
+				} else {
+					for (int c = 0; c < bytesPerTexel; c++) {
+						dest[c] = (unsigned char)((block[0][c] + block[1][c] + block[2][c] + block[3][c] + 2) / 4);
+					}
+				}
+			}
+		}
+		levels.push_back(std::move(mip));
+	}
+}
+
+/**
+ * @fn	void Image::compressBC1()
+ * @brief	Compresses every mipmap level of an RGB8 image, tile by tile, and switches
+ * 			the image to BC1. Texels in the padding of partial tiles are ignored.
+ */
+
+void Image::compressBC1() {
+	const int TILE_TEXELS = TEXEL_TILE_SIZE * TEXEL_TILE_SIZE;
+	for (int level = 0; level < (int)levels.size(); level++) {
+		MipLevel& mip = levels[level];
+		const int tilesDown = (mip.H + TEXEL_TILE_SIZE - 1) >> TEXEL_TILE_SHIFT;
+		vector<unsigned char> blocks((size_t)mip.tilesAcross * tilesDown * BC1_BLOCK_BYTES);
+		for (int ty = 0; ty < tilesDown; ty++) {
+			for (int tx = 0; tx < mip.tilesAcross; tx++) {
+				const unsigned char* texels[TILE_TEXELS];
+				int slots[TILE_TEXELS];
+				int count = 0;
+				for (int y = ty * TEXEL_TILE_SIZE; y < glm::min((ty + 1) * TEXEL_TILE_SIZE, mip.H); y++) {
+					for (int x = tx * TEXEL_TILE_SIZE; x < glm::min((tx + 1) * TEXEL_TILE_SIZE, mip.W); x++) {
+						texels[count] = texelAddress(level, x, y);
+						slots[count++] = (int)(mip.texelIndex(x, y) % TILE_TEXELS);
+					}
+				}
+				size_t tile = (size_t)ty * mip.tilesAcross + tx;
+				encodeBC1(texels, count, slots, &blocks[tile * BC1_BLOCK_BYTES]);
+			}
+		}
+		mip.texels.swap(blocks);
+	}
+	format = TexelFormat::BC1;
+	bytesPerTexel = 0;
+}
+
+/**
+ * @fn	color Image::getBilinear(int level, double u, double v) const
+ * @brief	Bilinearly interpolates the four texels of one mipmap level that surround
+ * 			(u, v). Lookups past the edges use the edge texels.
+ * @param	level	The mipmap level.
+ * @param	u	 	The u in (u, v).
+ * @param	v	 	The v in (u, v).
+ * @return	The interpolated color.
+ */
+
+color Image::getBilinear(int level, double u, double v) const {
+	const MipLevel& mip = levels[level];
+	double x = u * mip.W - 0.5;
+	double y = v * mip.H - 0.5;
+	int col = (int)std::floor(x);
+	int row = (int)std::floor(y);
+	double fx = x - col;
+	double fy = y - row;
+	int x0 = glm::clamp(col, 0, mip.W - 1);
+	int x1 = glm::clamp(col + 1, 0, mip.W - 1);
+	int y0 = glm::clamp(row, 0, mip.H - 1);
+	int y1 = glm::clamp(row + 1, 0, mip.H - 1);
+	return (1 - fy) * ((1 - fx) * getTexel(level, x0, y0) + fx * getTexel(level, x1, y0)) +
+		fy * ((1 - fx) * getTexel(level, x0, y1) + fx * getTexel(level, x1, y1));
+}
+
+/**
+ * @fn	color Image::sampleUV(double u, double v, double lod) const
+ * @brief	Trilinear filtered lookup: bilinear lookups in the two mipmap levels nearest
+ * 			to lod, blended by how close lod is to each.
+ * @param	u  	The u in (u, v).
+ * @param	v  	The v in (u, v).
+ * @param	lod	The level of detail (see getLevelOfDetail). 0 or less samples the full
+ * 				size image.
+ * @return	The filtered color.
+ */
+
+color Image::sampleUV(double u, double v, double lod) const {
+	if (!makeResident()) {
+		return PLACEHOLDER_TEXEL;
+	}
+	lod = glm::clamp(lod, 0.0, (double)(levels.size() - 1));
+	int level = (int)lod;
+	double f = lod - level;
+	color C = getBilinear(level, u, v);
+	if (f > 0.0) {
+		C = (1 - f) * C + f * getBilinear(level + 1, u, v);
+	}
+	return C;
+}
+
+/**
+ * @fn	double Image::getLevelOfDetail(const dvec2 &dUVdx, const dvec2 &dUVdy) const
+ * @brief	Chooses the mipmap level whose texels are about the size of a pixel's
+ * 			footprint on the texture.
+ * @param	dUVdx	Change in (u, v) from one pixel to the next, in x.
+ * @param	dUVdy	Change in (u, v) from one pixel to the next, in y.
+ * @return	log2 of the footprint's size, in texels of the full size image.
+ */
+
+double Image::getLevelOfDetail(const dvec2& dUVdx, const dvec2& dUVdy) const {
+	if (!makeResident()) {
+		return 0.0;
+	}
+	dvec2 size(W, H);
+	double footprint = glm::max(glm::length(dUVdx * size), glm::length(dUVdy * size));
+	return footprint > 0.0 ? std::log2(footprint) : 0.0;
 }
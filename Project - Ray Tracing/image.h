@@ -9,18 +9,140 @@
 
 #pragma once
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include "defs.h"
 #include "colorandmaterials.h"
 
+/**
+ * @enum	TexelFormat
+ * @brief	How an Image stores its texels. RGB8 and RGBA8 keep each file sample as
+ * 			a byte (RGBA8 pads texels to 4 bytes, with alpha 255); HALF keeps three
+ * 			16-bit floating point intensities and is used for files with more than 8
+ * 			bits per sample. BC1 compresses each 4x4 tile to 8 bytes, two 5:6:5 colors
+ * 			and a 2-bit index per texel choosing one of four colors between them, for a
+ * 			sixth of the memory of RGB8 at some loss of quality. It is encoded as the
+ * 			image loads.
+ */
+
+enum class TexelFormat { RGB8, RGBA8, HALF, BC1 };
+
+const int TEXEL_TILE_SHIFT = 2;							//!< log2 of TEXEL_TILE_SIZE.
+const int TEXEL_TILE_SIZE = 1 << TEXEL_TILE_SHIFT;		//!< Width and height of a tile of texels.
+
+struct TextureRegistry;
+
  /**
   * @struct	Image
-  * @brief	Represents a rectangular RGB image.
+  * @brief	Represents a rectangular RGB image. Texels are stored compactly (see
+  * 		TexelFormat) and converted to colors as they are looked up. A chain of
+  * 		mipmaps, each half the size of the one before, is built as the image is
+  * 		loaded, for filtered sampling (sampleUV). Each level is stored in square
+  * 		tiles of TEXEL_TILE_SIZE texels, so texels that are close in (u, v), in any
+  * 		direction, are close in memory.
+  *
+  * 		Images constructed directly are loaded right away and stay loaded. Images
+  * 		handed out by a TextureRegistry are loaded when first sampled, and may be
+  * 		evicted; getPixelUV, sampleUV and getLevelOfDetail load them as needed,
+  * 		while getTexel and getBilinear expect a resident image.
   */
 
 struct Image {
 	int W, H;
-	color* pixels;
-	Image(std::string ppmFileName);
-	~Image() { delete[] pixels; }
+	Image(std::string ppmFileName, TexelFormat format = TexelFormat::RGB8);
 	color getPixelUV(double u, double v) const;
+	color getTexel(int x, int y) const { return getTexel(0, x, y); }
+	color getTexel(int level, int x, int y) const;
+	color getBilinear(int level, double u, double v) const;
+	color sampleUV(double u, double v, double lod) const;
+	double getLevelOfDetail(const dvec2& dUVdx, const dvec2& dUVdy) const;
+	int getNumLevels() const { return (int)levels.size(); }
+	TexelFormat getFormat() const { return format; }
+	size_t getTexelBytes() const;
+	bool isResident() const { return residency.load(std::memory_order_acquire) == RESIDENT; }
+	const string& getFileName() const { return fileName; }
+
+	void allocate(int width, int height, int maxValue);
+	void setSample(int sample, int value);
+	void setTexelsRGB8(const unsigned char* rgb);
+	void buildMipmaps();
+protected:
+	/**
+	 * @struct	MipLevel
+	 * @brief	One level of the mipmap chain.
+	 */
+
+	struct MipLevel {
+		int W, H;						//!< Size of this level.
+		int tilesAcross;				//!< Number of tiles in each row of tiles.
+		vector<unsigned char> texels;	//!< Tile by tile, bottom row of tiles first;
+										//!< within a tile, row by row, bottom row first.
+
+		/**
+		 * @fn	size_t texelIndex(int x, int y) const
+		 * @brief	Position of a texel in the tiled layout.
+		 * @param	x	The column.
+		 * @param	y	The row.
+		 * @return	Index of the texel (not of its first byte).
+		 */
+
+		size_t texelIndex(int x, int y) const {
+			const int MASK = TEXEL_TILE_SIZE - 1;
+			size_t tile = (size_t)(y >> TEXEL_TILE_SHIFT) * tilesAcross + (x >> TEXEL_TILE_SHIFT);
+			return (tile << (2 * TEXEL_TILE_SHIFT)) + ((y & MASK) << TEXEL_TILE_SHIFT) + (x & MASK);
+		}
+		void setSize(int width, int height, int bytesPerTexel);
+	};
+
+	TexelFormat format;				//!< Storage format.
+	int bytesPerTexel;				//!< 3, 4 or 6; 0 for BC1, which stores whole tiles.
+	vector<MipLevel> levels;		//!< levels[0] is the image itself.
+	int maxValue;					//!< The file's maximum sample value (intensity 1).
+	double toIntensity[256];		//!< Intensity of each 8-bit sample.
+
+	friend struct TextureRegistry;
+	enum { UNLOADED, LOADING, RESIDENT };	//!< Values of residency.
+	string fileName;				//!< The file the texels come from.
+	TexelFormat requestedFormat;	//!< Format asked for (see the constructor).
+	TextureRegistry* registry;		//!< Loads and evicts this image, or nullptr.
+	const std::atomic<unsigned int>* useClock;	//!< The registry's frame counter.
+	mutable std::atomic<int> residency;			//!< UNLOADED, LOADING or RESIDENT.
+	mutable std::atomic<unsigned int> lastUse;	//!< *useClock when last sampled.
+	mutable std::mutex loadLock;	//!< Held while the texels are loaded.
+
+	Image(TextureRegistry* registry, const std::atomic<unsigned int>* useClock,
+		const string& ppmFileName, TexelFormat format);
+	bool load();
+	void unload();
+	void compressBC1();
+	bool requestResidency() const;
+
+	/**
+	 * @fn	bool makeResident() const
+	 * @brief	Makes sure the texels can be read, and records the use for the registry.
+	 * @return	true iff the texels are loaded. Only false while a registry is loading
+	 * 			them in the background.
+	 */
+
+	bool makeResident() const {
+		if (residency.load(std::memory_order_acquire) != RESIDENT) {
+			return requestResidency();
+		}
+		if (useClock != nullptr) {
+			unsigned int now = useClock->load(std::memory_order_relaxed);
+			if (lastUse.load(std::memory_order_relaxed) != now) {
+				lastUse.store(now, std::memory_order_relaxed);
+			}
+		}
+		return true;
+	}
+
+	const unsigned char* texelAddress(int level, int x, int y) const {
+		const MipLevel& mip = levels[level];
+		return &mip.texels[mip.texelIndex(x, y) * bytesPerTexel];
+	}
+	unsigned char* texelAddress(int level, int x, int y) {
+		MipLevel& mip = levels[level];
+		return &mip.texels[mip.texelIndex(x, y) * bytesPerTexel];
+	}
 };
@@ -0,0 +1,452 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <unordered_map>
+#include <cstring>
+#include <climits>
+#include "indexedmesh.h"
+#include "meshsimplifier.h"
+
+/**
+ * @struct	VertexKey
+ * @brief	The exact bits of a vertex, for finding duplicates.
+ */
+
+struct VertexKey {
+	double values[6];	//!< Position, then normal.
+	int materialId;		//!< The vertex's material.
+
+	bool operator==(const VertexKey& other) const {
+		return materialId == other.materialId && std::memcmp(values, other.values, sizeof(values)) == 0;
+	}
+};
+
+/**
+ * @struct	VertexKeyHash
+ * @brief	FNV-1a hash of a VertexKey.
+ */
+
+struct VertexKeyHash {
+	size_t operator()(const VertexKey& key) const {
+		uint64_t hash = 14695981039346656037ULL ^ (uint64_t)key.materialId;
+		const unsigned char* bytes = (const unsigned char*)key.values;
+		for (size_t i = 0; i < sizeof(key.values); i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+		return (size_t)hash;
+	}
+};
+
+static bool sameMaterial(const Material& a, const Material& b) {
+	return a.ambient == b.ambient && a.diffuse == b.diffuse &&
+		a.specular == b.specular && a.shininess == b.shininess;
+}
+
+/**
+ * @fn	IndexedMesh::IndexedMesh(const EShapeData &triangles, bool buildsLODs)
+ * @brief	Converts triangles into an indexed mesh. Vertices whose position, normal and
+ * 			material are bit for bit equal are merged, and each run of triangles with
+ * 			one material becomes a submesh, so the triangles keep their order. A
+ * 			triangle takes the material of its first vertex.
+ * @param	triangles 	Three vertices per triangle, each with w = 1.
+ * @param	buildsLODs	false to skip building the levels of detail.
+ */
+
+IndexedMesh::IndexedMesh(const EShapeData& triangles, bool buildsLODs) : center(ORIGIN3D), radius(0.0) {
+	std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertexIds;
+	const size_t NUM_CORNERS = triangles.size() / 3 * 3;
+	indices.reserve(NUM_CORNERS);
+	for (size_t i = 0; i < NUM_CORNERS; i += 3) {
+		const Material& material = triangles[i].material;
+		int materialId = submeshes.empty() ? -1 : submeshes.back().materialId;
+		if (materialId < 0 || !sameMaterial(materials[materialId], material)) {
+			materialId = -1;
+			for (int m = 0; m < (int)materials.size() && materialId < 0; m++) {
+				if (sameMaterial(materials[m], material)) {
+					materialId = m;
+				}
+			}
+			if (materialId < 0) {
+				materialId = (int)materials.size();
+				materials.push_back(material);
+			}
+			submeshes.push_back(Submesh{ (uint32_t)i, 0, materialId });
+		}
+		submeshes.back().numIndices += 3;
+
+		for (size_t j = i; j < i + 3; j++) {
+			const VertexData& v = triangles[j];
+			VertexKey key = { { v.pos.x, v.pos.y, v.pos.z, v.normal.x, v.normal.y, v.normal.z },
+								materialId };
+			auto found = vertexIds.find(key);
+			if (found == vertexIds.end()) {
+				found = vertexIds.emplace(key, (uint32_t)positions.size()).first;
+				positions.push_back(v.pos.xyz());
+				normals.push_back(v.normal);
+			}
+			indices.push_back(found->second);
+		}
+	}
+	buildClusters();
+	if (buildsLODs) {
+		buildLODs();
+	} else {
+		findBounds();
+	}
+}
+
+/**
+ * @fn	IndexedMesh IndexedMesh::createIObj(const string &filename, const Material &mat,
+ *											bool usesCache, bool buildsLODs)
+ * @brief	Creates a smooth shaded mesh from a Wavefront OBJ file (see EShape::readObj).
+ * 			Vertices keep their sharing, and each vertex's normal is the average of the
+ * 			normals of the faces around it, weighted by the faces' areas.
+ * @param	filename 	Name of the file.
+ * @param	mat		 	Material of every face.
+ * @param	usesCache	false to neither read nor write the mesh cache.
+ * @param	buildsLODs	false to skip building the levels of detail.
+ * @return	The mesh, empty if the file cannot be read.
+ */
+
+IndexedMesh IndexedMesh::createIObj(const string& filename, const Material& mat, bool usesCache,
+	bool buildsLODs) {
+	IndexedMesh mesh;
+	vector<double> positions, faceNormals;
+	if (!EShape::readObj(filename, positions, faceNormals, mesh.indices, usesCache)) {
+		return mesh;
+	}
+	const int NUM_VERTICES = (int)positions.size() / 3;
+	mesh.positions.resize(NUM_VERTICES);
+	for (int i = 0; i < NUM_VERTICES; i++) {
+		mesh.positions[i] = dvec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+	}
+	mesh.normals.assign(NUM_VERTICES, ZEROVEC);
+	for (int f = 0; f < mesh.getNumTriangles(); f++) {
+		const uint32_t* corner = &mesh.indices[3 * f];
+		const dvec3& A = mesh.positions[corner[0]];
+		dvec3 areaNormal = glm::cross(mesh.positions[corner[1]] - A, mesh.positions[corner[2]] - A);
+		for (int j = 0; j < 3; j++) {
+			mesh.normals[corner[j]] += areaNormal;
+		}
+	}
+	for (int i = 0; i < NUM_VERTICES; i++) {
+		double length = glm::length(mesh.normals[i]);
+		mesh.normals[i] = length > 0.0 ? mesh.normals[i] / length : Y_AXIS;
+	}
+	mesh.materials.push_back(mat);
+	if (!mesh.indices.empty()) {
+		mesh.submeshes.push_back(Submesh{ 0, (uint32_t)mesh.indices.size(), 0 });
+	}
+	mesh.buildClusters();
+	if (buildsLODs) {
+		mesh.buildLODs();
+	} else {
+		mesh.findBounds();
+	}
+	return mesh;
+}
+
+/**
+ * @fn	static void findClusterBounds(MeshCluster &cluster, const vector<dvec3> &positions,
+ *										const vector<uint32_t> &indices)
+ * @brief	Fills in a cluster's bounding sphere and normal cone. The sphere is centered
+ * 			on the middle of the cluster's bounding box. The cone's axis is the average
+ * 			of the triangles' unit normals, taken from their winding. A cluster with a
+ * 			degenerate triangle gets no usable cone, since such a triangle is drawn
+ * 			however it faces.
+ * @param [in,out]	cluster  	The cluster, with firstIndex and numIndices set.
+ * @param 		  	positions	The vertex positions.
+ * @param 		  	indices  	The indices the cluster is a run of.
+ */
+
+static void findClusterBounds(MeshCluster& cluster, const vector<dvec3>& positions,
+	const vector<uint32_t>& indices) {
+	const uint32_t* first = &indices[cluster.firstIndex];
+	const uint32_t* end = first + cluster.numIndices;
+	dvec3 lo = positions[*first], hi = lo;
+	for (const uint32_t* i = first; i < end; i++) {
+		lo = glm::min(lo, positions[*i]);
+		hi = glm::max(hi, positions[*i]);
+	}
+	cluster.center = (lo + hi) / 2.0;
+	cluster.radius = 0.0;
+	for (const uint32_t* i = first; i < end; i++) {
+		cluster.radius = glm::max(cluster.radius, glm::distance(cluster.center, positions[*i]));
+	}
+
+	vector<dvec3> faceNormals;
+	dvec3 sum = ZEROVEC;
+	for (const uint32_t* i = first; i < end; i += 3) {
+		const dvec3& A = positions[i[0]];
+		dvec3 n = glm::cross(positions[i[1]] - A, positions[i[2]] - A);
+		double length = glm::length(n);
+		if (length == 0.0) {
+			cluster.coneAxis = ZEROVEC;
+			cluster.coneCutoff = -1.0;
+			return;
+		}
+		faceNormals.push_back(n / length);
+		sum += faceNormals.back();
+	}
+	double length = glm::length(sum);
+	cluster.coneAxis = length > 0.0 ? sum / length : ZEROVEC;
+	cluster.coneCutoff = length > 0.0 ? 1.0 : -1.0;
+	for (const dvec3& n : faceNormals) {
+		cluster.coneCutoff = glm::min(cluster.coneCutoff, glm::dot(n, cluster.coneAxis));
+	}
+}
+
+/**
+ * @fn	void MeshLOD::buildClusters(const vector<dvec3> &positions, int maxTriangles)
+ * @brief	Splits each submesh into clusters of up to maxTriangles triangles, and reorders
+ * 			the submesh's indices so that each cluster is a consecutive run. A cluster
+ * 			starts from the first triangle not yet used and grows across shared corners,
+ * 			always taking the neighbor that adds the fewest new corners, then the one
+ * 			closest to the cluster and best aligned with its normals. This keeps the
+ * 			bounding spheres small and the normal cones narrow. Corners are shared if
+ * 			their positions are equal, so faceted meshes cluster as well as smooth ones.
+ * @param	positions   	The vertex positions the indices refer to.
+ * @param	maxTriangles	The most triangles in a cluster.
+ */
+
+void MeshLOD::buildClusters(const vector<dvec3>& positions, int maxTriangles) {
+	const double CONE_WEIGHT = 4.0;
+	const size_t MAX_CANDIDATES = 256;
+	const uint32_t NUM_TRIANGLES = (uint32_t)getNumTriangles();
+	clusters.clear();
+	maxTriangles = glm::max(maxTriangles, 1);
+
+	// Number the distinct positions, and list the triangles around each one.
+	std::unordered_map<VertexKey, uint32_t, VertexKeyHash> positionIds;
+	vector<uint32_t> cornerPositions(3 * NUM_TRIANGLES);
+	for (size_t i = 0; i < cornerPositions.size(); i++) {
+		const dvec3& P = positions[indices[i]];
+		VertexKey key = { { P.x, P.y, P.z, 0.0, 0.0, 0.0 }, 0 };
+		cornerPositions[i] = positionIds.emplace(key, (uint32_t)positionIds.size()).first->second;
+	}
+	const size_t NUM_POSITIONS = positionIds.size();
+	vector<uint32_t> firstAround(NUM_POSITIONS + 1, 0), trianglesAround(cornerPositions.size());
+	for (uint32_t p : cornerPositions) {
+		firstAround[p + 1]++;
+	}
+	for (size_t p = 0; p < NUM_POSITIONS; p++) {
+		firstAround[p + 1] += firstAround[p];
+	}
+	vector<uint32_t> nextAround(firstAround.begin(), firstAround.end() - 1);
+	for (size_t i = 0; i < cornerPositions.size(); i++) {
+		trianglesAround[nextAround[cornerPositions[i]]++] = (uint32_t)(i / 3);
+	}
+
+	vector<dvec3> centroids(NUM_TRIANGLES), faceNormals(NUM_TRIANGLES);
+	for (uint32_t t = 0; t < NUM_TRIANGLES; t++) {
+		const dvec3& A = positions[indices[3 * t]];
+		const dvec3& B = positions[indices[3 * t + 1]];
+		const dvec3& C = positions[indices[3 * t + 2]];
+		centroids[t] = (A + B + C) / 3.0;
+		dvec3 n = glm::cross(B - A, C - A);
+		double length = glm::length(n);
+		faceNormals[t] = length > 0.0 ? n / length : ZEROVEC;
+	}
+
+	vector<uint32_t> reordered;
+	reordered.reserve(indices.size());
+	vector<bool> isTaken(NUM_TRIANGLES, false);
+	vector<int> positionCluster(NUM_POSITIONS, -1);		// Last cluster to use each position.
+	vector<int> candidateCluster(NUM_TRIANGLES, -1);	// Last cluster to consider each triangle.
+	vector<uint32_t> candidates;
+	auto freeNeighbors = [&](uint32_t t) {
+		int count = 0;
+		for (int j = 0; j < 3; j++) {
+			uint32_t p = cornerPositions[3 * t + j];
+			for (uint32_t a = firstAround[p]; a < firstAround[p + 1]; a++) {
+				count += isTaken[trianglesAround[a]] ? 0 : 1;
+			}
+		}
+		return count;
+	};
+	for (const Submesh& submesh : submeshes) {
+		const uint32_t FIRST = submesh.firstIndex / 3;
+		const uint32_t END = FIRST + submesh.numIndices / 3;
+		uint32_t nextInOrder = FIRST;
+		candidates.clear();
+		while (true) {
+			// Start next to the last cluster, from the triangle that is most hemmed in,
+			// so that few triangles are left stranded between clusters.
+			uint32_t seed = END;
+			int fewestNeighbors = INT_MAX;
+			for (uint32_t t : candidates) {
+				int neighbors = isTaken[t] ? INT_MAX : freeNeighbors(t);
+				if (neighbors < fewestNeighbors) {
+					fewestNeighbors = neighbors;
+					seed = t;
+				}
+			}
+			while (seed == END && nextInOrder < END) {
+				seed = isTaken[nextInOrder] ? END : nextInOrder;
+				nextInOrder++;
+			}
+			if (seed == END) {
+				break;
+			}
+			const int ID = (int)clusters.size();
+			MeshCluster cluster;
+			cluster.firstIndex = (uint32_t)reordered.size();
+			dvec3 centroidSum = ZEROVEC, normalSum = ZEROVEC;
+			int size = 0;
+			candidates.clear();
+			uint32_t next = seed;
+			while (true) {
+				isTaken[next] = true;
+				size++;
+				centroidSum += centroids[next];
+				normalSum += faceNormals[next];
+				for (int j = 0; j < 3; j++) {
+					reordered.push_back(indices[3 * next + j]);
+					uint32_t p = cornerPositions[3 * next + j];
+					positionCluster[p] = ID;
+					for (uint32_t a = firstAround[p]; a < firstAround[p + 1]; a++) {
+						uint32_t t = trianglesAround[a];
+						if (t >= FIRST && t < END && !isTaken[t] && candidateCluster[t] != ID &&
+							candidates.size() < MAX_CANDIDATES) {
+							candidateCluster[t] = ID;
+							candidates.push_back(t);
+						}
+					}
+				}
+				if (size == maxTriangles) {
+					break;
+				}
+
+				dvec3 center = centroidSum / (double)size;
+				double normalLength = glm::length(normalSum);
+				dvec3 axis = normalLength > 0.0 ? normalSum / normalLength : ZEROVEC;
+				int bestNewCorners = 4;
+				double bestScore = 0.0;
+				size_t best = 0;
+				for (size_t c = 0; c < candidates.size(); ) {
+					uint32_t t = candidates[c];
+					if (isTaken[t]) {
+						candidates[c] = candidates.back();
+						candidates.pop_back();
+						continue;
+					}
+					int newCorners = 0;
+					for (int j = 0; j < 3; j++) {
+						newCorners += positionCluster[cornerPositions[3 * t + j]] != ID ? 1 : 0;
+					}
+					dvec3 offset = centroids[t] - center;
+					double score = glm::dot(offset, offset) *
+						(1.0 + CONE_WEIGHT * (1.0 - glm::dot(faceNormals[t], axis)));
+					if (newCorners < bestNewCorners || (newCorners == bestNewCorners && score < bestScore)) {
+						bestNewCorners = newCorners;
+						bestScore = score;
+						best = c;
+					}
+					c++;
+				}
+				if (candidates.empty()) {
+					break;
+				}
+				next = candidates[best];
+			}
+			cluster.numIndices = (uint32_t)reordered.size() - cluster.firstIndex;
+			clusters.push_back(cluster);
+		}
+	}
+	indices.swap(reordered);
+	for (MeshCluster& cluster : clusters) {
+		findClusterBounds(cluster, positions, indices);
+	}
+}
+
+/**
+ * @fn	void IndexedMesh::findBounds()
+ * @brief	Finds the mesh's bounding sphere, centered on the middle of its bounding box.
+ */
+
+void IndexedMesh::findBounds() {
+	center = ORIGIN3D;
+	radius = 0.0;
+	if (positions.empty()) {
+		return;
+	}
+	dvec3 lo = positions[0], hi = lo;
+	for (const dvec3& P : positions) {
+		lo = glm::min(lo, P);
+		hi = glm::max(hi, P);
+	}
+	center = (lo + hi) / 2.0;
+	for (const dvec3& P : positions) {
+		radius = glm::max(radius, glm::distance(center, P));
+	}
+}
+
+/**
+ * @fn	void IndexedMesh::buildLODs(int minTriangles)
+ * @brief	Finds the mesh's bounding sphere, then simplifies it into a chain of levels of
+ * 			detail, each with about half the triangles of the one before. The chain
+ * 			stops before a level would have fewer than minTriangles triangles, or when
+ * 			the simplifier cannot remove a quarter of the triangles left. Call it after
+ * 			constructing a mesh without levels of detail to add them.
+ * @param	minTriangles	The fewest triangles for a level.
+ */
+
+void IndexedMesh::buildLODs(int minTriangles) {
+	lods.clear();
+	findBounds();
+	int numTriangles = getNumTriangles();
+	if (numTriangles / 2 < minTriangles) {
+		return;
+	}
+	MeshSimplifier simplifier(*this);
+	while (numTriangles / 2 >= minTriangles) {
+		simplifier.simplify(numTriangles / 2);
+		if (simplifier.getNumTriangles() > numTriangles * 3 / 4) {
+			break;
+		}
+		numTriangles = simplifier.getNumTriangles();
+		lods.push_back(simplifier.getLOD());
+		lods.back().buildClusters(positions);
+	}
+}
+
+/**
+ * @fn	int IndexedMesh::selectLOD(double pixelsPerUnit) const
+ * @brief	Chooses the coarsest level of detail whose error, on screen, is at most
+ * 			MAX_LOD_PIXEL_ERROR pixels.
+ * @param	pixelsPerUnit	How many pixels one unit of object space covers where the mesh
+ * 							is closest to the eye.
+ * @return	The level, 0 for full detail.
+ */
+
+int IndexedMesh::selectLOD(double pixelsPerUnit) const {
+	for (int level = (int)lods.size(); level > 0; level--) {
+		if (lods[level - 1].error * pixelsPerUnit <= MAX_LOD_PIXEL_ERROR) {
+			return level;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @fn	size_t IndexedMesh::getBytes() const
+ * @brief	Memory used by the mesh's arrays, including its coarser levels of detail.
+ * @return	The number of bytes.
+ */
+
+size_t IndexedMesh::getBytes() const {
+	size_t bytes = positions.size() * sizeof(dvec3) + normals.size() * sizeof(dvec3) +
+		materials.size() * sizeof(Material);
+	for (int level = 0; level < getNumLODs(); level++) {
+		const MeshLOD& lod = getLOD(level);
+		bytes += lod.indices.size() * sizeof(uint32_t) + lod.submeshes.size() * sizeof(Submesh) +
+			lod.clusters.size() * sizeof(MeshCluster);
+	}
+	return bytes;
+}
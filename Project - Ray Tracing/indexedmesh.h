@@ -0,0 +1,108 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <cstdint>
+#include "defs.h"
+#include "colorandmaterials.h"
+#include "eshape.h"
+
+/**
+ * @struct	Submesh
+ * @brief	A run of consecutive triangles of an IndexedMesh that share a material.
+ */
+
+struct Submesh {
+	uint32_t firstIndex;	//!< Position of the run's first index in IndexedMesh::indices.
+	uint32_t numIndices;	//!< Three per triangle.
+	int materialId;			//!< Index into IndexedMesh::materials.
+};
+
+/**
+ * @struct	MeshCluster
+ * @brief	A small, connected patch of an IndexedMesh's triangles, with bounds that let the
+ * 			renderer reject the whole patch with one test: a sphere holding every vertex,
+ * 			and a cone holding every face normal.
+ */
+
+struct MeshCluster {
+	uint32_t firstIndex;	//!< Position of the cluster's first index in IndexedMesh::indices.
+	uint32_t numIndices;	//!< Three per triangle.
+	dvec3 center;			//!< Center of the bounding sphere.
+	double radius;			//!< Radius of the bounding sphere.
+	dvec3 coneAxis;			//!< Unit axis of the normal cone.
+	double coneCutoff;		//!< Cosine of the cone's half angle. -1 if the cone is not usable.
+};
+
+const int MAX_CLUSTER_TRIANGLES = 128;	//!< Default size limit of a MeshCluster.
+const int MIN_LOD_TRIANGLES = 64;		//!< No level of detail is made with fewer triangles.
+const double MAX_LOD_PIXEL_ERROR = 0.5;	//!< Screen error, in pixels, allowed when choosing a level.
+
+/**
+ * @struct	MeshLOD
+ * @brief	The triangles of one level of detail of an IndexedMesh. Every level indexes
+ * 			the same vertices.
+ */
+
+struct MeshLOD {
+	vector<uint32_t> indices;		//!< Three per triangle, counterclockwise.
+	vector<Submesh> submeshes;		//!< Cover indices in order.
+	vector<MeshCluster> clusters;	//!< Cover indices in order. Empty to draw without culling.
+	double error;					//!< How far, in object units, the level strays from the full mesh.
+
+	MeshLOD() : error(0.0) {}
+	int getNumTriangles() const { return (int)indices.size() / 3; }
+	void buildClusters(const vector<dvec3>& positions, int maxTriangles = MAX_CLUSTER_TRIANGLES);
+};
+
+/**
+ * @struct	IndexedMesh
+ * @brief	A triangle mesh for the raster pipeline that stores each distinct vertex once
+ * 			and refers to it by index, with materials kept per submesh rather than per
+ * 			vertex. VertexOps::render transforms each vertex once, however many
+ * 			triangles share it, and draws the same colors as it would for the
+ * 			equivalent EShapeData. The depths may differ where triangles overlap,
+ * 			since the clusters change the order in which they are drawn. Positions
+ * 			have an implied w of 1.
+ *
+ * 			The triangles are grouped into clusters, each of which lies within one
+ * 			submesh, so that off-screen and back-facing parts of a large mesh are
+ * 			skipped before any of their vertices are transformed. Both constructors
+ * 			build the clusters. Call buildClusters after changing the indices in any
+ * 			other way.
+ *
+ * 			The mesh itself is the full detail level. Unless told not to, the
+ * 			constructors also simplify it into a chain of coarser levels, each with
+ * 			about half the triangles of the one before, and VertexOps::render draws the
+ * 			coarsest level whose error covers less than MAX_LOD_PIXEL_ERROR pixels on
+ * 			screen. Simplifying takes seconds for meshes of a million triangles; pass
+ * 			buildsLODs = false to skip it, and call buildLODs later if needed.
+ */
+
+struct IndexedMesh : public MeshLOD {
+	vector<dvec3> positions;		//!< Object coordinates of each vertex.
+	vector<dvec3> normals;			//!< Unit normal of each vertex.
+	vector<Material> materials;		//!< Materials used by the submeshes.
+	vector<MeshLOD> lods;			//!< Coarser levels of detail, from finest to coarsest.
+	dvec3 center;					//!< Center of a sphere around all of the vertices.
+	double radius;					//!< Radius of that sphere.
+
+	IndexedMesh() : center(ORIGIN3D), radius(0.0) {}
+	IndexedMesh(const EShapeData& triangles, bool buildsLODs = true);
+	static IndexedMesh createIObj(const string& filename, const Material& mat, bool usesCache = true,
+		bool buildsLODs = true);
+	int getNumVertices() const { return (int)positions.size(); }
+	int getNumLODs() const { return 1 + (int)lods.size(); }
+	const MeshLOD& getLOD(int level) const { return level == 0 ? *this : lods[level - 1]; }
+	int selectLOD(double pixelsPerUnit) const;
+	void buildClusters(int maxTriangles = MAX_CLUSTER_TRIANGLES) { MeshLOD::buildClusters(positions, maxTriangles); }
+	void findBounds();
+	void buildLODs(int minTriangles = MIN_LOD_TRIANGLES);
+	size_t getBytes() const;
+};
@@ -32,6 +32,33 @@ void IShape::getTexCoords(const dvec3& pt, double& u, double& v) const {
 	u = v = 0;
 }
 
+/**
+ * @fn	void IShape::getTexCoordDerivatives(const dvec3 &pt, const dvec3 &dPdx, const dvec3 &dPdy,
+ *											dvec2 &dUVdx, dvec2 &dUVdy) const
+ * @brief	Estimates how the tex coordinates change across a pixel's footprint, by
+ * 			central differences of getTexCoords. Differences in u are taken the short
+ * 			way around, so a footprint that straddles the seam (u = 0 = 1) of a sphere
+ * 			or cylinder stays small.
+ * @param 		  	pt   	The point on the surface.
+ * @param 		  	dPdx 	Change in the point per pixel, in x (see RayDifferential).
+ * @param 		  	dPdy 	Change in the point per pixel, in y.
+ * @param [in,out]	dUVdx	Change in (u, v) per pixel, in x.
+ * @param [in,out]	dUVdy	Change in (u, v) per pixel, in y.
+ */
+
+void IShape::getTexCoordDerivatives(const dvec3& pt, const dvec3& dPdx, const dvec3& dPdy,
+	dvec2& dUVdx, dvec2& dUVdy) const {
+	dvec2 uv[4];
+	const dvec3 offsets[4] = { 0.5 * dPdx, -0.5 * dPdx, 0.5 * dPdy, -0.5 * dPdy };
+	for (int i = 0; i < 4; i++) {
+		getTexCoords(pt + offsets[i], uv[i].x, uv[i].y);
+	}
+	dUVdx = uv[0] - uv[1];
+	dUVdy = uv[2] - uv[3];
+	dUVdx.x -= std::round(dUVdx.x);
+	dUVdy.x -= std::round(dUVdy.x);
+}
+
 /**
  * @fn	dvec3 IShape::movePointOffSurface(const dvec3 &pt, const dvec3 &n)
  * @brief	Compute point that is slightly off surface.
@@ -70,6 +97,7 @@ void VisibleIShape::findClosestIntersection(const Ray& ray, OpaqueHitRecord& hit
     if (hit.t != FLT_MAX) {
         hit.material = material;
         hit.texture = texture;
+        hit.shape = shape;
         if (hit.texture != nullptr) {
             shape->getTexCoords(hit.interceptPt, hit.u, hit.v);
         }
@@ -560,6 +588,20 @@ IQuadricSurface::IQuadricSurface(const dvec3& position)
  */
 
 void IQuadricSurface::computeAqBqCq(const Ray& ray, double& Aq, double& Bq, double& Cq) const {
+	for (const QuadricOriginTerms& terms : originCache) {
+		if (terms.origin == ray.origin) {
+			const dvec3& Rd = ray.dir;
+			Aq = qParams.A * (Rd.x * Rd.x) +
+				qParams.B * (Rd.y * Rd.y) +
+				qParams.C * (Rd.z * Rd.z) +
+				qParams.D * (Rd.x * Rd.y) +
+				qParams.E * (Rd.x * Rd.z) +
+				qParams.F * (Rd.y * Rd.z);
+			Bq = glm::dot(Rd, terms.bLinear);
+			Cq = terms.Cq;
+			return;
+		}
+	}
 	dvec3 Ro = ray.origin - center;
 	const dvec3& Rd = ray.dir;
 	const double& A = qParams.A;
@@ -598,6 +640,66 @@ void IQuadricSurface::computeAqBqCq(const Ray& ray, double& Aq, double& Bq, doub
 		I * Ro.z + J;
 }
 
+/**
+ * @fn	void IQuadricSurface::computeOriginTerms(const dvec3 &origin, dvec3 &bLinear, double &Cq) const
+ * @brief	Computes the terms of Bq and Cq that only depend on the ray's origin.
+ * 			Bq is linear in the ray's direction, so it collapses to dot(Rd, bLinear).
+ * @param 		  	origin 	The ray origin.
+ * @param [in,out]	bLinear	Bq's coefficients for Rd.x, Rd.y and Rd.z.
+ * @param [in,out]	Cq	   	The cq.
+ */
+
+void IQuadricSurface::computeOriginTerms(const dvec3& origin, dvec3& bLinear, double& Cq) const {
+	dvec3 Ro = origin - center;
+	const QuadricParameters& q = qParams;
+	bLinear.x = twoA * Ro.x + q.D * Ro.y + q.E * Ro.z + q.G;
+	bLinear.y = twoB * Ro.y + q.D * Ro.x + q.F * Ro.z + q.H;
+	bLinear.z = twoC * Ro.z + q.E * Ro.x + q.F * Ro.y + q.I;
+	Cq = q.A * (Ro.x * Ro.x) +
+		q.B * (Ro.y * Ro.y) +
+		q.C * (Ro.z * Ro.z) +
+		q.D * (Ro.x * Ro.y) +
+		q.E * (Ro.x * Ro.z) +
+		q.F * (Ro.y * Ro.z) +
+		q.G * Ro.x +
+		q.H * Ro.y +
+		q.I * Ro.z + q.J;
+}
+
+/**
+ * @fn	void IQuadricSurface::cacheRayOrigin(const dvec3 &origin) const
+ * @brief	Precomputes the origin dependent terms for rays leaving origin, which is
+ * 			normally a perspective camera's position. computeAqBqCq uses them whenever
+ * 			a ray starts exactly at origin. Must not be called while other threads are
+ * 			intersecting rays with this shape.
+ * @param	origin	The ray origin.
+ */
+
+void IQuadricSurface::cacheRayOrigin(const dvec3& origin) const {
+	const int MAX_CACHED_ORIGINS = 4;
+	for (const QuadricOriginTerms& terms : originCache) {
+		if (terms.origin == origin) {
+			return;
+		}
+	}
+	if (originCache.size() >= MAX_CACHED_ORIGINS) {
+		originCache.erase(originCache.begin());
+	}
+	QuadricOriginTerms terms;
+	terms.origin = origin;
+	computeOriginTerms(origin, terms.bLinear, terms.Cq);
+	originCache.push_back(terms);
+}
+
+/**
+ * @fn	void IQuadricSurface::clearRayOriginCache() const
+ * @brief	Discards all cached origin terms. Must be called if the quadric moves.
+ */
+
+void IQuadricSurface::clearRayOriginCache() const {
+	originCache.clear();
+}
+
 /**
  * @fn	int IQuadricSurface::findIntersections(const Ray &ray, HitRecord hits[2]) const
  * @brief	Identifies the intersections that appear in front of the viewer. These
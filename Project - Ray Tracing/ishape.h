@@ -30,11 +30,58 @@ struct Ray {
 	Ray(const dvec3& rayOrigin, const dvec3& rayDirection) :
 		origin(rayOrigin), dir(glm::normalize(rayDirection)) {
 	}
+	Ray(const dvec3& rayOrigin, const dvec3& unitDirection, bool isNormalized) :
+		origin(rayOrigin), dir(isNormalized ? unitDirection : glm::normalize(unitDirection)) {
+	}
 	dvec3 getPoint(double t) const {
 		return origin + t * dir;
 	}
 };
 
+/**
+ * @struct	RayDifferential
+ * @brief	How a camera ray's origin and direction change from one pixel to the next,
+ * 			in x and in y. Transferred to a hit, it gives the size of the pixel's
+ * 			footprint on the surface, which is used to pick a texture's mipmap level.
+ */
+
+struct RayDifferential {
+	dvec3 dOdx, dOdy;	//!< change in the origin per pixel.
+	dvec3 dDdx, dDdy;	//!< change in the (unit) direction per pixel.
+	RayDifferential() : dOdx(ZEROVEC), dOdy(ZEROVEC), dDdx(ZEROVEC), dDdy(ZEROVEC) {
+	}
+	RayDifferential scaled(double s) const {
+		RayDifferential d;
+		d.dOdx = s * dOdx;
+		d.dOdy = s * dOdy;
+		d.dDdx = s * dDdx;
+		d.dDdy = s * dDdy;
+		return d;
+	}
+
+	/**
+	 * @fn	void transfer(const Ray &ray, double t, const dvec3 &normal, dvec3 &dPdx, dvec3 &dPdy) const
+	 * @brief	Follows the differential to a hit, giving the offsets to where the
+	 * 			neighboring pixels' rays meet the hit's tangent plane.
+	 * @param 		  	ray   	The ray.
+	 * @param 		  	t	  	Where the ray hit.
+	 * @param 		  	normal	The normal vector at the hit.
+	 * @param [in,out]	dPdx  	Change in the hit point per pixel, in x.
+	 * @param [in,out]	dPdy  	Change in the hit point per pixel, in y.
+	 */
+
+	void transfer(const Ray& ray, double t, const dvec3& normal, dvec3& dPdx, dvec3& dPdy) const {
+		double cosine = glm::dot(ray.dir, normal);
+		if (glm::abs(cosine) < EPSILON) {
+			cosine = cosine < 0.0 ? -EPSILON : EPSILON;
+		}
+		dvec3 moveX = dOdx + t * dDdx;
+		dvec3 moveY = dOdy + t * dDdy;
+		dPdx = moveX - (glm::dot(moveX, normal) / cosine) * ray.dir;
+		dPdy = moveY - (glm::dot(moveY, normal) / cosine) * ray.dir;
+	}
+};
+
 /**
  * @struct	IShape
  * @brief	Base class for all implicit shapes.
@@ -44,6 +91,10 @@ struct IShape {
 	IShape();
 	virtual void findClosestIntersection(const Ray& ray, HitRecord& hit) const = 0;
 	virtual void getTexCoords(const dvec3& pt, double& u, double& v) const;
+	void getTexCoordDerivatives(const dvec3& pt, const dvec3& dPdx, const dvec3& dPdy,
+		dvec2& dUVdx, dvec2& dUVdy) const;
+	virtual void cacheRayOrigin(const dvec3& /*origin*/) const {}
+	virtual void clearRayOriginCache() const {}
 	static dvec3 movePointOffSurface(const dvec3& pt, const dvec3& n);
 };
 
@@ -133,6 +184,17 @@ struct QuadricParameters {
 	static QuadricParameters ellipsoidQParams(const dvec3& sz);
 };
 
+/**
+ * @struct	QuadricOriginTerms
+ * @brief	The parts of a quadric's Bq and Cq that only depend on the ray's origin.
+ */
+
+struct QuadricOriginTerms {
+	dvec3 origin;		//!< The ray origin these terms were computed for.
+	dvec3 bLinear;		//!< Bq = dot(Rd, bLinear), for any ray leaving origin.
+	double Cq;			//!< Cq, for any ray leaving origin.
+};
+
 /**
  * @struct	IQuadricSurface
  * @brief	Implicit representation of quadric surface. These shapes can be
@@ -150,11 +212,15 @@ struct IQuadricSurface : public IShape {
 	int findIntersections(const Ray& ray, HitRecord hits[2]) const;
 	dvec3 normal(const dvec3& pt) const;
 	void computeAqBqCq(const Ray& ray, double& Aq, double& Bq, double& Cq) const;
+	virtual void cacheRayOrigin(const dvec3& origin) const;
+	virtual void clearRayOriginCache() const;
 protected:
 	QuadricParameters qParams;		//!< The parameters that make up the quadric
 	double twoA;					//!< 2*A
 	double twoB;					//!< 2*B
 	double twoC;					//!< 2*C
+	mutable vector<QuadricOriginTerms> originCache;	//!< Terms for this frame's camera origins.
+	void computeOriginTerms(const dvec3& origin, dvec3& bLinear, double& Cq) const;
 };
 
 /**
@@ -125,6 +125,34 @@ color PositionalLight::illuminate(const dvec3& interceptWorldCoords,
     }
 }
 
+/**
+ * @fn	color LightSource::illuminateWithVisibility(const dvec3 &interceptWorldCoords,
+ *													const dvec3 &normal, const Material &material,
+ *													const Frame &eyeFrame, double visibility) const
+ * @brief	Like illuminate, but for a point that may be partly shadowed, as reported by
+ * 			visibility. The lit and shadowed colors are blended by the visibility.
+ * @param	interceptWorldCoords	(x, y, z) at the intercept point.
+ * @param	normal				The normal vector.
+ * @param	material			The object's material properties.
+ * @param	eyeFrame			The coordinate frame of the camera.
+ * @param	visibility			0.0 if the point is fully shadowed, 1.0 if fully lit.
+ * @return	The color produced at the intercept point, given this light.
+ */
+
+color LightSource::illuminateWithVisibility(const dvec3& interceptWorldCoords,
+	const dvec3& normal,
+	const Material& material,
+	const Frame& eyeFrame,
+	double visibility) const {
+	if (visibility >= 1.0) {
+		return illuminate(interceptWorldCoords, normal, material, eyeFrame, false);
+	} else if (visibility <= 0.0) {
+		return illuminate(interceptWorldCoords, normal, material, eyeFrame, true);
+	}
+	return visibility * illuminate(interceptWorldCoords, normal, material, eyeFrame, false) +
+		(1.0 - visibility) * illuminate(interceptWorldCoords, normal, material, eyeFrame, true);
+}
+
 /*
 * @fn PositionalLight::actualPosition(const Frame& eyeFrame) const
 * @brief	Returns the global world coordinates of this light.
@@ -151,6 +179,9 @@ bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
 	const vector<VisibleIShapePtr>& objects,
 	const Frame& eyeFrame) const {
 	/* CSE 386 - todo  */
+    if (shadowMap.isOn && shadowMap.isBuilt()) {
+        return shadowMap.pointIsInAShadow(intercept, normal);
+    }
     Ray shadowFeeler = getShadowFeeler(intercept, normal, eyeFrame);
     OpaqueHitRecord hit;
     for (int i = 0; i < objects.size(); i++) {
@@ -164,6 +195,42 @@ bool PositionalLight::pointIsInAShadow(const dvec3& intercept,
 	return false;
 }
 
+/**
+* @fn	double PositionalLight::visibility(const dvec3& intercept, const dvec3& normal, const vector<VisibleIShapePtr>& objects, const Frame& eyeFrame) const
+* @brief	How much of this light reaches an intercept point. With a shadow map, this
+*			is its percentage-closer filtered lookup, which softens the edges of shadows.
+* @param	intercept	the position of the intercept.
+* @param	normal		the normal vector at the intercept point
+* @param	objects		the collection of opaque objects in the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+* @return	0.0 if the point is fully shadowed, 1.0 if fully lit.
+*/
+
+double PositionalLight::visibility(const dvec3& intercept,
+	const dvec3& normal,
+	const vector<VisibleIShapePtr>& objects,
+	const Frame& eyeFrame) const {
+	if (shadowMap.isOn && shadowMap.isBuilt()) {
+		return shadowMap.visibility(intercept, normal);
+	}
+	return pointIsInAShadow(intercept, normal, objects, eyeFrame) ? 0.0 : 1.0;
+}
+
+/**
+* @fn	void PositionalLight::buildShadowMap(const vector<VisibleIShapePtr>& objects, const Frame& eyeFrame)
+* @brief	Rebuilds this light's shadow map, if it is turned on and the light or the
+*			objects have changed. Called once per frame.
+* @param	objects		the collection of opaque objects in the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+*/
+
+void PositionalLight::buildShadowMap(const vector<VisibleIShapePtr>& objects,
+	const Frame& eyeFrame) {
+	if (shadowMap.isOn) {
+		shadowMap.build(pos, objects);
+	}
+}
+
 /**
 * @fn	Ray PositionalLight::getShadowFeeler(const dvec3& interceptWorldCoords, const dvec3& normal, const Frame &eyeFrame) const
 * @brief	Returns the shadow feeler for this light.
@@ -209,6 +276,21 @@ color SpotLight::illuminate(const dvec3& interceptWorldCoords,
     }
 }
 
+/**
+* @fn	void SpotLight::buildShadowMap(const vector<VisibleIShapePtr>& objects, const Frame& eyeFrame)
+* @brief	Rebuilds this light's shadow map, if it is turned on. Only the portion of
+*			the cube map that falls within the spotlight's cone is rendered.
+* @param	objects		the collection of opaque objects in the scene
+* @param	eyeFrame	The coordinate frame of the camera.
+*/
+
+void SpotLight::buildShadowMap(const vector<VisibleIShapePtr>& objects,
+	const Frame& eyeFrame) {
+	if (shadowMap.isOn) {
+		shadowMap.build(pos, objects, spotDir, fov);
+	}
+}
+
 /**
 * @fn	void setDir (double dx, double dy, double dz)
 * @brief	Sets the direction of the spotlight.
@@ -13,6 +13,7 @@
 #include "defs.h"
 #include "hitrecord.h"
 #include "ishape.h"
+#include "shadowmap.h"
 
  /**
   * @struct	LightATParams
@@ -66,6 +67,11 @@ struct LightSource {
 		const Material& material,
 		const Frame& eyeFrame,
 		bool inShadow) const = 0;
+	color illuminateWithVisibility(const dvec3& interceptWorldCoords,
+		const dvec3& normal,
+		const Material& material,
+		const Frame& eyeFrame,
+		double visibility) const;
 	virtual Ray getShadowFeeler(const dvec3& interceptWorldCoords,
 		const dvec3& normal,
 		const Frame& eyeFrame) const = 0;
@@ -73,6 +79,15 @@ struct LightSource {
 		const dvec3& normal,
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const = 0;
+	virtual double visibility(const dvec3& intercept,
+		const dvec3& normal,
+		const vector<VisibleIShapePtr>& objects,
+		const Frame& eyeFrame) const {
+		return pointIsInAShadow(intercept, normal, objects, eyeFrame) ? 0.0 : 1.0;
+	}
+	virtual void buildShadowMap(const vector<VisibleIShapePtr>& /*objects*/,
+		const Frame& /*eyeFrame*/) {
+	}
 };
 
 /**
@@ -85,6 +100,7 @@ struct PositionalLight : public LightSource {
 	bool attenuationIsTurnedOn;	//!< true if attenuation is active.
 	bool isTiedToWorld;			//!< true if the position is in world (or eye) coordinates.
 	LightATParams atParams;
+	ShadowMap shadowMap;		//!< Optional depth maps used in place of shadow feelers.
 
 	PositionalLight(const dvec3& position, const color& C = white)
 		: LightSource(C), pos(position), atParams(0.0, 1.0, 0.0) {
@@ -109,6 +125,12 @@ struct PositionalLight : public LightSource {
 		const dvec3& normal, 
 		const vector<VisibleIShapePtr>& objects,
 		const Frame& eyeFrame) const;
+	virtual double visibility(const dvec3& intercept,
+		const dvec3& normal,
+		const vector<VisibleIShapePtr>& objects,
+		const Frame& eyeFrame) const;
+	virtual void buildShadowMap(const vector<VisibleIShapePtr>& objects,
+		const Frame& eyeFrame);
 };
 
 /**
@@ -133,6 +155,8 @@ struct SpotLight : public PositionalLight {
 									const dvec3& spotDir,
 									double spotFOV,
 									const dvec3& intercept);
+	virtual void buildShadowMap(const vector<VisibleIShapePtr>& objects,
+		const Frame& eyeFrame);
 	void setDir(double dx, double dy, double dz);
 };
 
@@ -0,0 +1,97 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#ifdef WINDOWS
+#define NOMINMAX				// Keeps windows.h's min and max macros away from glm.
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "mappedfile.h"
+
+/**
+ * @fn	MappedFile::MappedFile(const std::string &fileName)
+ * @brief	Opens and maps a file. Check isOpen before using the data.
+ * @param	fileName	Name of the file.
+ */
+
+MappedFile::MappedFile(const std::string& fileName)
+	: isOpened(false), data(nullptr), size(0) {
+#ifdef WINDOWS
+	mapping = nullptr;
+	fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+							OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return;
+	}
+	LARGE_INTEGER length;
+	GetFileSizeEx(fileHandle, &length);
+	size = (size_t)length.QuadPart;
+	isOpened = true;
+	if (size == 0) {
+		return;
+	}
+	mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping != nullptr) {
+		data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (data == nullptr) {
+		isOpened = false;
+		size = 0;
+	}
+#else
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	struct stat info;
+	if (fstat(fd, &info) == 0) {
+		size = (size_t)info.st_size;
+		isOpened = true;
+		if (size > 0) {
+			void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address == MAP_FAILED) {
+				isOpened = false;
+				size = 0;
+			} else {
+				madvise(address, size, MADV_SEQUENTIAL);
+				data = (const char*)address;
+			}
+		}
+	}
+	close(fd);
+#endif
+}
+
+/**
+ * @fn	MappedFile::~MappedFile()
+ * @brief	Unmaps and closes the file.
+ */
+
+MappedFile::~MappedFile() {
+#ifdef WINDOWS
+	if (data != nullptr) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping != nullptr) {
+		CloseHandle(mapping);
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+	}
+#else
+	if (data != nullptr) {
+		munmap((void*)data, size);
+	}
+#endif
+}
@@ -0,0 +1,37 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <string>
+#include "defs.h"
+
+/**
+ * @struct	MappedFile
+ * @brief	A whole file mapped read-only into memory, so parsers can scan it in place
+ * 			(and in parallel) without copying it through a stream. The mapping lasts as
+ * 			long as the object.
+ */
+
+struct MappedFile {
+	MappedFile(const std::string& fileName);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool isOpen() const { return isOpened; }
+	const char* getData() const { return data; }
+	size_t getSize() const { return size; }
+protected:
+	bool isOpened;		//!< true iff the file could be opened.
+	const char* data;	//!< The file's contents, or nullptr if empty.
+	size_t size;		//!< Length of the file, in bytes.
+#ifdef WINDOWS
+	void* fileHandle;	//!< The open file.
+	void* mapping;		//!< The file mapping object.
+#endif
+};
@@ -0,0 +1,243 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#ifdef WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#include "meshcache.h"
+
+/**
+ * @fn	bool MeshCache::stampFile(const string &fileName, MeshSourceStamp &source)
+ * @brief	Reads the size and modification time of a file. The hash is set to 0.
+ * @param 		  	fileName	Name of the file.
+ * @param [in,out]	source  	The stamp.
+ * @return	true iff the file exists.
+ */
+
+bool MeshCache::stampFile(const string& fileName, MeshSourceStamp& source) {
+	std::error_code error;
+	source.size = (uint64_t)std::filesystem::file_size(fileName, error);
+	if (error) {
+		return false;
+	}
+	source.time = (int64_t)std::filesystem::last_write_time(fileName, error).time_since_epoch().count();
+	source.hash = 0;
+	return !error;
+}
+
+/**
+ * @fn	uint64_t MeshCache::hashBytes(const char *data, size_t size)
+ * @brief	Computes the 64-bit FNV-1a hash of some bytes.
+ * @param	data	The bytes.
+ * @param	size	How many there are.
+ * @return	The hash.
+ */
+
+uint64_t MeshCache::hashBytes(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * @fn	uint64_t MeshCache::hashFile(const string &fileName)
+ * @brief	Computes the 64-bit FNV-1a hash of a file's contents.
+ * @param	fileName	Name of the file.
+ * @return	The hash, or 0 if the file cannot be read.
+ */
+
+uint64_t MeshCache::hashFile(const string& fileName) {
+	MappedFile source(fileName);
+	if (!source.isOpen()) {
+		return 0;
+	}
+	return hashBytes(source.getData(), source.getSize());
+}
+
+/**
+ * @fn	static bool isUsable(const MappedFile &file, uint64_t sourceSize)
+ * @brief	Checks that a mapped cache is complete, in the current layout, and made from
+ * 			a source of the given size.
+ * @param	file	  	The mapped cache.
+ * @param	sourceSize	Size of the source file now.
+ * @return	true iff the header can be trusted.
+ */
+
+static bool isUsable(const MappedFile& file, uint64_t sourceSize) {
+	if (!file.isOpen() || file.getSize() < sizeof(MeshCacheHeader)) {
+		return false;
+	}
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file.getData();
+	uint64_t expectedSize = sizeof(MeshCacheHeader) +
+							(uint64_t)h->numVertices * 3 * sizeof(double) +
+							(uint64_t)h->numFaces * 3 * sizeof(double) +
+							(uint64_t)h->numFaces * 4 * sizeof(uint32_t);
+	return std::memcmp(h->magic, MESH_CACHE_MAGIC, sizeof(h->magic)) == 0 &&
+		h->version == MESH_CACHE_VERSION && file.getSize() == expectedSize &&
+		h->sourceSize == sourceSize;
+}
+
+/**
+ * @fn	MeshCache::MeshCache(const string &sourceFileName)
+ * @brief	Maps the cache of a source file, if there is one and it is up to date.
+ * 			Check isValid before using the arrays.
+ * @param	sourceFileName	Name of the source (OBJ) file.
+ */
+
+MeshCache::MeshCache(const string& sourceFileName) : header(nullptr) {
+	MeshSourceStamp source;
+	if (!stampFile(sourceFileName, source)) {
+		return;
+	}
+	const string cacheName = sourceFileName + MESH_CACHE_EXTENSION;
+	file.reset(new MappedFile(cacheName));
+	if (!isUsable(*file, source.size)) {
+		return;
+	}
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file->getData();
+	if (h->sourceTime != source.time) {
+		const uint64_t sourceHash = h->sourceHash;
+		if (sourceHash != hashFile(sourceFileName)) {
+			return;
+		}
+		// Only touched: record the new time so the next load skips the hash. The
+		// mapping is released first, since Windows will not open a mapped file for
+		// writing.
+		file.reset();
+		{
+			std::fstream patch(cacheName, std::ios::in | std::ios::out | std::ios::binary);
+			patch.seekp(offsetof(MeshCacheHeader, sourceTime));
+			patch.write((const char*)&source.time, sizeof(source.time));
+		}
+		file.reset(new MappedFile(cacheName));
+		h = (const MeshCacheHeader*)file->getData();
+		if (!isUsable(*file, source.size) || h->sourceHash != sourceHash) {
+			return;
+		}
+	}
+	header = h;
+	// A corrupt cache must not send createEObj out of bounds.
+	const uint32_t* index = getIndices();
+	for (size_t i = 0; i < (size_t)h->numFaces * 3; i++) {
+		if (index[i] >= h->numVertices) {
+			header = nullptr;
+			return;
+		}
+	}
+}
+
+/**
+ * @fn	const double* MeshCache::getPositions() const
+ * @brief	The vertex positions, x, y and z for each vertex.
+ * @return	The positions.
+ */
+
+const double* MeshCache::getPositions() const {
+	return (const double*)(file->getData() + sizeof(MeshCacheHeader));
+}
+
+/**
+ * @fn	const double* MeshCache::getNormals() const
+ * @brief	The unit normal of each face, x, y and z.
+ * @return	The normals.
+ */
+
+const double* MeshCache::getNormals() const {
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file->getData();
+	return getPositions() + (size_t)h->numVertices * 3;
+}
+
+/**
+ * @fn	const uint32_t* MeshCache::getIndices() const
+ * @brief	The three vertex indices (0-based) of each face.
+ * @return	The indices.
+ */
+
+const uint32_t* MeshCache::getIndices() const {
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file->getData();
+	return (const uint32_t*)(getNormals() + (size_t)h->numFaces * 3);
+}
+
+/**
+ * @fn	const uint32_t* MeshCache::getMaterialIds() const
+ * @brief	The material of each face. 0 is the default material.
+ * @return	The material ids.
+ */
+
+const uint32_t* MeshCache::getMaterialIds() const {
+	const MeshCacheHeader* h = (const MeshCacheHeader*)file->getData();
+	return getIndices() + (size_t)h->numFaces * 3;
+}
+
+/**
+ * @fn	bool MeshCache::write(const string &sourceFileName, const MeshSourceStamp &source,
+ *							const vector<double> &positions, const vector<double> &normals,
+ *							const vector<uint32_t> &indices, const vector<uint32_t> &materialIds)
+ * @brief	Writes the cache of a source file. The file is written under a temporary
+ * 			name and then renamed, so a reader never maps a half-written cache. The
+ * 			temporary name contains the process id, so processes that write the same
+ * 			cache at once do not write into each other's file.
+ * @param	sourceFileName	Name of the source (OBJ) file.
+ * @param	source		  	Stamp of the source as it was parsed. Take it (with
+ * 							stampFile) before reading the source, so that a change made
+ * 							while parsing is noticed by the next load.
+ * @param	positions	  	x, y and z of each vertex.
+ * @param	normals		  	x, y and z of each face's normal.
+ * @param	indices		  	Three 0-based vertex indices per face.
+ * @param	materialIds	  	One material id per face.
+ * @return	true iff the cache was written.
+ */
+
+bool MeshCache::write(const string& sourceFileName, const MeshSourceStamp& source,
+	const vector<double>& positions, const vector<double>& normals,
+	const vector<uint32_t>& indices, const vector<uint32_t>& materialIds) {
+	MeshCacheHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, MESH_CACHE_MAGIC, sizeof(h.magic));
+	h.version = MESH_CACHE_VERSION;
+	h.numVertices = (uint32_t)(positions.size() / 3);
+	h.numFaces = (uint32_t)materialIds.size();
+	h.sourceSize = source.size;
+	h.sourceTime = source.time;
+	h.sourceHash = source.hash;
+
+	const string cacheName = sourceFileName + MESH_CACHE_EXTENSION;
+	const string tempName = sourceFileName + "." + std::to_string(getpid()) +
+								MESH_CACHE_EXTENSION + ".tmp";
+	{
+		std::ofstream out(tempName, std::ios::binary);
+		out.write((const char*)&h, sizeof(h));
+		out.write((const char*)positions.data(), positions.size() * sizeof(double));
+		out.write((const char*)normals.data(), normals.size() * sizeof(double));
+		out.write((const char*)indices.data(), indices.size() * sizeof(uint32_t));
+		out.write((const char*)materialIds.data(), materialIds.size() * sizeof(uint32_t));
+		if (!out) {
+			out.close();
+			std::remove(tempName.c_str());
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempName, cacheName, error);
+	if (error) {
+		std::remove(tempName.c_str());
+		return false;
+	}
+	return true;
+}
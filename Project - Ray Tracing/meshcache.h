@@ -0,0 +1,78 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <memory>
+#include <cstdint>
+#include "defs.h"
+#include "mappedfile.h"
+
+const char MESH_CACHE_MAGIC[8] = { 'C', 'S', 'E', '3', '8', '6', 'M', 'C' };	//!< Starts every cache file.
+const uint32_t MESH_CACHE_VERSION = 1;		//!< Changes whenever the layout does.
+const char MESH_CACHE_EXTENSION[] = ".meshcache";	//!< Appended to the source's name.
+
+/**
+ * @struct	MeshSourceStamp
+ * @brief	Identifies the version of a source file that a cache was made from.
+ */
+
+struct MeshSourceStamp {
+	uint64_t size;		//!< Size of the file, in bytes.
+	int64_t time;		//!< Its modification time, in file clock ticks.
+	uint64_t hash;		//!< FNV-1a hash of its contents.
+};
+
+/**
+ * @struct	MeshCacheHeader
+ * @brief	Start of a mesh cache file. It is followed, with no padding, by
+ * 			numVertices * 3 double positions, numFaces * 3 double face normals,
+ * 			numFaces * 3 uint32 vertex indices (0-based) and numFaces uint32
+ * 			material ids, all in the byte order of the machine that wrote it.
+ */
+
+struct MeshCacheHeader {
+	char magic[8];				//!< MESH_CACHE_MAGIC.
+	uint32_t version;			//!< MESH_CACHE_VERSION.
+	uint32_t numVertices;		//!< Number of positions.
+	uint32_t numFaces;			//!< Number of triangles.
+	uint32_t reserved;			//!< 0; keeps the arrays 8-byte aligned.
+	uint64_t sourceSize;		//!< Size of the source file when the cache was written.
+	int64_t sourceTime;			//!< Its modification time, in file clock ticks.
+	uint64_t sourceHash;		//!< Its FNV-1a hash.
+};
+
+/**
+ * @struct	MeshCache
+ * @brief	A binary copy of a parsed mesh, stored next to its source file (with
+ * 			MESH_CACHE_EXTENSION appended) and memory-mapped when read, so later loads
+ * 			skip parsing altogether. A cache is used only while it matches its source:
+ * 			same size and modification time, or, if only the time differs, same hash.
+ * 			Positions and normals are kept as doubles so a mesh loads exactly as it
+ * 			would from the source.
+ */
+
+struct MeshCache {
+	MeshCache(const string& sourceFileName);
+	bool isValid() const { return header != nullptr; }
+	int getNumVertices() const { return (int)header->numVertices; }
+	int getNumFaces() const { return (int)header->numFaces; }
+	const double* getPositions() const;
+	const double* getNormals() const;
+	const uint32_t* getIndices() const;
+	const uint32_t* getMaterialIds() const;
+	static bool write(const string& sourceFileName, const MeshSourceStamp& source,
+		const vector<double>& positions, const vector<double>& normals,
+		const vector<uint32_t>& indices, const vector<uint32_t>& materialIds);
+	static bool stampFile(const string& fileName, MeshSourceStamp& source);
+	static uint64_t hashBytes(const char* data, size_t size);
+	static uint64_t hashFile(const string& fileName);
+protected:
+	std::unique_ptr<MappedFile> file;	//!< The mapped cache.
+	const MeshCacheHeader* header;		//!< Start of the mapping, or nullptr if not valid.
+};
@@ -0,0 +1,402 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include <numeric>
+#include "meshsimplifier.h"
+
+/**
+ * @fn	Quadric::Quadric()
+ * @brief	Constructs an empty quadric, which measures no error anywhere.
+ */
+
+Quadric::Quadric() : weight(0.0) {
+	std::fill(terms, terms + 10, 0.0);
+}
+
+/**
+ * @fn	Quadric::Quadric(const dvec3 &n, double d, double weight)
+ * @brief	Constructs the quadric of one plane, the points p where dot(n, p) + d = 0.
+ * @param	n	  	Unit normal of the plane.
+ * @param	d	  	Offset of the plane.
+ * @param	weight	How much the plane counts.
+ */
+
+Quadric::Quadric(const dvec3& n, double d, double weight) : weight(weight) {
+	const double plane[4] = { n.x, n.y, n.z, d };
+	int k = 0;
+	for (int i = 0; i < 4; i++) {
+		for (int j = i; j < 4; j++) {
+			terms[k++] = weight * plane[i] * plane[j];
+		}
+	}
+}
+
+/**
+ * @fn	Quadric& Quadric::operator+=(const Quadric &other)
+ * @brief	Adds another quadric's planes to this one.
+ * @param	other	The other quadric.
+ * @return	This quadric.
+ */
+
+Quadric& Quadric::operator+=(const Quadric& other) {
+	for (int k = 0; k < 10; k++) {
+		terms[k] += other.terms[k];
+	}
+	weight += other.weight;
+	return *this;
+}
+
+/**
+ * @fn	double Quadric::evaluate(const dvec3 &pt) const
+ * @brief	Sum of the weighted squared distances from a point to the planes.
+ * @param	pt	The point.
+ * @return	The error at pt.
+ */
+
+double Quadric::evaluate(const dvec3& pt) const {
+	const double x = pt.x, y = pt.y, z = pt.z;
+	const double* q = terms;
+	return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+		q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+		q[7] * z * z + 2.0 * q[8] * z + q[9];
+}
+
+/**
+ * @fn	MeshSimplifier::MeshSimplifier(const IndexedMesh &mesh)
+ * @brief	Prepares to simplify a mesh. Vertices at the same position are welded into one
+ * 			point, so the mesh is simplified as a surface whatever its normals or
+ * 			materials. Each point's quadric holds the planes of the faces around it,
+ * 			weighted by area, and of each border or material seam beside it, which keep
+ * 			those edges in place. The mesh must outlive the simplifier.
+ * @param	mesh	The full detail mesh.
+ */
+
+MeshSimplifier::MeshSimplifier(const IndexedMesh& mesh)
+	: mesh(mesh), numTriangles(mesh.getNumTriangles()), error(0.0) {
+	const double BORDER_WEIGHT = 10.0;
+	const uint32_t NUM_VERTICES = (uint32_t)mesh.getNumVertices();
+	const uint32_t NUM_TRIANGLES = (uint32_t)mesh.getNumTriangles();
+
+	vertexMaterials.assign(NUM_VERTICES, 0);
+	triangleMaterials.assign(NUM_TRIANGLES, 0);
+	for (const Submesh& submesh : mesh.submeshes) {
+		for (uint32_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.numIndices; i++) {
+			vertexMaterials[mesh.indices[i]] = submesh.materialId;
+			triangleMaterials[i / 3] = submesh.materialId;
+		}
+	}
+
+	// Weld equal positions, by sorting the vertices.
+	vector<uint32_t> order(NUM_VERTICES);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		const dvec3& A = mesh.positions[a];
+		const dvec3& B = mesh.positions[b];
+		return A.x != B.x ? A.x < B.x : (A.y != B.y ? A.y < B.y : A.z < B.z);
+	});
+	vertexPoints.resize(NUM_VERTICES);
+	for (uint32_t i = 0; i < NUM_VERTICES; i++) {
+		const dvec3& P = mesh.positions[order[i]];
+		if (i == 0 || P != points.back()) {
+			points.push_back(P);
+			firstAtPoint.push_back(i);
+		}
+		vertexPoints[order[i]] = (uint32_t)points.size() - 1;
+	}
+	firstAtPoint.push_back(NUM_VERTICES);
+	verticesAtPoint.swap(order);
+
+	const uint32_t NUM_POINTS = (uint32_t)points.size();
+	parents.resize(NUM_POINTS);
+	std::iota(parents.begin(), parents.end(), 0);
+	versions.assign(NUM_POINTS, 0);
+	quadrics.assign(NUM_POINTS, Quadric());
+	trianglesAround.resize(NUM_POINTS);
+	isRemoved.assign(NUM_TRIANGLES, false);
+
+	// Face planes, and the edges of each face, keyed by their ends.
+	vector<dvec3> faceNormals(NUM_TRIANGLES, ZEROVEC);
+	vector<std::pair<uint64_t, uint32_t>> edges;
+	edges.reserve(3 * NUM_TRIANGLES);
+	for (uint32_t t = 0; t < NUM_TRIANGLES; t++) {
+		const uint32_t c[3] = { corner(t, 0), corner(t, 1), corner(t, 2) };
+		if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) {
+			isRemoved[t] = true;
+			numTriangles--;
+			continue;
+		}
+		dvec3 n = glm::cross(points[c[1]] - points[c[0]], points[c[2]] - points[c[0]]);
+		double length = glm::length(n);
+		if (length > 0.0) {
+			faceNormals[t] = n / length;
+			Quadric face(faceNormals[t], -glm::dot(faceNormals[t], points[c[0]]), length / 2.0);
+			for (int j = 0; j < 3; j++) {
+				quadrics[c[j]] += face;
+			}
+		}
+		for (int j = 0; j < 3; j++) {
+			trianglesAround[c[j]].push_back(t);
+			uint32_t a = glm::min(c[j], c[(j + 1) % 3]);
+			uint32_t b = glm::max(c[j], c[(j + 1) % 3]);
+			edges.push_back(std::make_pair(((uint64_t)a << 32) | b, t));
+		}
+	}
+
+	// An edge with one face, or with faces of different materials, gets a plane through
+	// it, perpendicular to each face.
+	std::sort(edges.begin(), edges.end());
+	for (size_t first = 0, end = 0; first < edges.size(); first = end) {
+		const uint64_t KEY = edges[first].first;
+		bool isSeam = false;
+		for (end = first; end < edges.size() && edges[end].first == KEY; end++) {
+			isSeam = isSeam || triangleMaterials[edges[end].second] != triangleMaterials[edges[first].second];
+		}
+		const uint32_t A = (uint32_t)(KEY >> 32);
+		const uint32_t B = (uint32_t)(KEY & 0xFFFFFFFF);
+		if (end - first == 1 || isSeam) {
+			dvec3 edge = points[B] - points[A];
+			for (size_t e = first; e < end; e++) {
+				dvec3 n = glm::cross(edge, faceNormals[edges[e].second]);
+				double length = glm::length(n);
+				if (length > 0.0) {
+					n /= length;
+					Quadric border(n, -glm::dot(n, points[A]), BORDER_WEIGHT * glm::dot(edge, edge));
+					quadrics[A] += border;
+					quadrics[B] += border;
+				}
+			}
+		}
+	}
+	for (size_t e = 0; e < edges.size(); e++) {
+		if (e == 0 || edges[e].first != edges[e - 1].first) {
+			const uint32_t A = (uint32_t)(edges[e].first >> 32);
+			const uint32_t B = (uint32_t)(edges[e].first & 0xFFFFFFFF);
+			propose(A, B);
+		}
+	}
+}
+
+/**
+ * @fn	uint32_t MeshSimplifier::root(uint32_t point)
+ * @brief	The point that a point has been moved onto, following every collapse since.
+ * @param	point	The point.
+ * @return	The point that now stands for it.
+ */
+
+uint32_t MeshSimplifier::root(uint32_t point) {
+	uint32_t result = point;
+	while (parents[result] != result) {
+		result = parents[result];
+	}
+	while (parents[point] != result) {
+		uint32_t next = parents[point];
+		parents[point] = result;
+		point = next;
+	}
+	return result;
+}
+
+/**
+ * @fn	uint32_t MeshSimplifier::corner(uint32_t triangle, int j)
+ * @brief	The point at a corner of a triangle.
+ * @param	triangle	The triangle.
+ * @param	j			The corner, 0, 1 or 2.
+ * @return	The point.
+ */
+
+uint32_t MeshSimplifier::corner(uint32_t triangle, int j) {
+	return root(vertexPoints[mesh.indices[3 * triangle + j]]);
+}
+
+/**
+ * @fn	MeshSimplifier::Collapse MeshSimplifier::makeCollapse(uint32_t from, uint32_t to) const
+ * @brief	Makes the collapse of from onto to. Its cost is the mean squared distance from
+ * 			to to the planes of both points' quadrics.
+ * @param	from	The point to move.
+ * @param	to  	The point it moves onto.
+ * @return	The collapse.
+ */
+
+MeshSimplifier::Collapse MeshSimplifier::makeCollapse(uint32_t from, uint32_t to) const {
+	Quadric q = quadrics[from];
+	q += quadrics[to];
+	double cost = q.weight > 0.0 ? glm::max(q.evaluate(points[to]), 0.0) / q.weight : 0.0;
+	return Collapse{ cost, from, to, versions[from], versions[to], true };
+}
+
+/**
+ * @fn	void MeshSimplifier::propose(uint32_t a, uint32_t b)
+ * @brief	Queues the cheaper way of collapsing the edge between two points. The other
+ * 			way is queued in turn if that one turns out not to be allowed.
+ * @param	a	One point.
+ * @param	b	The other point.
+ */
+
+void MeshSimplifier::propose(uint32_t a, uint32_t b) {
+	Collapse ab = makeCollapse(a, b);
+	Collapse ba = makeCollapse(b, a);
+	collapses.push(ab.cost <= ba.cost ? ab : ba);
+}
+
+/**
+ * @fn	bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to)
+ * @brief	Determines if from can be moved onto to. It cannot if that would turn any
+ * 			face around, or leave a face with a material that none of to's vertices have.
+ * @param	from	The point to move.
+ * @param	to  	The point it moves onto.
+ * @return	true iff the collapse is allowed.
+ */
+
+bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to) {
+	for (uint32_t t : trianglesAround[from]) {
+		if (isRemoved[t]) {
+			continue;
+		}
+		uint32_t c[3] = { corner(t, 0), corner(t, 1), corner(t, 2) };
+		if (c[0] == to || c[1] == to || c[2] == to) {
+			continue;
+		}
+		bool hasMaterial = false;
+		for (uint32_t i = firstAtPoint[to]; i < firstAtPoint[to + 1] && !hasMaterial; i++) {
+			hasMaterial = vertexMaterials[verticesAtPoint[i]] == triangleMaterials[t];
+		}
+		if (!hasMaterial) {
+			return false;
+		}
+		dvec3 before = glm::cross(points[c[1]] - points[c[0]], points[c[2]] - points[c[0]]);
+		for (int j = 0; j < 3; j++) {
+			c[j] = c[j] == from ? to : c[j];
+		}
+		dvec3 after = glm::cross(points[c[1]] - points[c[0]], points[c[2]] - points[c[0]]);
+		if (glm::dot(before, after) < 0.0 || (after == ZEROVEC && before != ZEROVEC)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @fn	void MeshSimplifier::collapse(const Collapse &c)
+ * @brief	Moves c.from onto c.to. The faces that had both lose their area and are
+ * 			removed, and every edge at c.to is proposed again with its new cost.
+ * @param	c	The collapse.
+ */
+
+void MeshSimplifier::collapse(const Collapse& c) {
+	parents[c.from] = c.to;
+	quadrics[c.to] += quadrics[c.from];
+	versions[c.from]++;
+	versions[c.to]++;
+	error = glm::max(error, std::sqrt(c.cost));
+
+	vector<uint32_t>& around = trianglesAround[c.to];
+	for (uint32_t t : trianglesAround[c.from]) {
+		if (isRemoved[t]) {
+			continue;
+		}
+		uint32_t a = corner(t, 0), b = corner(t, 1), d = corner(t, 2);
+		if (a == b || b == d || d == a) {
+			isRemoved[t] = true;
+			numTriangles--;
+		} else {
+			around.push_back(t);
+		}
+	}
+	vector<uint32_t>().swap(trianglesAround[c.from]);
+	std::sort(around.begin(), around.end());
+	around.erase(std::unique(around.begin(), around.end()), around.end());
+	around.erase(std::remove_if(around.begin(), around.end(),
+		[&](uint32_t t) { return (bool)isRemoved[t]; }), around.end());
+
+	vector<uint32_t> neighbors;
+	for (uint32_t t : around) {
+		for (int j = 0; j < 3; j++) {
+			uint32_t p = corner(t, j);
+			if (p != c.to) {
+				neighbors.push_back(p);
+			}
+		}
+	}
+	std::sort(neighbors.begin(), neighbors.end());
+	neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+	for (uint32_t p : neighbors) {
+		propose(c.to, p);
+	}
+}
+
+/**
+ * @fn	void MeshSimplifier::simplify(int targetTriangles)
+ * @brief	Collapses edges, cheapest first, until at most targetTriangles are left or
+ * 			no allowed collapse remains.
+ * @param	targetTriangles	The number of triangles wanted.
+ */
+
+void MeshSimplifier::simplify(int targetTriangles) {
+	while (numTriangles > targetTriangles && !collapses.empty()) {
+		Collapse c = collapses.top();
+		collapses.pop();
+		if (versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion) {
+			continue;
+		}
+		if (canCollapse(c.from, c.to)) {
+			collapse(c);
+		} else if (c.isCheaperWay) {
+			Collapse reverse = makeCollapse(c.to, c.from);
+			reverse.isCheaperWay = false;
+			collapses.push(reverse);
+		}
+	}
+}
+
+/**
+ * @fn	MeshLOD MeshSimplifier::getLOD()
+ * @brief	The triangles left, in their original order and submeshes. A corner whose point
+ * 			has moved takes the vertex at the new point with the triangle's material
+ * 			and the normal closest to its old one. Clusters are not built.
+ * @return	The level of detail.
+ */
+
+MeshLOD MeshSimplifier::getLOD() {
+	MeshLOD lod;
+	lod.error = error;
+	lod.indices.reserve(3 * numTriangles);
+	for (const Submesh& submesh : mesh.submeshes) {
+		Submesh part = { (uint32_t)lod.indices.size(), 0, submesh.materialId };
+		const uint32_t END = (submesh.firstIndex + submesh.numIndices) / 3;
+		for (uint32_t t = submesh.firstIndex / 3; t < END; t++) {
+			if (isRemoved[t]) {
+				continue;
+			}
+			for (int j = 0; j < 3; j++) {
+				uint32_t v = mesh.indices[3 * t + j];
+				uint32_t p = corner(t, j);
+				if (p != vertexPoints[v]) {
+					uint32_t best = verticesAtPoint[firstAtPoint[p]];
+					double bestAlignment = -DBL_MAX;
+					for (uint32_t i = firstAtPoint[p]; i < firstAtPoint[p + 1]; i++) {
+						uint32_t w = verticesAtPoint[i];
+						double alignment = glm::dot(mesh.normals[w], mesh.normals[v]);
+						if (vertexMaterials[w] == triangleMaterials[t] && alignment > bestAlignment) {
+							best = w;
+							bestAlignment = alignment;
+						}
+					}
+					v = best;
+				}
+				lod.indices.push_back(v);
+			}
+			part.numIndices += 3;
+		}
+		if (part.numIndices > 0) {
+			lod.submeshes.push_back(part);
+		}
+	}
+	return lod;
+}
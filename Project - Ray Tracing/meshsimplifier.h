@@ -0,0 +1,89 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <queue>
+#include <functional>
+#include "defs.h"
+#include "indexedmesh.h"
+
+/**
+ * @struct	Quadric
+ * @brief	A sum of weighted squared distances to planes (Garland and Heckbert's error
+ * 			quadric), stored as the 10 distinct entries of a symmetric 4x4 matrix.
+ */
+
+struct Quadric {
+	double terms[10];	//!< xx, xy, xz, x, yy, yz, y, zz, z, 1.
+	double weight;		//!< Total weight of the planes.
+
+	Quadric();
+	Quadric(const dvec3& n, double d, double weight);
+	Quadric& operator+=(const Quadric& other);
+	double evaluate(const dvec3& pt) const;
+};
+
+/**
+ * @class	MeshSimplifier
+ * @brief	Simplifies an IndexedMesh by collapsing edges, cheapest first, where the cost
+ * 			of moving a point is measured by the quadric of the faces around it. Each
+ * 			collapse moves one end of an edge onto the other, so the simplified
+ * 			triangles still index the mesh's own vertices. Mesh borders and the seams
+ * 			between materials are held in place by extra planes along them.
+ *
+ * 			simplify may be called repeatedly with smaller targets, and getLOD taken
+ * 			after each, to make a chain of levels of detail.
+ */
+
+class MeshSimplifier {
+public:
+	MeshSimplifier(const IndexedMesh& mesh);
+	void simplify(int targetTriangles);
+	int getNumTriangles() const { return numTriangles; }
+	double getError() const { return error; }
+	MeshLOD getLOD();
+protected:
+	/**
+	 * @struct	Collapse
+	 * @brief	A proposal to move point "from" onto point "to". It is out of date if
+	 * 			either point has changed since it was made.
+	 */
+	struct Collapse {
+		double cost;			//!< Mean squared distance from the merged faces' planes.
+		uint32_t from, to;		//!< The points.
+		uint32_t fromVersion;	//!< versions[from] when proposed.
+		uint32_t toVersion;		//!< versions[to] when proposed.
+		bool isCheaperWay;		//!< false once the other way round has been refused.
+
+		bool operator>(const Collapse& other) const { return cost > other.cost; }
+	};
+
+	const IndexedMesh& mesh;				//!< The full detail mesh.
+	vector<uint32_t> vertexPoints;			//!< Point of each vertex.
+	vector<int> vertexMaterials;			//!< Material of each vertex.
+	vector<int> triangleMaterials;			//!< Material of each triangle.
+	vector<dvec3> points;					//!< Distinct vertex positions.
+	vector<uint32_t> firstAtPoint;			//!< Start of each point's run in verticesAtPoint.
+	vector<uint32_t> verticesAtPoint;		//!< Vertices, grouped by point.
+	vector<uint32_t> parents;				//!< The point each point was moved onto, or itself.
+	vector<uint32_t> versions;				//!< Incremented whenever a point changes.
+	vector<Quadric> quadrics;				//!< Error quadric of each point.
+	vector<vector<uint32_t>> trianglesAround;	//!< Triangles that use each point.
+	vector<bool> isRemoved;					//!< Per triangle, true once it has collapsed.
+	std::priority_queue<Collapse, vector<Collapse>, std::greater<Collapse>> collapses;
+	int numTriangles;						//!< Triangles left.
+	double error;							//!< Largest error of any collapse so far.
+
+	uint32_t root(uint32_t point);
+	uint32_t corner(uint32_t triangle, int j);
+	Collapse makeCollapse(uint32_t from, uint32_t to) const;
+	void propose(uint32_t a, uint32_t b);
+	bool canCollapse(uint32_t from, uint32_t to);
+	void collapse(const Collapse& c);
+};
@@ -17,7 +17,53 @@
   */
 
 RayTracer::RayTracer(const color& defa)
-	: defaultColor(defa) {
+	: defaultColor(defa), deferredShading(false), showsFrames(true), showsAxes(true),
+	filtersTextures(true) {
+}
+
+const double AXIS_THICKNESS = 0.25;		//!< Radius of the axis overlay's tubes.
+
+/**
+ * @fn	const unsigned char* pixelAxes(const unsigned char *mask, const RaytracingCamera &camera, int x, int y, int N)
+ * @brief	Finds one pixel's entries in an axis mask.
+ * @param	mask  	The camera's axis mask, or nullptr.
+ * @param	camera	The camera.
+ * @param	x	  	The pixel's x coordinate, according to the camera.
+ * @param	y	  	The pixel's y coordinate, according to the camera.
+ * @param	N	  	The square root of the number of samples per pixel.
+ * @return	The pixel's N*N entries, or nullptr if there are none.
+ */
+
+static const unsigned char* pixelAxes(const unsigned char* mask, const RaytracingCamera& camera,
+	int x, int y, int N) {
+	if (mask == nullptr || x < 0 || y < 0 || x >= camera.getNX() || y >= camera.getNY()) {
+		return nullptr;
+	}
+	return mask + (y * camera.getNX() + x) * N * N;
+}
+
+/**
+ * @fn	static double textureLOD(const Image &texture, const IShape &shape, const Ray &ray,
+ *									const RayDifferential &diff, double t, const dvec3 &pt, const dvec3 &normal)
+ * @brief	Finds the mipmap level of detail for a hit on a textured shape, by carrying
+ * 			the ray's differential to the hit and measuring the footprint in texels.
+ * @param	texture	The shape's texture.
+ * @param	shape 	The shape that was hit.
+ * @param	ray   	The ray.
+ * @param	diff  	The ray's differential, per sample.
+ * @param	t	  	Where the ray hit.
+ * @param	pt	  	The hit point.
+ * @param	normal	The normal vector at the hit.
+ * @return	The level of detail.
+ */
+
+static double textureLOD(const Image& texture, const IShape& shape, const Ray& ray,
+	const RayDifferential& diff, double t, const dvec3& pt, const dvec3& normal) {
+	dvec3 dPdx, dPdy;
+	diff.transfer(ray, t, normal, dPdx, dPdy);
+	dvec2 dUVdx, dUVdy;
+	shape.getTexCoordDerivatives(pt, dPdx, dPdy, dUVdx, dUVdy);
+	return texture.getLevelOfDetail(dUVdx, dUVdy);
 }
 
 /**
@@ -32,80 +78,295 @@ void RayTracer::raytraceScene(FrameBuffer& frameBuffer, int depth,
 	const IScene& theScene, int N) const {
 	const RaytracingCamera& camera = *theScene.camera;
 	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
-    const vector<TransparentIShapePtr>& objs2 = theScene.transparentObjs;
 	const vector<LightSourcePtr>& lights = theScene.lights;
 	
     frameBuffer.setClearColor(defaultColor);
-    frameBuffer.clearColorBuffer();
+    frameBuffer.clearColorBuffer(true);
+
+    for (const LightSourcePtr& L : lights) {
+        L->buildShadowMap(objs, camera.getFrame());
+    }
+    camera.cacheSubpixelRays(N);
+    cacheCameraOrigins(theScene, { theScene.camera });
+    const unsigned char* axisMask = getAxisMask(camera, N);
+
+    if (deferredShading) {
+        fillGBuffer(frameBuffer, theScene, N);
+        shadeGBuffer(theScene, N);
+        resolveGBuffer(frameBuffer, theScene, N);
+        cacheCameraOrigins(theScene, {});
+        if (showsFrames) {
+            frameBuffer.showColorBuffer();
+        }
+        return;
+    }
     
-    for (int y = 0; y < frameBuffer.getWindowHeight(); ++y) {
-        for (int x = 0; x < frameBuffer.getWindowWidth(); ++x) {
-            DEBUG_PIXEL = (x == xDebug && y == yDebug);
-            if (DEBUG_PIXEL) {
-                cout << "";
+    // Each band of rows one tile high is written at once, so that every tile it
+    // covers is written whole and its lazy clear is skipped.
+    const int W = frameBuffer.getWindowWidth();
+    const int H = frameBuffer.getWindowHeight();
+    vector<color> band(W * FRAMEBUFFER_TILE_SIZE);
+    for (int y0 = 0; y0 < H; y0 += FRAMEBUFFER_TILE_SIZE) {
+        frameBuffer.expectTileWrites(BoundingBoxi(0, W, y0, glm::min(FRAMEBUFFER_TILE_SIZE, H - y0)));
+    }
+    for (int y0 = 0; y0 < H; y0 += FRAMEBUFFER_TILE_SIZE) {
+        const int ROWS = glm::min(FRAMEBUFFER_TILE_SIZE, H - y0);
+        for (int y = y0; y < y0 + ROWS; ++y) {
+            for (int x = 0; x < W; ++x) {
+                DEBUG_PIXEL = (x == xDebug && y == yDebug);
+                if (DEBUG_PIXEL) {
+                    cout << "";
+                }
+                band[(y - y0) * W + x] = tracePixel(theScene, camera, x, y, N, pixelAxes(axisMask, camera, x, y, N));
             }
-            /* CSE 386 - todo  */
-            OpaqueHitRecord opaqueHit;
-            TransparentHitRecord transHit;
-            color finalColor = black;
-            dvec2 rayPositions[N * N];
-            int index = 0;
-                for (int i = 0; i < N; i++) {
-                    for (int j = 0; j < N; j++) {
-                        rayPositions[index] = dvec2((1.0 / (2.0 * N)) + ((1.0 / N) * i),
-                                                   (1.0 / (2.0 * N)) + ((1.0 / N) * j));
-                        index++;
-                    }
+        }
+        frameBuffer.setColors(BoundingBoxi(0, W, y0, ROWS), band.data());
+    }
+    cacheCameraOrigins(theScene, {});
+    if (showsFrames) {
+        frameBuffer.showColorBuffer();
+    }
+}
+
+/**
+ * @fn	void RayTracer::raytraceViews(FrameBuffer &frameBuffer, const IScene &theScene,
+ *									const vector<RaytracingCamera*> &cameras,
+ *									const vector<BoundingBoxi> &viewports, int N) const
+ * @brief	Renders the scene from several cameras at once, each into its own viewport
+ * 			of the framebuffer. The per-frame preparation (shadow maps, ray tables,
+ * 			cached camera origins) is done once for all of the views, and then the rows
+ * 			of every viewport are traced as one parallel job. Each camera should be
+ * 			sized to match its viewport. Always uses forward shading. Nothing is traced
+ * 			unless there is exactly one viewport per camera.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	theScene   	The scene. Its camera is not used.
+ * @param 		  	cameras	   	One camera per view.
+ * @param 		  	viewports  	Where each view goes in the framebuffer.
+ * @param 		  	N		   	The square root of the number of samples per pixel.
+ */
+
+void RayTracer::raytraceViews(FrameBuffer& frameBuffer, const IScene& theScene,
+	const vector<RaytracingCamera*>& cameras, const vector<BoundingBoxi>& viewports, int N) const {
+	frameBuffer.setClearColor(defaultColor);
+	frameBuffer.clearColorBuffer(true);
+	if (cameras.empty() || cameras.size() != viewports.size()) {
+		if (showsFrames) {
+			frameBuffer.showColorBuffer();
+		}
+		return;
+	}
+
+	for (const LightSourcePtr& L : theScene.lights) {
+		L->buildShadowMap(theScene.opaqueObjs, cameras[0]->getFrame());
+	}
+	// One job per framebuffer tile per viewport, so that each thread writes whole
+	// tiles (contiguous memory when the framebuffer has a tiled layout).
+	vector<int> jobView;
+	vector<BoundingBoxi> jobBounds;
+	for (size_t v = 0; v < cameras.size(); v++) {
+		cameras[v]->cacheSubpixelRays(N);
+		getAxisMask(*cameras[v], N);
+		const BoundingBoxi& vp = viewports[v];
+		for (int tile = 0; tile < frameBuffer.getNumTiles(); tile++) {
+			BoundingBoxi bounds = frameBuffer.getTileBounds(tile);
+			int left = glm::max(bounds.lx, vp.lx);
+			int right = glm::min(bounds.lx + bounds.width, vp.lx + vp.width);
+			int bottom = glm::max(bounds.ly, vp.ly);
+			int top = glm::min(bounds.ly + bounds.height, vp.ly + vp.height);
+			if (left < right && bottom < top) {
+				jobView.push_back((int)v);
+				jobBounds.push_back(BoundingBoxi(left, right - left, bottom, top - bottom));
+			}
+		}
+	}
+	for (const BoundingBoxi& bounds : jobBounds) {
+		frameBuffer.expectTileWrites(bounds);
+	}
+	cacheCameraOrigins(theScene, cameras);
+	vector<const unsigned char*> masks;
+	for (const RaytracingCamera* camera : cameras) {
+		masks.push_back(getAxisMask(*camera, N));	// all built above, so these stay put
+	}
+
+	parallelFor(0, (int)jobBounds.size(), [&](int job) {
+		const RaytracingCamera& camera = *cameras[jobView[job]];
+		const BoundingBoxi& vp = viewports[jobView[job]];
+		const BoundingBoxi& bounds = jobBounds[job];
+		vector<color> block(bounds.width * bounds.height);
+		for (int py = bounds.ly; py < bounds.ly + bounds.height; py++) {
+			for (int px = bounds.lx; px < bounds.lx + bounds.width; px++) {
+				int x = px - vp.lx;
+				int y = py - vp.ly;
+				block[(py - bounds.ly) * bounds.width + (px - bounds.lx)] =
+					tracePixel(theScene, camera, x, y, N, pixelAxes(masks[jobView[job]], camera, x, y, N));
+			}
+		}
+		frameBuffer.setColors(bounds, block.data());
+	});
+
+	cacheCameraOrigins(theScene, {});
+	if (showsFrames) {
+		frameBuffer.showColorBuffer();
+	}
+}
+
+/**
+ * @fn	const unsigned char* RayTracer::getAxisMask(const RaytracingCamera &camera, int N) const
+ * @brief	Returns the axis overlay for a camera's samples, building it only when the
+ * 			camera has moved, turned, been resized or N has changed. This replaces three
+ * 			quadric solves per sample with a table lookup.
+ * @param	camera	The camera.
+ * @param	N	  	The square root of the number of samples per pixel.
+ * @return	N*N entries per pixel, or nullptr if showsAxes is false.
+ */
+
+const unsigned char* RayTracer::getAxisMask(const RaytracingCamera& camera, int N) const {
+	if (!showsAxes) {
+		return nullptr;
+	}
+	AxisMask* mask = nullptr;
+	for (AxisMask& m : axisMasks) {
+		if (m.camera == &camera) {
+			mask = &m;
+		}
+	}
+	if (mask == nullptr) {
+		axisMasks.push_back(AxisMask());
+		mask = &axisMasks.back();
+		mask->camera = &camera;
+		mask->N = 0;
+	}
+	const int NX = camera.getNX();
+	const int NY = camera.getNY();
+	if (mask->N == N && mask->revision == camera.getRevision() && mask->nx == NX &&
+		mask->ny == NY && mask->origin == camera.getFrame().origin) {
+		return mask->axes.data();
+	}
+
+	mask->revision = camera.getRevision();
+	mask->origin = camera.getFrame().origin;
+	mask->nx = NX;
+	mask->ny = NY;
+	mask->N = N;
+	mask->axes.assign(NX * NY * N * N, NO_AXIS);
+	unsigned char* axes = mask->axes.data();
+	parallelFor(0, NY, [&](int y) {
+		for (int x = 0; x < NX; x++) {
+			for (int i = 0; i < N * N; i++) {
+				Ray ray = camera.getSubpixelRay(x, y, i / N, i % N, N);
+				axes[(y * NX + x) * N * N + i] = (unsigned char)FrameBuffer::axisHitAt(x, y, ray, AXIS_THICKNESS);
+			}
+		}
+	});
+	return mask->axes.data();
+}
+
+/**
+ * @fn	color RayTracer::tracePixel(const IScene &theScene, const RaytracingCamera &camera,
+ *									int x, int y, int N, const unsigned char *axes) const
+ * @brief	Traces and shades the N*N samples of one pixel.
+ * @param	theScene	The scene.
+ * @param	camera  	The camera to trace from.
+ * @param	x		   	The pixel's x coordinate, according to the camera.
+ * @param	y		   	The pixel's y coordinate, according to the camera.
+ * @param	N		   	The square root of the number of samples per pixel.
+ * @param	axes	   	The pixel's entries in the axis mask, or nullptr for no axes.
+ * @return	The pixel's color; defaultColor if no sample hit anything.
+ */
+
+color RayTracer::tracePixel(const IScene& theScene, const RaytracingCamera& camera,
+	int x, int y, int N, const unsigned char* axes) const {
+	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
+    const vector<TransparentIShapePtr>& objs2 = theScene.transparentObjs;
+	const vector<LightSourcePtr>& lights = theScene.lights;
+
+    /* CSE 386 - todo  */
+    OpaqueHitRecord opaqueHit;
+    TransparentHitRecord transHit;
+    color finalColor = black;
+    color pixelColor = defaultColor;
+    RayDifferential sampleDiff = filtersTextures ? camera.getRayDifferential(x, y).scaled(1.0 / N) : RayDifferential();
+    for (int i = 0; i < N * N; i++) {
+        Ray ray = camera.getSubpixelRay(x, y, i / N, i % N, N);
+        VisibleIShape::findIntersection(ray, objs, opaqueHit);
+        TransparentIShape::findIntersection(ray, objs2, transHit);
+        if (glm::dot(ray.dir, opaqueHit.normal) > 0.0) {
+            opaqueHit.normal = -opaqueHit.normal;
+        }
+        color texel = black;
+        if (opaqueHit.t != FLT_MAX && opaqueHit.texture != nullptr) {
+            if (filtersTextures) {
+                double lod = textureLOD(*opaqueHit.texture, *opaqueHit.shape, ray, sampleDiff,
+                                        opaqueHit.t, opaqueHit.interceptPt, opaqueHit.normal);
+                texel = opaqueHit.texture->sampleUV(opaqueHit.u, opaqueHit.v, lod);
+            } else {
+                texel = opaqueHit.texture->getPixelUV(opaqueHit.u, opaqueHit.v);
             }
-            for (int i = 0; i < N * N; i++) {
-                Ray ray = camera.getRay(x + rayPositions[i].x, y + rayPositions[i].y);
-                VisibleIShape::findIntersection(ray, objs, opaqueHit);
-                TransparentIShape::findIntersection(ray, objs2, transHit);
-                if (glm::dot(ray.dir, opaqueHit.normal) > 0.0) {
-                    opaqueHit.normal = -opaqueHit.normal;
+        }
+        dvec3 pt = IShape::movePointOffSurface(opaqueHit.interceptPt, opaqueHit.normal);
+        for (unsigned int i = 0; i < lights.size(); i++) {
+            const LightSourcePtr L = lights[i];
+            double visible = L->visibility(pt, opaqueHit.normal, objs, camera.getFrame());
+            if (opaqueHit.t != FLT_MAX && transHit.t == FLT_MAX) {
+                finalColor += glm::clamp(L->illuminateWithVisibility(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), visible), 0.0, 1.0) / (double)(N * N);
+                if (opaqueHit.texture != nullptr) {
+                    pixelColor = finalColor * 0.5 + texel * 0.5;
+                } else {
+                    pixelColor = finalColor;
                 }
-                dvec3 pt = IShape::movePointOffSurface(opaqueHit.interceptPt, opaqueHit.normal);
-                for (unsigned int i = 0; i < lights.size(); i++) {
-                    const LightSourcePtr L = lights[i];
-                    bool shadow = L->pointIsInAShadow(pt, opaqueHit.normal, objs, camera.getFrame());
-                    if (opaqueHit.t != FLT_MAX && transHit.t == FLT_MAX) {
-                        finalColor += glm::clamp(L->illuminate(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), shadow), 0.0, 1.0) / (double)(N * N);
-                        if (opaqueHit.texture != nullptr) {
-                            color texel = opaqueHit.texture->getPixelUV(opaqueHit.u, opaqueHit.v);
-                            frameBuffer.setColor(x, y, finalColor * 0.5 + texel * 0.5);
-                        } else {
-                            frameBuffer.setColor(x, y, finalColor);
-                        }
-                    } else if (opaqueHit.t == FLT_MAX && transHit.t != FLT_MAX) {
-                        finalColor += glm::clamp(((1 - transHit.alpha) * defaultColor) + (transHit.alpha * transHit.transColor), 0.0, 1.0) / ((double)lights.size() * (double)(N * N));
-                        frameBuffer.setColor(x, y, finalColor);
-                    } else if (opaqueHit.t != FLT_MAX && transHit.t != FLT_MAX) {
-                        if (opaqueHit.t < transHit.t) {
-                            finalColor += glm::clamp(L->illuminate(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), shadow), 0.0, 1.0) / (double)(N * N);
-                            if (opaqueHit.texture != nullptr) {
-                                color texel = opaqueHit.texture->getPixelUV(opaqueHit.u, opaqueHit.v);
-                                frameBuffer.setColor(x, y, finalColor * 0.5 + texel * 0.5);
-                            } else {
-                                frameBuffer.setColor(x, y, finalColor);
-                            }
-                        } else {
-                            color source = transHit.transColor / (double)lights.size();
-                            color destination = L->illuminate(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), shadow);
-                            finalColor += glm::clamp(((1 - transHit.alpha) * destination) + (transHit.alpha * source), 0.0, 1.0) / (double)(N * N);
-                            if (opaqueHit.texture != nullptr) {
-                                color texel = opaqueHit.texture->getPixelUV(opaqueHit.u, opaqueHit.v);
-                                frameBuffer.setColor(x, y, finalColor * 0.5 + texel * 0.5);
-                            } else {
-                                frameBuffer.setColor(x, y, finalColor);
-                            }
-                        }
+            } else if (opaqueHit.t == FLT_MAX && transHit.t != FLT_MAX) {
+                finalColor += glm::clamp(((1 - transHit.alpha) * defaultColor) + (transHit.alpha * transHit.transColor), 0.0, 1.0) / ((double)lights.size() * (double)(N * N));
+                pixelColor = finalColor;
+            } else if (opaqueHit.t != FLT_MAX && transHit.t != FLT_MAX) {
+                if (opaqueHit.t < transHit.t) {
+                    finalColor += glm::clamp(L->illuminateWithVisibility(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), visible), 0.0, 1.0) / (double)(N * N);
+                    if (opaqueHit.texture != nullptr) {
+                        pixelColor = finalColor * 0.5 + texel * 0.5;
+                    } else {
+                        pixelColor = finalColor;
+                    }
+                } else {
+                    color source = transHit.transColor / (double)lights.size();
+                    color destination = L->illuminateWithVisibility(opaqueHit.interceptPt, opaqueHit.normal, opaqueHit.material, camera.getFrame(), visible);
+                    finalColor += glm::clamp(((1 - transHit.alpha) * destination) + (transHit.alpha * source), 0.0, 1.0) / (double)(N * N);
+                    if (opaqueHit.texture != nullptr) {
+                        pixelColor = finalColor * 0.5 + texel * 0.5;
+                    } else {
+                        pixelColor = finalColor;
                     }
                 }
-                frameBuffer.showAxes(x, y, ray, 0.25);			// Displays R/x, G/y, B/z axes
             }
         }
+        if (axes != nullptr && axes[i] != NO_AXIS) {
+            pixelColor = FrameBuffer::axisColor(axes[i]);	// Displays R/x, G/y, B/z axes
+        }
     }
-    frameBuffer.showColorBuffer();
+    return pixelColor;
+}
+
+/**
+ * @fn	void RayTracer::cacheCameraOrigins(const IScene &theScene, const vector<RaytracingCamera*> &cameras) const
+ * @brief	Lets each shape precompute the terms that only depend on the cameras'
+ * 			positions, since every primary ray starts at one of them. Called with the
+ * 			frame's cameras before tracing, and with no cameras afterwards, which
+ * 			discards the caches.
+ * @param	theScene	The scene.
+ * @param	cameras		The cameras whose origins should be cached.
+ */
+
+void RayTracer::cacheCameraOrigins(const IScene& theScene, const vector<RaytracingCamera*>& cameras) const {
+	for (const VisibleIShapePtr& obj : theScene.opaqueObjs) {
+		obj->shape->clearRayOriginCache();
+		for (const RaytracingCamera* camera : cameras) {
+			obj->shape->cacheRayOrigin(camera->getFrame().origin);
+		}
+	}
+	for (const TransparentIShapePtr& obj : theScene.transparentObjs) {
+		obj->shape->clearRayOriginCache();
+		for (const RaytracingCamera* camera : cameras) {
+			obj->shape->cacheRayOrigin(camera->getFrame().origin);
+		}
+	}
 }
 
 /**
@@ -124,3 +385,200 @@ color RayTracer::traceIndividualRay(const Ray& ray, const IScene& theScene, int
 	// This might be a useful helper function.
 	return black;
 }
+
+/**
+ * @fn	void RayTracer::fillGBuffer(const FrameBuffer &frameBuffer, const IScene &theScene, int N) const
+ * @brief	First stage of deferred shading. Finds the closest opaque and transparent
+ * 			hit for each of the N*N subpixel samples of every pixel, without shading.
+ * @param	frameBuffer	Framebuffer (only its size is used).
+ * @param	theScene   	The scene.
+ * @param	N		   	The square root of the number of samples per pixel.
+ */
+
+void RayTracer::fillGBuffer(const FrameBuffer& frameBuffer, const IScene& theScene, int N) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
+	const vector<TransparentIShapePtr>& objs2 = theScene.transparentObjs;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+
+	gBuffer.resize(W * H * N * N);
+	int s = 0;
+	for (int y = 0; y < H; ++y) {
+		for (int x = 0; x < W; ++x) {
+			DEBUG_PIXEL = (x == xDebug && y == yDebug);
+			RayDifferential sampleDiff = filtersTextures ? camera.getRayDifferential(x, y).scaled(1.0 / N) : RayDifferential();
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < N; j++) {
+					Ray ray = camera.getSubpixelRay(x, y, i, j, N);
+					GBufferSample& sample = gBuffer[s++];
+					sample.t = FLT_MAX;
+					sample.materialID = -1;
+					for (int k = 0; k < (int)objs.size(); k++) {
+						OpaqueHitRecord hit;
+						objs[k]->findClosestIntersection(ray, hit);
+						if (hit.t < sample.t) {
+							sample.t = hit.t;
+							sample.interceptPt = hit.interceptPt;
+							sample.normal = hit.normal;
+							sample.u = hit.u;
+							sample.v = hit.v;
+							sample.materialID = k;
+						}
+					}
+					if (glm::dot(ray.dir, sample.normal) > 0.0) {
+						sample.normal = -sample.normal;
+					}
+					sample.lod = 0.0;
+					if (filtersTextures && sample.materialID >= 0 && objs[sample.materialID]->texture != nullptr) {
+						const VisibleIShape& obj = *objs[sample.materialID];
+						sample.lod = textureLOD(*obj.texture, *obj.shape, ray, sampleDiff,
+												sample.t, sample.interceptPt, sample.normal);
+					}
+					sample.transT = FLT_MAX;
+					sample.transID = -1;
+					for (int k = 0; k < (int)objs2.size(); k++) {
+						TransparentHitRecord hit;
+						objs2[k]->findClosestIntersection(ray, hit);
+						if (hit.t < sample.transT) {
+							sample.transT = hit.t;
+							sample.transID = k;
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	void RayTracer::shadeGBuffer(const IScene &theScene, int N) const
+ * @brief	Second stage of deferred shading. The samples are sorted by material, and
+ * 			then shaded one light and one material at a time, so that each batch runs
+ * 			the same shadow and lighting code over the same material.
+ * @param	theScene	The scene.
+ * @param	N			The square root of the number of samples per pixel.
+ */
+
+void RayTracer::shadeGBuffer(const IScene& theScene, int N) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
+	const vector<TransparentIShapePtr>& objs2 = theScene.transparentObjs;
+	const vector<LightSourcePtr>& lights = theScene.lights;
+	const int NUM_SAMPLES = (int)gBuffer.size();
+	const int NUM_LIGHTS = (int)lights.size();
+	const int NUM_MATERIALS = (int)objs.size();
+	const int TRANSPARENT_ONLY = NUM_MATERIALS;		// bucket for samples that only hit glass
+	const double NN = (double)(N * N);
+
+	// Counting sort of the samples by material. Samples that miss everything
+	// are left out, since they are never shaded.
+	vector<int> bucketStart(NUM_MATERIALS + 2, 0);
+	for (const GBufferSample& sample : gBuffer) {
+		if (sample.materialID >= 0) {
+			bucketStart[sample.materialID + 1]++;
+		} else if (sample.transID >= 0) {
+			bucketStart[TRANSPARENT_ONLY + 1]++;
+		}
+	}
+	for (int b = 0; b <= NUM_MATERIALS; b++) {
+		bucketStart[b + 1] += bucketStart[b];
+	}
+	shadingOrder.resize(bucketStart[NUM_MATERIALS + 1]);
+	vector<int> next(bucketStart.begin(), bucketStart.end() - 1);
+	for (int s = 0; s < NUM_SAMPLES; s++) {
+		const GBufferSample& sample = gBuffer[s];
+		if (sample.materialID >= 0) {
+			shadingOrder[next[sample.materialID]++] = s;
+		} else if (sample.transID >= 0) {
+			shadingOrder[next[TRANSPARENT_ONLY]++] = s;
+		}
+	}
+
+	// One color per sample and light, so the resolve can sum them in the same
+	// order as the forward path.
+	sampleColors.assign(NUM_SAMPLES * NUM_LIGHTS, black);
+	for (int l = 0; l < NUM_LIGHTS; l++) {
+		const LightSourcePtr L = lights[l];
+		for (int m = 0; m < NUM_MATERIALS; m++) {
+			const Material& material = objs[m]->material;
+			for (int k = bucketStart[m]; k < bucketStart[m + 1]; k++) {
+				const int s = shadingOrder[k];
+				const GBufferSample& sample = gBuffer[s];
+				dvec3 pt = IShape::movePointOffSurface(sample.interceptPt, sample.normal);
+				double visible = L->visibility(pt, sample.normal, objs, camera.getFrame());
+				color lit = L->illuminateWithVisibility(sample.interceptPt, sample.normal, material, camera.getFrame(), visible);
+				if (sample.transID < 0 || sample.t < sample.transT) {
+					sampleColors[s * NUM_LIGHTS + l] = glm::clamp(lit, 0.0, 1.0) / NN;
+				} else {
+					const TransparentIShape& glass = *objs2[sample.transID];
+					color source = glass.c / (double)NUM_LIGHTS;
+					sampleColors[s * NUM_LIGHTS + l] = glm::clamp(((1 - glass.alpha) * lit) + (glass.alpha * source), 0.0, 1.0) / NN;
+				}
+			}
+		}
+		for (int k = bucketStart[TRANSPARENT_ONLY]; k < bucketStart[TRANSPARENT_ONLY + 1]; k++) {
+			const int s = shadingOrder[k];
+			const TransparentIShape& glass = *objs2[gBuffer[s].transID];
+			sampleColors[s * NUM_LIGHTS + l] = glm::clamp(((1 - glass.alpha) * defaultColor) + (glass.alpha * glass.c), 0.0, 1.0) / ((double)NUM_LIGHTS * NN);
+		}
+	}
+}
+
+/**
+ * @fn	void RayTracer::resolveGBuffer(FrameBuffer &frameBuffer, const IScene &theScene, int N) const
+ * @brief	Combines the shaded samples of each pixel, applies textures and writes the
+ * 			result (and the axes) into the framebuffer.
+ * @param [in,out]	frameBuffer	Framebuffer.
+ * @param 		  	theScene   	The scene.
+ * @param 		  	N		   	The square root of the number of samples per pixel.
+ */
+
+void RayTracer::resolveGBuffer(FrameBuffer& frameBuffer, const IScene& theScene, int N) const {
+	const RaytracingCamera& camera = *theScene.camera;
+	const vector<VisibleIShapePtr>& objs = theScene.opaqueObjs;
+	const int NUM_LIGHTS = (int)theScene.lights.size();
+	const bool hasLights = NUM_LIGHTS > 0;
+	const int W = frameBuffer.getWindowWidth();
+	const int H = frameBuffer.getWindowHeight();
+	const unsigned char* axisMask = getAxisMask(camera, N);
+
+	// Written a band of rows one tile high at a time (see raytraceScene).
+	for (int y0 = 0; y0 < H; y0 += FRAMEBUFFER_TILE_SIZE) {
+		frameBuffer.expectTileWrites(BoundingBoxi(0, W, y0, glm::min(FRAMEBUFFER_TILE_SIZE, H - y0)));
+	}
+	int s = 0;
+	vector<color> band(W * FRAMEBUFFER_TILE_SIZE);
+	for (int y = 0; y < H; ++y) {
+		const int y0 = y - y % FRAMEBUFFER_TILE_SIZE;
+		for (int x = 0; x < W; ++x) {
+			const unsigned char* axes = pixelAxes(axisMask, camera, x, y, N);
+			color finalColor = black;
+			color& pixelColor = band[(y - y0) * W + x];
+			pixelColor = defaultColor;
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < N; j++) {
+					const GBufferSample& sample = gBuffer[s];
+					for (int l = 0; l < NUM_LIGHTS; l++) {
+						finalColor += sampleColors[s * NUM_LIGHTS + l];
+					}
+					s++;
+					if (hasLights && sample.materialID >= 0 && objs[sample.materialID]->texture != nullptr) {
+						const Image& texture = *objs[sample.materialID]->texture;
+						color texel = filtersTextures ? texture.sampleUV(sample.u, sample.v, sample.lod)
+														: texture.getPixelUV(sample.u, sample.v);
+						pixelColor = finalColor * 0.5 + texel * 0.5;
+					} else if (hasLights && (sample.materialID >= 0 || sample.transID >= 0)) {
+						pixelColor = finalColor;
+					}
+					if (axes != nullptr && axes[i * N + j] != NO_AXIS) {
+						pixelColor = FrameBuffer::axisColor(axes[i * N + j]);	// Displays R/x, G/y, B/z axes
+					}
+				}
+			}
+		}
+		if (y % FRAMEBUFFER_TILE_SIZE == FRAMEBUFFER_TILE_SIZE - 1 || y == H - 1) {
+			frameBuffer.setColors(BoundingBoxi(0, W, y0, y - y0 + 1), band.data());
+		}
+	}
+}
@@ -14,6 +14,38 @@
 #include "camera.h"
 #include "iscene.h"
 
+ /**
+  * @struct	GBufferSample
+  * @brief	The primary visibility of one subpixel sample. Written by the first stage
+  *			of deferred shading and consumed by the second.
+  */
+
+struct GBufferSample {
+	double t;				//!< t value of the closest opaque hit (FLT_MAX if none).
+	dvec3 interceptPt;		//!< where the opaque hit took place.
+	dvec3 normal;			//!< normal at the opaque hit, facing the viewer.
+	int materialID;			//!< index of the opaque object that was hit, or -1.
+	double u, v;			//!< texture coordinates of the opaque hit.
+	double lod;				//!< texture level of detail at the opaque hit (if filtered).
+	double transT;			//!< t value of the closest transparent hit (FLT_MAX if none).
+	int transID;			//!< index of the transparent object that was hit, or -1.
+};
+
+ /**
+  * @struct	AxisMask
+  * @brief	Which axis, if any, the overlay draws for each subpixel sample of one
+  *			camera's image. Depends only on the primary rays, so it is kept until the
+  *			camera changes.
+  */
+
+struct AxisMask {
+	const RaytracingCamera* camera;	//!< the camera the mask was built for.
+	unsigned int revision;			//!< camera revision used to build the mask.
+	dvec3 origin;					//!< camera position used to build the mask.
+	int nx, ny, N;					//!< image size and samples per pixel (square root).
+	vector<unsigned char> axes;		//!< NO_AXIS, X_AXIS_HIT, ..., N*N per pixel.
+};
+
  /**
   * @struct	RayTracer
   * @brief	Encapsulates the functionality of a ray tracer.
@@ -21,9 +53,26 @@
 
 struct RayTracer {
 	color defaultColor;			//!< the color to use if no intersection is present.
+	bool deferredShading;		//!< true to shade the primary hits in a separate, batched pass.
+	bool showsFrames;			//!< false if the caller presents finished frames itself (see SwapChain).
+	bool showsAxes;				//!< false to leave out the R/G/B axis overlay.
+	bool filtersTextures;		//!< true for mipmapped, trilinear texturing; false for the nearest texel.
 	RayTracer(const color& defaultColor);
 	void raytraceScene(FrameBuffer& frameBuffer, int depth,
 		const IScene& theScene, int N) const;
+	void raytraceViews(FrameBuffer& frameBuffer, const IScene& theScene,
+		const vector<RaytracingCamera*>& cameras, const vector<BoundingBoxi>& viewports, int N) const;
 protected:
+	mutable vector<GBufferSample> gBuffer;	//!< primary hits, N*N per pixel. Reused between frames.
+	mutable vector<color> sampleColors;		//!< shaded color of each G-buffer sample, per light.
+	mutable vector<int> shadingOrder;		//!< G-buffer indices, sorted by material.
+	mutable vector<AxisMask> axisMasks;		//!< one cached axis overlay per camera.
+	const unsigned char* getAxisMask(const RaytracingCamera& camera, int N) const;
 	color traceIndividualRay(const Ray& ray, const IScene& theScene, int recursionLevel) const;
+	void fillGBuffer(const FrameBuffer& frameBuffer, const IScene& theScene, int N) const;
+	void shadeGBuffer(const IScene& theScene, int N) const;
+	void resolveGBuffer(FrameBuffer& frameBuffer, const IScene& theScene, int N) const;
+	color tracePixel(const IScene& theScene, const RaytracingCamera& camera,
+		int x, int y, int N, const unsigned char* axes) const;
+	void cacheCameraOrigins(const IScene& theScene, const vector<RaytracingCamera*>& cameras) const;
 };
@@ -0,0 +1,198 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "shadowmap.h"
+#include "utilities.h"
+
+/**
+ * @fn	ShadowMap::ShadowMap(int res, double constantBias, double texelBias)
+ * @brief	Constructs a shadow map. The map is off until isOn is set, and is
+ * 			not built until the first call to build().
+ * @param	res				Width and height of each cube face, in texels.
+ * @param	constantBias	Constant depth tolerance, in world units.
+ * @param	texelBias		Additional depth tolerance, measured in texels.
+ */
+
+ShadowMap::ShadowMap(int res, double constantBias, double texelBias)
+	: isOn(false), resolution(res), bias(constantBias), slopeBias(texelBias),
+	center(ORIGIN3D), builtConeDir(ZEROVEC), builtConeFOV(TWO_PI),
+	builtObjects(nullptr), builtNumObjects(0), builtResolution(0) {
+}
+
+/**
+ * @fn	void ShadowMap::directionToFace(const dvec3 &dir, int &face, double &s, double &t)
+ * @brief	Determines which cube face a direction passes through, and where.
+ * 			The face is chosen by the major axis of dir. The other two axes,
+ * 			taken in cyclic order, give (s, t), each in [-1, 1].
+ * @param 		  	dir 	Direction from the center of the cube (need not be unit length).
+ * @param [in,out]	face	Face index: 2 * axis, plus 1 for the negative face.
+ * @param [in,out]	s   	First face coordinate.
+ * @param [in,out]	t   	Second face coordinate.
+ */
+
+void ShadowMap::directionToFace(const dvec3& dir, int& face, double& s, double& t) {
+	dvec3 a = glm::abs(dir);
+	int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+	double major = a[axis];
+	face = 2 * axis + (dir[axis] < 0.0 ? 1 : 0);
+	s = dir[(axis + 1) % 3] / major;
+	t = dir[(axis + 2) % 3] / major;
+}
+
+/**
+ * @fn	dvec3 ShadowMap::faceToDirection(int face, double s, double t)
+ * @brief	Inverse of directionToFace.
+ * @param	face	Face index.
+ * @param	s   	First face coordinate, in [-1, 1].
+ * @param	t   	Second face coordinate, in [-1, 1].
+ * @return	Unit length direction through (s, t) on the given face.
+ */
+
+dvec3 ShadowMap::faceToDirection(int face, double s, double t) {
+	int axis = face / 2;
+	dvec3 dir;
+	dir[axis] = (face % 2 == 0) ? 1.0 : -1.0;
+	dir[(axis + 1) % 3] = s;
+	dir[(axis + 2) % 3] = t;
+	return glm::normalize(dir);
+}
+
+/**
+ * @fn	void ShadowMap::build(const dvec3 &lightPos, const vector<VisibleIShapePtr> &objects,
+ *								const dvec3 &coneDir, double coneFOV)
+ * @brief	Renders the distance to the closest opaque surface into all six faces.
+ * 			Should be called once per frame, before any lookups, but the faces are
+ * 			only rendered again when the light, its cone, the resolution or the list
+ * 			of objects differs from the last build. Whoever moves or reshapes an
+ * 			object in the list must call invalidate. When a cone is given
+ * 			(spotlights), texels well outside of the cone are skipped since they can
+ * 			never be lit.
+ * @param	lightPos	Position of the light.
+ * @param	objects 	The opaque objects that cast shadows.
+ * @param	coneDir 	Direction of the light's cone, or ZEROVEC for a point light.
+ * @param	coneFOV 	Field of view of the light's cone.
+ */
+
+void ShadowMap::build(const dvec3& lightPos, const vector<VisibleIShapePtr>& objects,
+	const dvec3& coneDir, double coneFOV) {
+	const int N = glm::max(resolution, 1);
+	const bool hasCone = coneDir != ZEROVEC && coneFOV < TWO_PI;
+	const dvec3 axis = hasCone ? glm::normalize(coneDir) : ZEROVEC;
+	// Pad the cone by a few texels so filtered lookups near the edge stay valid.
+	const double coneCos = std::cos(glm::min(PI, coneFOV / 2.0 + 4.0 / N));
+
+	if (builtResolution == N && center == lightPos && builtConeDir == coneDir &&
+		builtConeFOV == coneFOV && builtObjects == objects.data() &&
+		builtNumObjects == objects.size()) {
+		return;
+	}
+	center = lightPos;
+	builtConeDir = coneDir;
+	builtConeFOV = coneFOV;
+	builtObjects = objects.data();
+	builtNumObjects = objects.size();
+	builtResolution = N;
+	for (int face = 0; face < NUM_CUBE_FACES; face++) {
+		vector<float>& depths = faces[face];
+		depths.assign(N * N, FLT_MAX);
+		for (int row = 0; row < N; row++) {
+			double t = map(row + 0.5, 0.0, N, -1.0, 1.0);
+			for (int col = 0; col < N; col++) {
+				double s = map(col + 0.5, 0.0, N, -1.0, 1.0);
+				dvec3 dir = faceToDirection(face, s, t);
+				if (hasCone && glm::dot(dir, axis) < coneCos) {
+					continue;
+				}
+				OpaqueHitRecord hit;
+				VisibleIShape::findIntersection(Ray(lightPos, dir), objects, hit);
+				if (hit.t != FLT_MAX) {
+					depths[row * N + col] = (float)hit.t;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @fn	double ShadowMap::depthAt(int face, int col, int row) const
+ * @brief	Returns the stored depth, clamping (col, row) to the face.
+ * @param	face	Face index.
+ * @param	col 	Texel column.
+ * @param	row 	Texel row.
+ * @return	Distance from the light to the closest surface through this texel.
+ */
+
+double ShadowMap::depthAt(int face, int col, int row) const {
+	const int N = builtResolution;
+	col = glm::clamp(col, 0, N - 1);
+	row = glm::clamp(row, 0, N - 1);
+	return faces[face][row * N + col];
+}
+
+/**
+ * @fn	double ShadowMap::visibility(const dvec3 &pt, const dvec3 &normal) const
+ * @brief	Percentage-closer filtered visibility of a point. The four texels
+ * 			surrounding the lookup are each depth tested, and the results are
+ * 			blended bilinearly. The depth tolerance grows with the texel size and
+ * 			with the slope of the surface, as seen from the light, which avoids
+ * 			"shadow acne" on surfaces lit at grazing angles.
+ * @param	pt	  	The point, in world coordinates.
+ * @param	normal	The normal vector at pt.
+ * @return	1.0 if fully lit, 0.0 if fully shadowed.
+ */
+
+double ShadowMap::visibility(const dvec3& pt, const dvec3& normal) const {
+	if (!isBuilt()) {
+		return 1.0;
+	}
+	const int N = builtResolution;
+	dvec3 toPt = pt - center;
+	double dist = glm::length(toPt);
+	if (dist == 0.0) {
+		return 1.0;
+	}
+
+	int face;
+	double s, t;
+	directionToFace(toPt, face, s, t);
+
+	// A texel spans roughly 2 * dist / N world units at this distance.
+	const double MAX_SLOPE = 20.0;
+	double cosTheta = glm::abs(glm::dot(normal, toPt)) / dist;
+	double sinTheta = std::sqrt(glm::max(0.0, 1.0 - cosTheta * cosTheta));
+	double slope = glm::min(sinTheta / glm::max(cosTheta, EPSILON), MAX_SLOPE);
+	double tolerance = bias + slopeBias * (1.0 + slope) * 2.0 * dist / N;
+	double x = map(s, -1.0, 1.0, 0.0, N) - 0.5;
+	double y = map(t, -1.0, 1.0, 0.0, N) - 0.5;
+	int col = (int)std::floor(x);
+	int row = (int)std::floor(y);
+	double fx = x - col;
+	double fy = y - row;
+
+	double lit00 = dist - tolerance <= depthAt(face, col, row) ? 1.0 : 0.0;
+	double lit10 = dist - tolerance <= depthAt(face, col + 1, row) ? 1.0 : 0.0;
+	double lit01 = dist - tolerance <= depthAt(face, col, row + 1) ? 1.0 : 0.0;
+	double lit11 = dist - tolerance <= depthAt(face, col + 1, row + 1) ? 1.0 : 0.0;
+
+	return (1 - fy) * ((1 - fx) * lit00 + fx * lit10) +
+		fy * ((1 - fx) * lit01 + fx * lit11);
+}
+
+/**
+ * @fn	bool ShadowMap::pointIsInAShadow(const dvec3 &pt, const dvec3 &normal) const
+ * @brief	Determines if a point is in a shadow, according to the depth maps. This
+ * 			rounds the filtered visibility; shading should use visibility itself.
+ * @param	pt	  	The point, in world coordinates.
+ * @param	normal	The normal vector at pt.
+ * @return	true iff the point is more shadowed than lit.
+ */
+
+bool ShadowMap::pointIsInAShadow(const dvec3& pt, const dvec3& normal) const {
+	return visibility(pt, normal) < 0.5;
+}
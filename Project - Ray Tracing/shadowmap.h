@@ -0,0 +1,51 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <vector>
+#include "defs.h"
+#include "ishape.h"
+
+const int NUM_CUBE_FACES = 6;		//!< +x, -x, +y, -y, +z, -z
+
+/**
+ * @struct	ShadowMap
+ * @brief	A cube of depth maps centered on a positional light. Each texel holds the
+ * 			distance from the light to the closest opaque surface in that direction, so
+ * 			a shadow query becomes a filtered depth lookup instead of a shadow feeler
+ * 			tested against every object in the scene. The faces are kept until the
+ * 			light or the list of objects changes, or until invalidate is called.
+ */
+
+struct ShadowMap {
+	bool isOn;			//!< True if lookups should replace shadow feelers.
+	int resolution;		//!< Width (and height) of each cube face, in texels.
+	double bias;		//!< Constant depth tolerance, in world units.
+	double slopeBias;	//!< Additional tolerance, in texels, scaled by the surface's slope.
+
+	ShadowMap(int res = 256, double constantBias = 0.05, double texelBias = 1.5);
+	void build(const dvec3& lightPos, const vector<VisibleIShapePtr>& objects,
+		const dvec3& coneDir = ZEROVEC, double coneFOV = TWO_PI);
+	double visibility(const dvec3& pt, const dvec3& normal) const;
+	bool pointIsInAShadow(const dvec3& pt, const dvec3& normal) const;
+	bool isBuilt() const { return builtResolution > 0; }
+	void invalidate() { builtResolution = 0; }
+protected:
+	dvec3 center;							//!< Light position used for the last build.
+	dvec3 builtConeDir;						//!< Cone direction used for the last build.
+	double builtConeFOV;					//!< Cone field of view used for the last build.
+	const VisibleIShapePtr* builtObjects;	//!< Objects used for the last build.
+	size_t builtNumObjects;					//!< Number of objects used for the last build.
+	int builtResolution;					//!< Resolution of the faces currently held.
+	vector<float> faces[NUM_CUBE_FACES];	//!< Distance to closest surface, per texel.
+
+	static void directionToFace(const dvec3& dir, int& face, double& s, double& t);
+	static dvec3 faceToDirection(int face, double s, double t);
+	double depthAt(int face, int col, int row) const;
+};
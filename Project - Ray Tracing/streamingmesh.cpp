@@ -0,0 +1,486 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <filesystem>
+#include "streamingmesh.h"
+#include "eshape.h"
+#include "mappedfile.h"
+#include "utilities.h"
+
+const size_t TRIANGLES_PER_BLOCK = 1 << 16;	//!< Triangles read from a temporary file at a time.
+
+/**
+ * @struct	Bucket
+ * @brief	A temporary file of triangles, each stored as 9 floats (x, y and z of each
+ * 			corner), waiting to be split or clustered by StreamingMesh::convert.
+ */
+
+struct Bucket {
+	string fileName;		//!< Name of the file.
+	uint64_t numTriangles;	//!< Triangles in it.
+	dvec3 lo;				//!< Smallest corner of the box around the triangles' centroids.
+	dvec3 hi;				//!< Largest corner of that box.
+
+	Bucket(const string& fileName) : fileName(fileName), numTriangles(0), lo(DBL_MAX), hi(-DBL_MAX) {}
+};
+
+/**
+ * @struct	BucketWriter
+ * @brief	Appends triangles to a new bucket, keeping its count and bounds.
+ */
+
+struct BucketWriter {
+	Bucket bucket;			//!< What has been written.
+	std::ofstream out;		//!< The bucket's file.
+
+	BucketWriter(const string& fileName) : bucket(fileName), out(fileName, std::ios::binary) {}
+	void add(const float* triangle) {
+		dvec3 centroid(((double)triangle[0] + triangle[3] + triangle[6]) / 3.0,
+			((double)triangle[1] + triangle[4] + triangle[7]) / 3.0,
+			((double)triangle[2] + triangle[5] + triangle[8]) / 3.0);
+		bucket.lo = glm::min(bucket.lo, centroid);
+		bucket.hi = glm::max(bucket.hi, centroid);
+		bucket.numTriangles++;
+		out.write((const char*)triangle, 9 * sizeof(float));
+	}
+};
+
+/**
+ * @fn	static bool splitBucket(const Bucket &parent, bool byOrder, vector<Bucket> &children)
+ * @brief	Copies the triangles of a bucket into smaller ones, reading and writing a
+ * 			block at a time. The parent itself is left in place.
+ * @param 		  	parent  	The bucket to split.
+ * @param 		  	byOrder 	false to split the box around the centroids into octants;
+ * 								true to split the triangles into two halves as they come,
+ * 								for when the octants would not separate them.
+ * @param [in,out]	children	The new buckets that received any triangles.
+ * @return	true iff every file could be read and written. If not, no children are left.
+ */
+
+static bool splitBucket(const Bucket& parent, bool byOrder, vector<Bucket>& children) {
+	const int NUM_PARTS = byOrder ? 2 : 8;
+	vector<std::unique_ptr<BucketWriter>> writers;
+	for (int i = 0; i < NUM_PARTS; i++) {
+		writers.push_back(std::unique_ptr<BucketWriter>(new BucketWriter(parent.fileName + "." + std::to_string(i))));
+	}
+	const dvec3 mid = (parent.lo + parent.hi) / 2.0;
+	std::ifstream in(parent.fileName, std::ios::binary);
+	vector<float> block(9 * TRIANGLES_PER_BLOCK);
+	bool isOK = true;
+	for (uint64_t done = 0; isOK && done < parent.numTriangles; ) {
+		size_t n = (size_t)glm::min((uint64_t)TRIANGLES_PER_BLOCK, parent.numTriangles - done);
+		isOK = (bool)in.read((char*)block.data(), n * 9 * sizeof(float));
+		for (size_t i = 0; isOK && i < n; i++) {
+			const float* triangle = block.data() + 9 * i;
+			int part;
+			if (byOrder) {
+				part = done + i < parent.numTriangles / 2 ? 0 : 1;
+			} else {
+				dvec3 centroid(((double)triangle[0] + triangle[3] + triangle[6]) / 3.0,
+					((double)triangle[1] + triangle[4] + triangle[7]) / 3.0,
+					((double)triangle[2] + triangle[5] + triangle[8]) / 3.0);
+				part = (centroid.x >= mid.x ? 1 : 0) + (centroid.y >= mid.y ? 2 : 0) + (centroid.z >= mid.z ? 4 : 0);
+			}
+			writers[part]->add(triangle);
+		}
+		done += n;
+	}
+	for (std::unique_ptr<BucketWriter>& writer : writers) {
+		writer->out.close();
+		isOK = isOK && writer->out;
+	}
+	for (std::unique_ptr<BucketWriter>& writer : writers) {
+		if (isOK && writer->bucket.numTriangles > 0) {
+			children.push_back(writer->bucket);
+		} else {
+			std::remove(writer->bucket.fileName.c_str());
+		}
+	}
+	return isOK;
+}
+
+/**
+ * @fn	static bool writeGroup(const Bucket &bucket, std::ofstream &out,
+ *								vector<StreamingGroup> &groups, vector<StreamingCluster> &clusters)
+ * @brief	Loads a bucket small enough to hold in memory, welds its corners into vertices,
+ * 			splits it into clusters as MeshLOD::buildClusters does, and appends the
+ * 			clusters' blocks to the streaming mesh file.
+ * @param 		  	bucket  	The bucket.
+ * @param [in,out]	out			The streaming mesh file.
+ * @param [in,out]	groups  	Gets the bucket's group.
+ * @param [in,out]	clusters	Gets the group's clusters.
+ * @return	true iff the bucket could be read and the blocks written.
+ */
+
+static bool writeGroup(const Bucket& bucket, std::ofstream& out,
+	vector<StreamingGroup>& groups, vector<StreamingCluster>& clusters) {
+	const size_t NUM_CORNERS = 3 * (size_t)bucket.numTriangles;
+	vector<float> corners(3 * NUM_CORNERS);
+	std::ifstream in(bucket.fileName, std::ios::binary);
+	if (NUM_CORNERS == 0 || !in.read((char*)corners.data(), corners.size() * sizeof(float))) {
+		return NUM_CORNERS == 0;
+	}
+
+	// Corners at the same place become one vertex.
+	vector<uint32_t> order(NUM_CORNERS);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return std::lexicographical_compare(&corners[3 * a], &corners[3 * a + 3], &corners[3 * b], &corners[3 * b + 3]);
+	});
+	vector<dvec3> positions;
+	MeshLOD level;
+	level.indices.resize(NUM_CORNERS);
+	for (size_t i = 0; i < NUM_CORNERS; i++) {
+		const float* p = &corners[3 * (size_t)order[i]];
+		if (i == 0 || !std::equal(p, p + 3, &corners[3 * (size_t)order[i - 1]])) {
+			positions.push_back(dvec3(p[0], p[1], p[2]));
+		}
+		level.indices[order[i]] = (uint32_t)positions.size() - 1;
+	}
+	level.submeshes.push_back(Submesh{ 0, (uint32_t)NUM_CORNERS, 0 });
+	level.buildClusters(positions);
+
+	StreamingGroup group;
+	dvec3 lo(DBL_MAX), hi(-DBL_MAX);
+	for (const dvec3& p : positions) {
+		lo = glm::min(lo, p);
+		hi = glm::max(hi, p);
+	}
+	group.bounds.firstIndex = 0;
+	group.bounds.numIndices = (uint32_t)NUM_CORNERS;
+	group.bounds.center = (lo + hi) / 2.0;
+	group.bounds.radius = 0.0;
+	for (const dvec3& p : positions) {
+		group.bounds.radius = glm::max(group.bounds.radius, glm::distance(p, group.bounds.center));
+	}
+	group.bounds.coneAxis = Z_AXIS;
+	group.bounds.coneCutoff = -1.0;
+	group.firstCluster = (uint32_t)clusters.size();
+	group.numClusters = (uint32_t)level.clusters.size();
+	groups.push_back(group);
+
+	// Each block numbers its own vertices, so a cluster's indices fit in 16 bits.
+	const uint32_t UNUSED = UINT32_MAX;
+	vector<uint32_t> local(positions.size(), UNUSED);
+	for (const MeshCluster& cluster : level.clusters) {
+		StreamingCluster entry;
+		entry.bounds = cluster;
+		entry.bounds.firstIndex = 0;
+		entry.offset = (uint64_t)out.tellp();
+		entry.reserved = 0;
+		vector<float> points;
+		vector<uint16_t> blockIndices;
+		const uint32_t LAST = cluster.firstIndex + cluster.numIndices;
+		for (uint32_t i = cluster.firstIndex; i < LAST; i++) {
+			uint32_t v = level.indices[i];
+			if (local[v] == UNUSED) {
+				local[v] = (uint32_t)points.size() / 3;
+				points.push_back((float)positions[v].x);
+				points.push_back((float)positions[v].y);
+				points.push_back((float)positions[v].z);
+			}
+			blockIndices.push_back((uint16_t)local[v]);
+		}
+		for (uint32_t i = cluster.firstIndex; i < LAST; i++) {
+			local[level.indices[i]] = UNUSED;
+		}
+		entry.numVertices = (uint32_t)points.size() / 3;
+		out.write((const char*)points.data(), points.size() * sizeof(float));
+		out.write((const char*)blockIndices.data(), blockIndices.size() * sizeof(uint16_t));
+		clusters.push_back(entry);
+	}
+	return (bool)out;
+}
+
+/**
+ * @fn	bool StreamingMesh::convert(const string &objFileName, const string &fileName)
+ * @brief	Converts a Wavefront OBJ file, of any size, into a streaming mesh file. The
+ * 			OBJ is read with EShape::scanObj, and its positions and faces are copied to
+ * 			temporary files. The faces are then expanded into triangles in one bucket,
+ * 			which is split into octants, again and again, until each bucket holds at most
+ * 			MAX_BUCKET_TRIANGLES. Each of those is loaded in turn and written as one group
+ * 			of clusters. Only a window of the OBJ and one bucket are ever held in memory
+ * 			(the positions are memory-mapped). Like readObj, only the first three
+ * 			vertices of each face are used. Positions are stored as floats.
+ * 			The file is written under a temporary name and then renamed.
+ * @param	objFileName	Name of the OBJ file.
+ * @param	fileName   	Name of the streaming mesh file to write.
+ * @return	true iff the file was written.
+ */
+
+bool StreamingMesh::convert(const string& objFileName, const string& fileName) {
+	const string vertexFileName = fileName + ".vertices";
+	const string faceFileName = fileName + ".faces";
+	const string tempName = fileName + ".tmp";
+
+	// Copy the positions and faces out of the text.
+	uint64_t numVertices = 0, numFaces = 0;
+	{
+		std::ofstream vertexOut(vertexFileName, std::ios::binary);
+		std::ofstream faceOut(faceFileName, std::ios::binary);
+		bool isRead = vertexOut && faceOut &&
+			EShape::scanObj(objFileName, [&](const vector<dvec4>& vertices, const vector<glm::ivec3>& faces) {
+				for (const dvec4& v : vertices) {
+					float p[3] = { (float)v.x, (float)v.y, (float)v.z };
+					vertexOut.write((const char*)p, sizeof(p));
+				}
+				faceOut.write((const char*)faces.data(), faces.size() * sizeof(glm::ivec3));
+				numVertices += vertices.size();
+				numFaces += faces.size();
+			});
+		vertexOut.close();
+		faceOut.close();
+		if (!isRead || !vertexOut || !faceOut) {
+			std::remove(vertexFileName.c_str());
+			std::remove(faceFileName.c_str());
+			if (isRead) {
+				cout << "Error: Cannot write file " << fileName << endl;
+			}
+			return false;
+		}
+	}
+
+	// Expand the faces into triangles. Indices are 1-based.
+	Bucket root(fileName + ".bucket");
+	bool isValid = true, isCopied = true;
+	{
+		MappedFile vertexFile(vertexFileName);
+		const float* points = (const float*)vertexFile.getData();
+		BucketWriter writer(root.fileName);
+		std::ifstream faceIn(faceFileName, std::ios::binary);
+		vector<glm::ivec3> block(TRIANGLES_PER_BLOCK);
+		isCopied = vertexFile.isOpen() && faceIn && writer.out;
+		for (uint64_t done = 0; isCopied && isValid && done < numFaces; ) {
+			size_t n = (size_t)glm::min((uint64_t)TRIANGLES_PER_BLOCK, numFaces - done);
+			isCopied = (bool)faceIn.read((char*)block.data(), n * sizeof(glm::ivec3));
+			for (size_t i = 0; isCopied && isValid && i < n; i++) {
+				float triangle[9];
+				for (int j = 0; j < 3; j++) {
+					if (block[i][j] < 1 || (uint64_t)block[i][j] > numVertices) {
+						isValid = false;
+						break;
+					}
+					std::memcpy(triangle + 3 * j, points + 3 * (size_t)(block[i][j] - 1), 3 * sizeof(float));
+				}
+				if (isValid) {
+					writer.add(triangle);
+				}
+			}
+			done += n;
+		}
+		writer.out.close();
+		isCopied = isCopied && writer.out;
+		root = writer.bucket;
+	}
+	std::remove(vertexFileName.c_str());
+	std::remove(faceFileName.c_str());
+	if (!isValid) {
+		std::remove(root.fileName.c_str());
+		throw std::out_of_range("StreamingMesh::convert: face refers to a missing vertex in " + objFileName);
+	}
+
+	// Split the buckets, depth first, and write each small one as a group.
+	StreamingMeshHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, STREAMING_MESH_MAGIC, sizeof(header.magic));
+	header.version = STREAMING_MESH_VERSION;
+	header.numTriangles = root.numTriangles;
+	vector<StreamingGroup> groups;
+	vector<StreamingCluster> clusters;
+	vector<Bucket> pending = { root };
+	std::ofstream out(tempName, std::ios::binary);
+	out.write((const char*)&header, sizeof(header));
+	isCopied = isCopied && out;
+	while (!pending.empty()) {
+		Bucket bucket = pending.back();
+		pending.pop_back();
+		if (isCopied && bucket.numTriangles > MAX_BUCKET_TRIANGLES) {
+			vector<Bucket> children;
+			isCopied = splitBucket(bucket, false, children);
+			if (isCopied && children.size() == 1) {
+				std::remove(children[0].fileName.c_str());
+				children.clear();
+				isCopied = splitBucket(bucket, true, children);
+			}
+			pending.insert(pending.end(), children.rbegin(), children.rend());
+		} else if (isCopied) {
+			isCopied = writeGroup(bucket, out, groups, clusters);
+		}
+		std::remove(bucket.fileName.c_str());
+	}
+
+	header.numGroups = (uint32_t)groups.size();
+	header.numClusters = (uint32_t)clusters.size();
+	header.directoryOffset = (uint64_t)out.tellp();
+	out.write((const char*)groups.data(), groups.size() * sizeof(StreamingGroup));
+	out.write((const char*)clusters.data(), clusters.size() * sizeof(StreamingCluster));
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.close();
+	std::error_code error;
+	if (isCopied && out) {
+		std::filesystem::rename(tempName, fileName, error);
+	}
+	if (!isCopied || !out || error) {
+		std::remove(tempName.c_str());
+		cout << "Error: Cannot write file " << fileName << endl;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @fn	StreamingMesh::StreamingMesh(const string &fileName, const Material &mat, size_t budgetBytes)
+ * @brief	Opens a streaming mesh file and reads its list of groups and clusters. Check
+ * 			isOpen before using it.
+ * @param	fileName   	Name of the file written by convert.
+ * @param	mat		   	Material of every triangle.
+ * @param	budgetBytes	Bytes of clusters to keep loaded.
+ */
+
+StreamingMesh::StreamingMesh(const string& fileName, const Material& mat, size_t budgetBytes)
+	: isOpened(false), file(fileName, std::ios::binary), material(mat), numTriangles(0),
+	budget(budgetBytes), residentBytes(0) {
+	StreamingMeshHeader header;
+	if (!file.read((char*)&header, sizeof(header)) ||
+		std::memcmp(header.magic, STREAMING_MESH_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != STREAMING_MESH_VERSION) {
+		return;
+	}
+	groups.resize(header.numGroups);
+	clusters.resize(header.numClusters);
+	file.seekg(header.directoryOffset);
+	file.read((char*)groups.data(), groups.size() * sizeof(StreamingGroup));
+	file.read((char*)clusters.data(), clusters.size() * sizeof(StreamingCluster));
+	bool isValid = (bool)file;
+	for (const StreamingGroup& group : groups) {
+		isValid = isValid && (uint64_t)group.firstCluster + group.numClusters <= clusters.size();
+	}
+	if (!isValid) {
+		groups.clear();
+		clusters.clear();
+		return;
+	}
+	numTriangles = header.numTriangles;
+	isOpened = true;
+}
+
+/**
+ * @fn	std::shared_ptr<const StreamingBlock> StreamingMesh::fetch(int cluster)
+ * @brief	Gets the triangles of a cluster, reading them from the file, on the calling
+ * 			thread, if they are not loaded. Loading may drop other clusters to stay
+ * 			within the budget.
+ * @param	cluster	Index of the cluster.
+ * @return	The cluster's block, or nullptr if it could not be read.
+ */
+
+std::shared_ptr<const StreamingBlock> StreamingMesh::fetch(int cluster) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::unordered_map<int, Resident>::iterator found = residents.find(cluster);
+	if (found != residents.end()) {
+		uses.splice(uses.begin(), uses, found->second.use);
+		return found->second.block;
+	}
+	std::shared_ptr<const StreamingBlock> block = load(cluster);
+	if (block) {
+		uses.push_front(cluster);
+		Resident resident = { block, uses.begin(), block->getBytes() };
+		residents[cluster] = resident;
+		residentBytes += resident.bytes;
+		evict(cluster);
+	}
+	return block;
+}
+
+/**
+ * @fn	std::shared_ptr<const StreamingBlock> StreamingMesh::load(int cluster)
+ * @brief	Reads a cluster's block, and checks that its indices are in range. The
+ * 			caller must hold lock.
+ * @param	cluster	Index of the cluster.
+ * @return	The block, or nullptr if it could not be read.
+ */
+
+std::shared_ptr<const StreamingBlock> StreamingMesh::load(int cluster) {
+	if (cluster < 0 || cluster >= (int)clusters.size()) {
+		return nullptr;
+	}
+	const StreamingCluster& entry = clusters[cluster];
+	std::shared_ptr<StreamingBlock> block = std::make_shared<StreamingBlock>();
+	block->positions.resize(3 * (size_t)entry.numVertices);
+	block->indices.resize(entry.bounds.numIndices / 3 * 3);
+	file.clear();
+	file.seekg(entry.offset);
+	file.read((char*)block->positions.data(), block->positions.size() * sizeof(float));
+	file.read((char*)block->indices.data(), block->indices.size() * sizeof(uint16_t));
+	if (!file) {
+		return nullptr;
+	}
+	for (uint16_t v : block->indices) {
+		if (v >= entry.numVertices) {
+			return nullptr;
+		}
+	}
+	return block;
+}
+
+/**
+ * @fn	void StreamingMesh::evict(int keep)
+ * @brief	Drops the least recently fetched clusters until the loaded ones fit in the
+ * 			budget, or only keep is left. The caller must hold lock.
+ * @param	keep	A cluster never to drop, or -1.
+ */
+
+void StreamingMesh::evict(int keep) {
+	while (residentBytes > budget && !uses.empty() && uses.back() != keep) {
+		std::unordered_map<int, Resident>::iterator found = residents.find(uses.back());
+		residentBytes -= found->second.bytes;
+		residents.erase(found);
+		uses.pop_back();
+	}
+}
+
+/**
+ * @fn	void StreamingMesh::setBudget(size_t budgetBytes)
+ * @brief	Sets the bytes of clusters to keep loaded, dropping clusters at once if they
+ * 			no longer fit.
+ * @param	budgetBytes	The budget.
+ */
+
+void StreamingMesh::setBudget(size_t budgetBytes) {
+	std::lock_guard<std::mutex> guard(lock);
+	budget = budgetBytes;
+	evict(-1);
+}
+
+/**
+ * @fn	size_t StreamingMesh::getBudget() const
+ * @brief	The bytes of clusters to keep loaded.
+ * @return	The budget.
+ */
+
+size_t StreamingMesh::getBudget() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return budget;
+}
+
+/**
+ * @fn	size_t StreamingMesh::getResidentBytes() const
+ * @brief	Memory used by the loaded clusters.
+ * @return	The number of bytes.
+ */
+
+size_t StreamingMesh::getResidentBytes() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return residentBytes;
+}
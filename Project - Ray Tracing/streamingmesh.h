@@ -0,0 +1,138 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+#include <unordered_map>
+#include "defs.h"
+#include "indexedmesh.h"
+
+const char STREAMING_MESH_MAGIC[8] = { 'C', 'S', 'E', '3', '8', '6', 'S', 'M' };	//!< Starts every streaming mesh file.
+const uint32_t STREAMING_MESH_VERSION = 1;			//!< Changes whenever the layout does.
+const size_t DEFAULT_STREAMING_BUDGET = 256 << 20;	//!< Bytes of clusters kept loaded, by default.
+const uint64_t MAX_BUCKET_TRIANGLES = 1 << 16;		//!< Size limit of a group when converting.
+
+/**
+ * @struct	StreamingMeshHeader
+ * @brief	Start of a streaming mesh file. It is followed by the blocks of the clusters,
+ * 			then, at directoryOffset, numGroups StreamingGroups and numClusters
+ * 			StreamingClusters, all in the byte order of the machine that wrote it.
+ */
+
+struct StreamingMeshHeader {
+	char magic[8];				//!< STREAMING_MESH_MAGIC.
+	uint32_t version;			//!< STREAMING_MESH_VERSION.
+	uint32_t numGroups;			//!< Number of groups.
+	uint32_t numClusters;		//!< Number of clusters.
+	uint32_t reserved;			//!< 0; keeps the rest 8-byte aligned.
+	uint64_t numTriangles;		//!< Triangles in all of the clusters.
+	uint64_t directoryOffset;	//!< Where the groups and clusters are listed.
+};
+
+/**
+ * @struct	StreamingCluster
+ * @brief	Where to find one cluster of a streaming mesh, and its bounds. Its block holds
+ * 			numVertices * 3 float positions, then bounds.numIndices uint16 indices into
+ * 			them, three per triangle, counterclockwise.
+ */
+
+struct StreamingCluster {
+	MeshCluster bounds;		//!< Bounding sphere and normal cone. firstIndex is 0.
+	uint64_t offset;		//!< Position of the block in the file.
+	uint32_t numVertices;	//!< Distinct positions in the block.
+	uint32_t reserved;		//!< 0.
+};
+
+/**
+ * @struct	StreamingGroup
+ * @brief	A run of clusters that lie close together, so that the renderer can reject
+ * 			them all with one test.
+ */
+
+struct StreamingGroup {
+	MeshCluster bounds;		//!< Bounding sphere. The cone is not usable.
+	uint32_t firstCluster;	//!< Index of the first cluster of the run.
+	uint32_t numClusters;	//!< Length of the run.
+};
+
+/**
+ * @struct	StreamingBlock
+ * @brief	A loaded cluster, kept just as its block is stored in the file: shared float
+ * 			positions, and three 16-bit indices into them per triangle. There are no
+ * 			normals; the renderer derives a flat one for each triangle as it draws.
+ */
+
+struct StreamingBlock {
+	vector<float> positions;	//!< x, y and z of each vertex.
+	vector<uint16_t> indices;	//!< Three per triangle, counterclockwise.
+
+	int getNumVertices() const { return (int)(positions.size() / 3); }
+	int getNumTriangles() const { return (int)(indices.size() / 3); }
+	size_t getBytes() const {
+		return sizeof(StreamingBlock) + positions.size() * sizeof(float) + indices.size() * sizeof(uint16_t);
+	}
+};
+
+/**
+ * @struct	StreamingMesh
+ * @brief	A triangle mesh too large to load whole. convert turns an OBJ file into a
+ * 			streaming mesh file without ever holding the OBJ's faces in memory: the
+ * 			triangles are sorted on disk into spatially compact groups, and each group
+ * 			is split into the same clusters an IndexedMesh uses. Only the list of groups
+ * 			and clusters is read when the file is opened; VertexOps::render culls
+ * 			against it and fetches just the clusters it draws.
+ *
+ * 			Fetched clusters are kept, as StreamingBlocks, until the loaded bytes exceed
+ * 			the budget, and then the least recently fetched are dropped. A dropped
+ * 			cluster stays valid for as long as someone holds it.
+ */
+
+struct StreamingMesh {
+	StreamingMesh(const string& fileName, const Material& mat = redPlastic,
+		size_t budgetBytes = DEFAULT_STREAMING_BUDGET);
+	bool isOpen() const { return isOpened; }
+	uint64_t getNumTriangles() const { return numTriangles; }
+	const Material& getMaterial() const { return material; }
+	const vector<StreamingGroup>& getGroups() const { return groups; }
+	const vector<StreamingCluster>& getClusters() const { return clusters; }
+	std::shared_ptr<const StreamingBlock> fetch(int cluster);
+	void setBudget(size_t budgetBytes);
+	size_t getBudget() const;
+	size_t getResidentBytes() const;
+	static bool convert(const string& objFileName, const string& fileName);
+protected:
+	/**
+	 * @struct	Resident
+	 * @brief	A loaded cluster.
+	 */
+	struct Resident {
+		std::shared_ptr<const StreamingBlock> block;	//!< Its triangles.
+		std::list<int>::iterator use;					//!< Its place in uses.
+		size_t bytes;									//!< Memory it uses.
+	};
+
+	bool isOpened;						//!< true iff the file could be opened and read.
+	std::ifstream file;					//!< The open file.
+	Material material;					//!< Given to every triangle.
+	uint64_t numTriangles;				//!< Triangles in all of the clusters.
+	vector<StreamingGroup> groups;		//!< The groups, in file order.
+	vector<StreamingCluster> clusters;	//!< The clusters, in file order.
+	std::unordered_map<int, Resident> residents;	//!< Loaded clusters, by index.
+	std::list<int> uses;				//!< Loaded clusters, most recently fetched first.
+	size_t budget;						//!< Bytes of clusters to keep loaded.
+	size_t residentBytes;				//!< Bytes of clusters loaded now.
+	mutable std::mutex lock;			//!< Guards file and everything after it.
+
+	std::shared_ptr<const StreamingBlock> load(int cluster);
+	void evict(int keep);
+};
@@ -0,0 +1,218 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include "swapchain.h"
+
+/**
+ * @fn	SwapChain::SwapChain(int width, int height, int numBuffers, bool tiledLayout)
+ * @brief	Constructs a swap chain and starts its presenter thread.
+ * @param	width	   	Width of each buffer.
+ * @param	height	   	Height of each buffer.
+ * @param	numBuffers 	2 for double buffering, 3 for triple buffering.
+ * @param	tiledLayout	true to store the buffers' pixels tile by tile.
+ */
+
+SwapChain::SwapChain(int width, int height, int numBuffers, bool tiledLayout)
+	: back(0), front(-1), frameCount(0), lastShownFrame(0),
+	width(width), height(height), isShuttingDown(false) {
+	numBuffers = glm::max(numBuffers, 2);
+	for (int i = 0; i < numBuffers; i++) {
+		buffers.push_back(new FrameBuffer(width, height));
+		buffers.back()->setTiledLayout(tiledLayout);
+	}
+	presentsPending.assign(numBuffers, 0);
+	isBeingShown.assign(numBuffers, false);
+	presentThread = std::thread(&SwapChain::presentLoop, this);
+}
+
+/**
+ * @fn	SwapChain::~SwapChain()
+ * @brief	Finishes any queued presents, then stops the presenter thread.
+ */
+
+SwapChain::~SwapChain() {
+	finishPresenting();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		isShuttingDown = true;
+	}
+	changed.notify_all();
+	presentThread.join();
+	for (FrameBuffer* buffer : buffers) {
+		delete buffer;
+	}
+}
+
+/**
+ * @fn	FrameBuffer& SwapChain::getBackBuffer()
+ * @brief	The buffer to render the next frame into. It is resized first if setSize
+ * 			has been called since it was last used.
+ * @return	The back buffer.
+ */
+
+FrameBuffer& SwapChain::getBackBuffer() {
+	std::lock_guard<std::mutex> guard(lock);
+	FrameBuffer& buffer = *buffers[back];
+	if (buffer.getWindowWidth() != width || buffer.getWindowHeight() != height) {
+		buffer.setFrameBufferSize(width, height);
+	}
+	return buffer;
+}
+
+/**
+ * @fn	bool SwapChain::isFree(int buffer) const
+ * @brief	Determines if a buffer can become the back buffer. The caller must hold lock.
+ * @param	buffer	Index of the buffer.
+ * @return	true iff nothing else is using the buffer.
+ */
+
+bool SwapChain::isFree(int buffer) const {
+	return buffer != front && presentsPending[buffer] == 0 && !isBeingShown[buffer];
+}
+
+/**
+ * @fn	void SwapChain::swap()
+ * @brief	Makes the back buffer the front buffer, queues it for the presenter, and
+ * 			selects a new back buffer. Waits only if every other buffer is still
+ * 			being presented or shown.
+ */
+
+void SwapChain::swap() {
+	buffers[back]->finishClears();
+	std::unique_lock<std::mutex> guard(lock);
+	front = back;
+	frameCount++;
+	if (presenter) {
+		presentsPending[front]++;
+		presentQueue.push_back(std::make_pair(front, frameCount));
+	}
+	changed.notify_all();
+
+	const int N = (int)buffers.size();
+	changed.wait(guard, [&]() {
+		for (int i = 1; i < N; i++) {
+			if (isFree((front + i) % N)) {
+				back = (front + i) % N;
+				return true;
+			}
+		}
+		return false;
+	});
+}
+
+/**
+ * @fn	bool SwapChain::showFrontBuffer()
+ * @brief	Draws the newest finished frame to the screen. Must be called from the
+ * 			thread that owns the GL context, typically from the display callback.
+ * @return	true iff there was a frame that had not been shown before.
+ */
+
+bool SwapChain::showFrontBuffer() {
+	int toShow;
+	bool isNew;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (front < 0) {
+			return false;
+		}
+		toShow = front;
+		isNew = lastShownFrame != frameCount;
+		lastShownFrame = frameCount;
+		isBeingShown[toShow] = true;
+	}
+	buffers[toShow]->showColorBuffer();
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		isBeingShown[toShow] = false;
+	}
+	changed.notify_all();
+	return isNew;
+}
+
+/**
+ * @fn	void SwapChain::setPresenter(const Presenter &presenter)
+ * @brief	Sets the function called, on the presenter thread, with each frame passed
+ * 			to swap(). Frames are presented in order. Pass an empty function to stop
+ * 			presenting.
+ * @param	presenter	The presenter.
+ */
+
+void SwapChain::setPresenter(const Presenter& presenter) {
+	finishPresenting();
+	std::lock_guard<std::mutex> guard(lock);
+	this->presenter = presenter;
+}
+
+/**
+ * @fn	void SwapChain::finishPresenting()
+ * @brief	Waits until every frame queued so far has been presented.
+ */
+
+void SwapChain::finishPresenting() {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [&]() {
+		for (int pending : presentsPending) {
+			if (pending > 0) {
+				return false;
+			}
+		}
+		return true;
+	});
+}
+
+/**
+ * @fn	void SwapChain::setSize(int width, int height)
+ * @brief	Changes the size of future frames. Each buffer is resized the next time it
+ * 			becomes the back buffer, so frames already finished are unaffected.
+ * @param	width 	The new width.
+ * @param	height	The new height.
+ */
+
+void SwapChain::setSize(int width, int height) {
+	std::lock_guard<std::mutex> guard(lock);
+	this->width = width;
+	this->height = height;
+}
+
+/**
+ * @fn	int SwapChain::getFrameCount() const
+ * @brief	The number of frames swapped so far.
+ * @return	The frame count.
+ */
+
+int SwapChain::getFrameCount() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return frameCount;
+}
+
+/**
+ * @fn	void SwapChain::presentLoop()
+ * @brief	Body of the presenter thread. Presents queued frames, in order, until the
+ * 			swap chain is destroyed.
+ */
+
+void SwapChain::presentLoop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		changed.wait(guard, [&]() { return isShuttingDown || !presentQueue.empty(); });
+		if (presentQueue.empty()) {
+			return;
+		}
+		std::pair<int, int> job = presentQueue.front();
+		presentQueue.pop_front();
+		Presenter present = presenter;
+		guard.unlock();
+		if (present) {
+			present(*buffers[job.first], job.second);
+		}
+		guard.lock();
+		presentsPending[job.first]--;
+		changed.notify_all();
+	}
+}
@@ -0,0 +1,64 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "defs.h"
+#include "framebuffer.h"
+
+/**
+ * @struct	SwapChain
+ * @brief	Two or three framebuffers that take turns being rendered into. The renderer
+ * 			draws into the back buffer and calls swap(), which makes it the front buffer
+ * 			and hands the renderer a different back buffer right away. Finished frames are
+ * 			given to an optional presenter (for example, one that writes image files) on
+ * 			a separate thread, and the GL thread shows the newest front buffer with
+ * 			showFrontBuffer. Neither costs the renderer any time unless every other buffer
+ * 			is still in use, in which case swap() waits for one to come free.
+ *
+ * 			One thread renders (getBackBuffer, swap) and, at most, one other thread shows
+ * 			frames (showFrontBuffer).
+ */
+
+struct SwapChain {
+	typedef std::function<void(const FrameBuffer& frame, int frameNumber)> Presenter;
+
+	SwapChain(int width, int height, int numBuffers = 2, bool tiledLayout = false);
+	~SwapChain();
+	FrameBuffer& getBackBuffer();
+	void swap();
+	bool showFrontBuffer();
+	void setPresenter(const Presenter& presenter);
+	void finishPresenting();
+	void setSize(int width, int height);
+	int getFrameCount() const;
+protected:
+	std::vector<FrameBuffer*> buffers;	//!< All of the buffers.
+	std::vector<int> presentsPending;	//!< Per buffer, number of queued or running presents.
+	std::vector<bool> isBeingShown;		//!< Per buffer, true while showFrontBuffer draws it.
+	int back;							//!< Index of the back buffer.
+	int front;							//!< Index of the newest finished frame, or -1.
+	int frameCount;						//!< Number of swaps so far.
+	int lastShownFrame;					//!< frameCount when the front buffer was last shown.
+	int width, height;					//!< Requested size of the buffers.
+	Presenter presenter;				//!< Called for each finished frame, on presentThread.
+	std::deque<std::pair<int, int>> presentQueue;	//!< (buffer, frame number) to present.
+	bool isShuttingDown;				//!< Tells presentThread to exit.
+	mutable std::mutex lock;			//!< Guards everything above.
+	std::condition_variable changed;	//!< Signalled whenever a buffer or the queue changes.
+	std::thread presentThread;			//!< Runs the presenter.
+
+	bool isFree(int buffer) const;
+	void presentLoop();
+};
@@ -0,0 +1,221 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <algorithm>
+#include "textureregistry.h"
+
+/**
+ * @fn	TextureRegistry::TextureRegistry(size_t budgetBytes, bool loadsAsynchronously)
+ * @brief	Constructs an empty registry.
+ * @param	budgetBytes		   	Bytes of texels to keep loaded (see trim).
+ * @param	loadsAsynchronously	true to load in the background (see setAsynchronous).
+ */
+
+TextureRegistry::TextureRegistry(size_t budgetBytes, bool loadsAsynchronously)
+	: budget(budgetBytes), clock(1), isAsynchronous(loadsAsynchronously),
+	numLoading(0), isShuttingDown(false) {
+}
+
+/**
+ * @fn	TextureRegistry::~TextureRegistry()
+ * @brief	Stops loading and deletes every image handed out.
+ */
+
+TextureRegistry::~TextureRegistry() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		isShuttingDown = true;
+	}
+	changed.notify_all();
+	if (loadThread.joinable()) {
+		loadThread.join();
+	}
+}
+
+/**
+ * @fn	Image* TextureRegistry::get(const string &fileName, TexelFormat format)
+ * @brief	Returns the shared image for a file, creating it (unloaded) if needed. The
+ * 			image belongs to the registry and lives as long as it does.
+ * @param	fileName	Name of a PPM file.
+ * @param	format  	How to store the texels.
+ * @return	The image.
+ */
+
+Image* TextureRegistry::get(const string& fileName, TexelFormat format) {
+	std::lock_guard<std::mutex> guard(lock);
+	std::unique_ptr<Image>& image = images[std::make_pair(fileName, format)];
+	if (image == nullptr) {
+		image.reset(new Image(this, &clock, fileName, format));
+	}
+	return image.get();
+}
+
+/**
+ * @fn	bool TextureRegistry::makeResident(Image *image)
+ * @brief	Loads an image that was sampled while not loaded. Called by the image,
+ * 			possibly from several rendering threads at once.
+ * @param [in,out]	image	The image.
+ * @return	true iff the image is loaded on return.
+ */
+
+bool TextureRegistry::makeResident(Image* image) {
+	bool isAsync;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		isAsync = isAsynchronous;
+		if (isAsync) {
+			int expected = Image::UNLOADED;
+			if (image->residency.compare_exchange_strong(expected, Image::LOADING)) {
+				loadQueue.push_back(image);
+				numLoading++;
+				if (!loadThread.joinable()) {
+					loadThread = std::thread(&TextureRegistry::loadLoop, this);
+				}
+				changed.notify_all();
+			}
+		}
+	}
+	if (!isAsync) {
+		std::lock_guard<std::mutex> guard(image->loadLock);
+		if (!image->isResident()) {
+			image->load();
+			image->lastUse.store(clock.load(), std::memory_order_relaxed);
+			image->residency.store(Image::RESIDENT, std::memory_order_release);
+		}
+	}
+	return image->isResident();
+}
+
+/**
+ * @fn	void TextureRegistry::loadLoop()
+ * @brief	Body of loadThread. Loads queued images, in order, until the registry is
+ * 			destroyed.
+ */
+
+void TextureRegistry::loadLoop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		changed.wait(guard, [&]() { return isShuttingDown || !loadQueue.empty(); });
+		if (isShuttingDown) {
+			return;
+		}
+		Image* image = loadQueue.front();
+		loadQueue.pop_front();
+		LoadedCallback callback = onLoaded;
+		guard.unlock();
+		{
+			std::lock_guard<std::mutex> imageGuard(image->loadLock);
+			image->load();
+			image->lastUse.store(clock.load(), std::memory_order_relaxed);
+			image->residency.store(Image::RESIDENT, std::memory_order_release);
+		}
+		if (callback) {
+			callback(*image);
+		}
+		guard.lock();
+		numLoading--;
+		changed.notify_all();
+	}
+}
+
+/**
+ * @fn	void TextureRegistry::finishLoading()
+ * @brief	Waits until every background load requested so far has finished.
+ */
+
+void TextureRegistry::finishLoading() {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [&]() { return numLoading == 0; });
+}
+
+/**
+ * @fn	void TextureRegistry::trim()
+ * @brief	Ends a frame: evicts the least recently sampled images, oldest first, until
+ * 			the loaded texels fit in the budget. Images sampled since the last trim are
+ * 			kept. Must not be called while any image might be sampled.
+ */
+
+void TextureRegistry::trim() {
+	std::lock_guard<std::mutex> guard(lock);
+	const unsigned int frame = clock++;
+	vector<Image*> resident;
+	size_t bytes = 0;
+	for (const auto& entry : images) {
+		if (entry.second->isResident()) {
+			resident.push_back(entry.second.get());
+			bytes += entry.second->getTexelBytes();
+		}
+	}
+	std::sort(resident.begin(), resident.end(), [](const Image* a, const Image* b) {
+		return a->lastUse.load(std::memory_order_relaxed) < b->lastUse.load(std::memory_order_relaxed);
+	});
+	for (Image* image : resident) {
+		if (bytes <= budget || image->lastUse.load(std::memory_order_relaxed) >= frame) {
+			break;
+		}
+		bytes -= image->getTexelBytes();
+		image->unload();
+	}
+}
+
+/**
+ * @fn	void TextureRegistry::setBudget(size_t budgetBytes)
+ * @brief	Sets the number of bytes of texels to keep loaded. Takes effect at the next trim.
+ * @param	budgetBytes	The budget.
+ */
+
+void TextureRegistry::setBudget(size_t budgetBytes) {
+	std::lock_guard<std::mutex> guard(lock);
+	budget = budgetBytes;
+}
+
+/**
+ * @fn	size_t TextureRegistry::getBudget() const
+ * @brief	The number of bytes of texels to keep loaded.
+ * @return	The budget.
+ */
+
+size_t TextureRegistry::getBudget() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return budget;
+}
+
+/**
+ * @fn	size_t TextureRegistry::getResidentBytes() const
+ * @brief	The number of bytes of texels currently loaded, mipmaps included.
+ * @return	The byte count.
+ */
+
+size_t TextureRegistry::getResidentBytes() const {
+	std::lock_guard<std::mutex> guard(lock);
+	size_t bytes = 0;
+	for (const auto& entry : images) {
+		if (entry.second->isResident()) {
+			bytes += entry.second->getTexelBytes();
+		}
+	}
+	return bytes;
+}
+
+/**
+ * @fn	void TextureRegistry::setAsynchronous(bool loadsAsynchronously, const LoadedCallback &onLoaded)
+ * @brief	Chooses where images are loaded. Synchronous loads happen on the thread that
+ * 			first samples the image, which waits for them. Asynchronous loads happen on a
+ * 			background thread; until one finishes, the image samples as a gray
+ * 			placeholder, and afterwards onLoaded is called (on that thread), for example
+ * 			to ask for the frame to be redrawn.
+ * @param	loadsAsynchronously	true to load in the background.
+ * @param	onLoaded		   	Called after each background load, if not empty.
+ */
+
+void TextureRegistry::setAsynchronous(bool loadsAsynchronously, const LoadedCallback& onLoaded) {
+	std::lock_guard<std::mutex> guard(lock);
+	isAsynchronous = loadsAsynchronously;
+	this->onLoaded = onLoaded;
+}
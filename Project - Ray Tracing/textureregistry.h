@@ -0,0 +1,63 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include "defs.h"
+#include "image.h"
+
+const size_t DEFAULT_TEXTURE_BUDGET = 256 << 20;	//!< Bytes of texels kept loaded, by default.
+
+/**
+ * @struct	TextureRegistry
+ * @brief	Hands out shared textures by file name. Asking twice for the same file
+ * 			gives the same Image, and nothing is read until the image is first sampled.
+ * 			Loading happens on the sampling thread, or, when loading asynchronously, on
+ * 			a background thread while samples return a gray placeholder.
+ *
+ * 			Call trim() between frames (never while rendering): it marks the end of a
+ * 			frame and evicts the least recently sampled textures until the loaded
+ * 			texels fit in the budget. Textures sampled during the frame that just ended
+ * 			are never evicted, so the budget can be exceeded by a single frame's needs.
+ */
+
+struct TextureRegistry {
+	typedef std::function<void(const Image& image)> LoadedCallback;
+
+	TextureRegistry(size_t budgetBytes = DEFAULT_TEXTURE_BUDGET, bool loadsAsynchronously = false);
+	~TextureRegistry();
+	Image* get(const string& fileName, TexelFormat format = TexelFormat::RGB8);
+	void trim();
+	void finishLoading();
+	void setBudget(size_t budgetBytes);
+	size_t getBudget() const;
+	size_t getResidentBytes() const;
+	void setAsynchronous(bool loadsAsynchronously, const LoadedCallback& onLoaded = LoadedCallback());
+	bool makeResident(Image* image);
+protected:
+	std::map<std::pair<string, TexelFormat>, std::unique_ptr<Image>> images;	//!< Every image handed out.
+	size_t budget;						//!< Bytes of texels to keep loaded.
+	std::atomic<unsigned int> clock;	//!< Number of trims so far; stamps each use.
+	bool isAsynchronous;				//!< true to load on loadThread.
+	LoadedCallback onLoaded;			//!< Called on loadThread after each load.
+	std::deque<Image*> loadQueue;		//!< Images waiting for loadThread.
+	int numLoading;						//!< Images queued or being loaded.
+	bool isShuttingDown;				//!< Tells loadThread to exit.
+	mutable std::mutex lock;			//!< Guards everything above.
+	std::condition_variable changed;	//!< Signalled when the queue changes.
+	std::thread loadThread;				//!< Loads queued images (started on demand).
+
+	void loadLoop();
+};
@@ -0,0 +1,276 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#ifndef WINDOWS
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "tilestream.h"
+
+const int TILE_BYTES = FRAMEBUFFER_TILE_AREA * BYTES_PER_PIXEL;	//!< Largest tile's pixel data.
+
+/**
+ * @fn	TilePublisher::TilePublisher(const std::string &socketPath)
+ * @brief	Creates a publisher that sends to the viewer listening at socketPath. The
+ * 			viewer may be started before or after the publisher. Unix domain sockets
+ * 			are not available on Windows, where the publisher is never open. An open
+ * 			publisher starts the thread that sends frames while they are rendered.
+ * @param	socketPath	Path of the viewer's socket.
+ */
+
+TilePublisher::TilePublisher(const std::string& socketPath)
+	: path(socketPath), socketFD(-1), frameWidth(0), frameHeight(0),
+	lastFrame(nullptr), newestFrame(INT_MIN), bytesSent(0), renderingFrame(nullptr),
+	renderingNumber(0), renderingClears(0), isShuttingDown(false) {
+	pixels.resize(TILE_BYTES);
+	message.reserve(MAX_TILE_MESSAGE);
+#ifndef WINDOWS
+	sockaddr_un address;
+	if (path.size() < sizeof(address.sun_path)) {
+		socketFD = socket(AF_UNIX, SOCK_DGRAM, 0);
+	}
+#endif
+	if (socketFD < 0) {
+		std::cerr << "Unable to publish tiles to " << path << endl;
+	} else {
+		progressThread = std::thread(&TilePublisher::progressLoop, this);
+	}
+}
+
+/**
+ * @fn	TilePublisher::~TilePublisher()
+ * @brief	Stops the progress thread and closes the socket.
+ */
+
+TilePublisher::~TilePublisher() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		isShuttingDown = true;
+	}
+	changed.notify_all();
+	if (progressThread.joinable()) {
+		progressThread.join();
+	}
+#ifndef WINDOWS
+	if (socketFD >= 0) {
+		close(socketFD);
+	}
+#endif
+}
+
+/**
+ * @fn	void TilePublisher::forgetViewer()
+ * @brief	Marks every tile as unknown to the viewer, so the next frame is sent in full.
+ */
+
+void TilePublisher::forgetViewer() {
+	isStale.assign(isStale.size(), true);
+}
+
+/**
+ * @fn	bool TilePublisher::sendMessage()
+ * @brief	Sends the tiles collected in message, without waiting, and empties it.
+ * 			Tiles that could not be sent will be sent with a later frame.
+ * @return	true iff the message was sent (or was empty).
+ */
+
+bool TilePublisher::sendMessage() {
+	if (messageTiles.empty()) {
+		return true;
+	}
+	bool wasSent = false;
+#ifndef WINDOWS
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, path.c_str());
+	ssize_t n = sendto(socketFD, message.data(), message.size(), MSG_DONTWAIT,
+						(const sockaddr*)&address, sizeof(address));
+	wasSent = n == (ssize_t)message.size();
+#endif
+	if (wasSent) {
+		bytesSent += message.size();
+		for (const std::pair<int, size_t>& tile : messageTiles) {
+			std::memcpy(sent.data() + (size_t)tile.first * TILE_BYTES,
+						message.data() + tile.second, tileSizes[tile.first]);
+			isStale[tile.first] = false;
+		}
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+		// The viewer is behind; these tiles go out with a later frame.
+		for (const std::pair<int, size_t>& tile : messageTiles) {
+			isStale[tile.first] = true;
+		}
+	} else {
+		// No viewer is listening. Whichever one starts next needs everything.
+		forgetViewer();
+	}
+	message.clear();
+	messageTiles.clear();
+	return wasSent;
+}
+
+/**
+ * @fn	size_t TilePublisher::getBytesSent() const
+ * @brief	Total bytes sent so far.
+ * @return	The bytes sent.
+ */
+
+size_t TilePublisher::getBytesSent() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return bytesSent;
+}
+
+/**
+ * @fn	void TilePublisher::beginFrame(const FrameBuffer &frame, int frameNumber)
+ * @brief	Starts sending the tiles of a frame as they are rendered, every
+ * 			TILE_PROGRESS_INTERVAL milliseconds, until endFrame is called. Nothing is
+ * 			sent until the renderer clears the frame, since until then it holds an old
+ * 			image, and after that a tile is sent once all of the blocks the renderer
+ * 			announced for it have been written (see FrameBuffer::expectTileWrites), so
+ * 			that no tile is read while it is being written. Renderers that announce
+ * 			nothing are sent only when published. The frame must stay alive and the same
+ * 			size until endFrame.
+ * @param	frame	   	The frame about to be rendered.
+ * @param	frameNumber	The number it will be published with.
+ */
+
+void TilePublisher::beginFrame(const FrameBuffer& frame, int frameNumber) {
+	if (!isOpen()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		renderingFrame = &frame;
+		renderingNumber = frameNumber;
+		renderingClears = frame.getFrameNumber();
+	}
+	changed.notify_all();
+}
+
+/**
+ * @fn	void TilePublisher::endFrame()
+ * @brief	Stops sending the frame given to beginFrame. Its remaining tiles go out when
+ * 			it is published.
+ */
+
+void TilePublisher::endFrame() {
+	std::lock_guard<std::mutex> guard(lock);
+	renderingFrame = nullptr;
+}
+
+/**
+ * @fn	void TilePublisher::progressLoop()
+ * @brief	Body of the progress thread.
+ */
+
+void TilePublisher::progressLoop() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (!isShuttingDown) {
+		if (renderingFrame != nullptr) {
+			if (renderingFrame->getFrameNumber() != renderingClears) {
+				sendTiles(*renderingFrame, renderingNumber, false);
+			}
+			changed.wait_for(guard, std::chrono::milliseconds(TILE_PROGRESS_INTERVAL));
+		} else {
+			changed.wait(guard, [this]() { return renderingFrame != nullptr || isShuttingDown; });
+		}
+	}
+}
+
+/**
+ * @fn	void TilePublisher::publish(const FrameBuffer &frame, int frameNumber)
+ * @brief	Sends the tiles of a finished frame that the viewer does not already have.
+ * 			Intended to be called as (or from) a SwapChain presenter. A frame older than
+ * 			one already being sent is skipped.
+ * @param	frame	   	The frame.
+ * @param	frameNumber	The frame's sequence number.
+ */
+
+void TilePublisher::publish(const FrameBuffer& frame, int frameNumber) {
+	if (!isOpen()) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(lock);
+	sendTiles(frame, frameNumber, true);
+}
+
+/**
+ * @fn	void TilePublisher::sendTiles(const FrameBuffer &frame, int frameNumber, bool isFinished)
+ * @brief	Sends the tiles of a frame that the viewer does not already have. The change
+ * 			flags of a buffer cover everything the viewer has from it only if no other
+ * 			buffer was sent in between, so when the buffer differs from the last one,
+ * 			every tile is compared with the last one sent. A lazily cleared buffer
+ * 			flags every tile anyway, and that happens once per frame. lock must be held.
+ * @param	frame	   	The frame.
+ * @param	frameNumber	The frame's sequence number.
+ * @param	isFinished 	false while the frame is being rendered; its undrawn tiles are
+ * 						then left for later.
+ */
+
+void TilePublisher::sendTiles(const FrameBuffer& frame, int frameNumber, bool isFinished) {
+	if (frameNumber < newestFrame) {
+		return;
+	}
+	newestFrame = frameNumber;
+	const int NUM_TILES = frame.getNumTiles();
+	if (frame.getWindowWidth() != frameWidth || frame.getWindowHeight() != frameHeight) {
+		frameWidth = frame.getWindowWidth();
+		frameHeight = frame.getWindowHeight();
+		sent.assign((size_t)NUM_TILES * TILE_BYTES, 0);
+		isStale.assign(NUM_TILES, true);
+		tileSizes.resize(NUM_TILES);
+		for (int t = 0; t < NUM_TILES; t++) {
+			BoundingBoxi bounds = frame.getTileBounds(t);
+			tileSizes[t] = (size_t)bounds.width * bounds.height * BYTES_PER_PIXEL;
+		}
+		lastFrame = nullptr;
+	}
+	const bool onlyChanged = &frame == lastFrame;
+	lastFrame = &frame;
+
+	TileHeader header;
+	header.magic = TILE_MAGIC;
+	header.frameNumber = (unsigned int)frameNumber;
+	header.frameWidth = (unsigned short)frameWidth;
+	header.frameHeight = (unsigned short)frameHeight;
+	for (int t = 0; t < NUM_TILES; t++) {
+		if (!isFinished && !frame.isTileFinished(t)) {
+			continue;
+		}
+		bool isChanged = frame.takeTileChange(t);
+		if (onlyChanged && !isChanged && !isStale[t]) {
+			continue;
+		}
+		size_t numBytes = tileSizes[t];
+		frame.copyTileRGB(t, pixels.data());
+		if (!isStale[t] && std::memcmp(pixels.data(), sent.data() + (size_t)t * TILE_BYTES, numBytes) == 0) {
+			continue;
+		}
+		if (message.size() + sizeof(TileHeader) + numBytes > MAX_TILE_MESSAGE && !sendMessage()) {
+			// Leave this tile, and the rest, for a later frame.
+			isStale[t] = true;
+			return;
+		}
+		BoundingBoxi bounds = frame.getTileBounds(t);
+		header.lx = (unsigned short)bounds.lx;
+		header.ly = (unsigned short)bounds.ly;
+		header.width = (unsigned short)bounds.width;
+		header.height = (unsigned short)bounds.height;
+		const GLubyte* headerBytes = (const GLubyte*)&header;
+		message.insert(message.end(), headerBytes, headerBytes + sizeof(TileHeader));
+		messageTiles.push_back(std::make_pair(t, message.size()));
+		message.insert(message.end(), pixels.begin(), pixels.begin() + numBytes);
+	}
+	sendMessage();
+}
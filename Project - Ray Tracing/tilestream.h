@@ -0,0 +1,85 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "defs.h"
+#include "framebuffer.h"
+
+const unsigned int TILE_MAGIC = 0x54333836;		//!< Starts every tile.
+const int MAX_TILE_MESSAGE = 65536;				//!< Largest datagram, in bytes.
+const int TILE_PROGRESS_INTERVAL = 50;			//!< Milliseconds between sends of a frame being rendered.
+
+/**
+ * @struct	TileHeader
+ * @brief	Each datagram sent by a TilePublisher holds one or more tiles. Every tile
+ * 			is a TileHeader followed by width * height packed RGB pixels, bottom row
+ * 			first.
+ */
+
+struct TileHeader {
+	unsigned int magic;				//!< TILE_MAGIC.
+	unsigned int frameNumber;		//!< Sequence number of the frame the tile belongs to.
+	unsigned short frameWidth;		//!< Width of the whole frame.
+	unsigned short frameHeight;		//!< Height of the whole frame.
+	unsigned short lx, ly;			//!< Lower left corner of the tile.
+	unsigned short width, height;	//!< Size of the tile.
+};
+
+/**
+ * @struct	TilePublisher
+ * @brief	Streams frames to a viewer in another process (see tileviewer.cpp) over a
+ * 			Unix domain datagram socket. Between beginFrame and endFrame, the tiles of
+ * 			the frame being rendered are sent as they are finished, from a thread of the
+ * 			publisher's own, and publish sends whatever is left once the frame is done.
+ * 			The framebuffer's change flags say which tiles to look at, and only tiles
+ * 			that differ from what was last sent are published, so the bandwidth used
+ * 			grows with the changed area, not with the size of the window. Sends never
+ * 			block: if the viewer falls behind, the rest of the frame is dropped and
+ * 			those tiles are sent with a later frame, and if no viewer is listening, the
+ * 			next frame is sent in full.
+ */
+
+struct TilePublisher {
+	TilePublisher(const std::string& socketPath);
+	~TilePublisher();
+	bool isOpen() const { return socketFD >= 0; }
+	void beginFrame(const FrameBuffer& frame, int frameNumber);
+	void endFrame();
+	void publish(const FrameBuffer& frame, int frameNumber);
+	size_t getBytesSent() const;
+protected:
+	std::string path;					//!< Path of the viewer's socket.
+	int socketFD;						//!< The socket, or -1.
+	int frameWidth, frameHeight;		//!< Size of the frame the viewer has.
+	const FrameBuffer* lastFrame;		//!< The buffer published last.
+	int newestFrame;					//!< Highest frame number published so far.
+	std::vector<GLubyte> sent;			//!< Per tile, the pixels the viewer has.
+	std::vector<bool> isStale;			//!< Per tile, true if the viewer's copy is unknown.
+	std::vector<size_t> tileSizes;		//!< Per tile, bytes of pixel data.
+	std::vector<GLubyte> pixels;		//!< Scratch copy of one tile.
+	std::vector<GLubyte> message;		//!< The datagram being filled.
+	std::vector<std::pair<int, size_t>> messageTiles;	//!< (tile, offset of its pixels) in message.
+	size_t bytesSent;					//!< Total bytes sent.
+	const FrameBuffer* renderingFrame;	//!< The frame between beginFrame and endFrame, or nullptr.
+	int renderingNumber;				//!< Its frame number.
+	unsigned int renderingClears;		//!< Its getFrameNumber when beginFrame was called.
+	bool isShuttingDown;				//!< Tells progressThread to exit.
+	mutable std::mutex lock;			//!< Guards everything above.
+	std::condition_variable changed;	//!< Signalled by beginFrame and the destructor.
+	std::thread progressThread;			//!< Sends the tiles of renderingFrame.
+
+	void forgetViewer();
+	bool sendMessage();
+	void sendTiles(const FrameBuffer& frame, int frameNumber, bool isFinished);
+	void progressLoop();
+};
@@ -0,0 +1,173 @@
+/****************************************************
+ * 2016-2023 Eric Bachmann and Mike Zmuda
+ * All Rights Reserved.
+ * NOTICE:
+ * Dissemination of this information or reproduction
+ * of this material is prohibited unless prior written
+ * permission is granted.
+ ****************************************************/
+
+// Shows the frames that a renderer streams with a TilePublisher. Start it with
+// the same socket path that the renderer is given, e.g.:
+//		tileviewer /tmp/cse386.sock &
+//		CSE386_TILE_SOCKET=/tmp/cse386.sock fullraytrace
+
+#include <cstring>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include "defs.h"
+#include "utilities.h"
+#include "framebuffer.h"
+#include "tilestream.h"
+
+FrameBuffer frameBuffer(WINDOW_WIDTH, WINDOW_HEIGHT);
+int socketFD = -1;
+unsigned int frameNumber = 0;
+int numTilesReceived = 0;
+
+/**
+ * @fn	int openSocket(const string &path)
+ * @brief	Creates the socket that tiles are received on, replacing any stale one.
+ * @param	path	Path of the socket.
+ * @return	The socket, or -1.
+ */
+
+int openSocket(const string& path) {
+	sockaddr_un address;
+	if (path.size() >= sizeof(address.sun_path)) {
+		return -1;
+	}
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, path.c_str());
+	unlink(path.c_str());
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd >= 0 && bind(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/**
+ * @fn	bool receiveTiles(int timeoutMS)
+ * @brief	Copies every tile that has arrived into the framebuffer.
+ * @param	timeoutMS	How long to wait for the first tile.
+ * @return	true iff any tile was received.
+ */
+
+bool receiveTiles(int timeoutMS) {
+	static vector<GLubyte> message(MAX_TILE_MESSAGE);
+	pollfd request = { socketFD, POLLIN, 0 };
+	if (poll(&request, 1, timeoutMS) <= 0) {
+		return false;
+	}
+	bool received = false;
+	while (true) {
+		ssize_t n = recv(socketFD, message.data(), message.size(), MSG_DONTWAIT);
+		if (n <= 0) {
+			break;
+		}
+		size_t offset = 0;
+		while (offset + sizeof(TileHeader) <= (size_t)n) {
+			TileHeader header;
+			std::memcpy(&header, message.data() + offset, sizeof(TileHeader));
+			offset += sizeof(TileHeader);
+			size_t numBytes = (size_t)header.width * header.height * BYTES_PER_PIXEL;
+			if (header.magic != TILE_MAGIC || offset + numBytes > (size_t)n ||
+				header.lx + header.width > header.frameWidth || header.ly + header.height > header.frameHeight) {
+				break;
+			}
+			if (header.frameWidth != frameBuffer.getWindowWidth() ||
+				header.frameHeight != frameBuffer.getWindowHeight()) {
+				frameBuffer.setFrameBufferSize(header.frameWidth, header.frameHeight);
+				frameBuffer.clearColorBuffer();
+#ifndef CONSOLE_ONLY
+				glutReshapeWindow(header.frameWidth, header.frameHeight);
+#endif
+			}
+			const GLubyte* rgb = message.data() + offset;
+			vector<color> colors(header.width * header.height);
+			for (color& C : colors) {
+				C = color(rgb[0] + 0.5, rgb[1] + 0.5, rgb[2] + 0.5) / 255.0;
+				rgb += BYTES_PER_PIXEL;
+			}
+			frameBuffer.setColors(BoundingBoxi(header.lx, header.width, header.ly, header.height), colors.data());
+			offset += numBytes;
+			frameNumber = header.frameNumber;
+			numTilesReceived++;
+			received = true;
+		}
+	}
+	return received;
+}
+
+#ifdef CONSOLE_ONLY
+/**
+ * @fn	int main(int argc, char* argv[])
+ * @brief	Headless viewer: tileviewer [socketPath [outputFile [idleSeconds]]]. Once
+ * 			tiles stop arriving, the assembled image is written to outputFile (a PPM).
+ * 			Exits after idleSeconds without any tiles, or never if that is 0.
+ */
+
+int main(int argc, char* argv[]) {
+	string path = argc > 1 ? argv[1] : "/tmp/cse386.sock";
+	string fileName = argc > 2 ? argv[2] : "tileviewer.ppm";
+	int idleLimitMS = argc > 3 ? 1000 * std::atoi(argv[3]) : 0;
+	socketFD = openSocket(path);
+	if (socketFD < 0) {
+		std::cerr << "Unable to listen on " << path << endl;
+		return 1;
+	}
+	int idleMS = 0;
+	bool isUnsaved = false;
+	while (idleLimitMS == 0 || idleMS < idleLimitMS) {
+		if (receiveTiles(100)) {
+			idleMS = 0;
+			isUnsaved = true;
+		} else {
+			idleMS += 100;
+			if (isUnsaved && frameBuffer.writePPM(fileName)) {
+				cout << "Wrote frame " << frameNumber << " (" << numTilesReceived << " tiles) to " << fileName << endl;
+				isUnsaved = false;
+			}
+		}
+	}
+	close(socketFD);
+	unlink(path.c_str());
+	return 0;
+}
+#else
+void display() {
+	frameBuffer.showColorBuffer();
+}
+
+void timer(int id) {
+	if (receiveTiles(0)) {
+		glutPostRedisplay();
+	}
+	glutTimerFunc(TIME_INTERVAL, timer, id);
+}
+
+int main(int argc, char* argv[]) {
+	string path = argc > 1 ? argv[1] : "/tmp/cse386.sock";
+	socketFD = openSocket(path);
+	if (socketFD < 0) {
+		std::cerr << "Unable to listen on " << path << endl;
+		return 1;
+	}
+	graphicsInit(argc, argv, __FILE__);
+
+	glutDisplayFunc(display);
+	glutKeyboardFunc(keyboardUtility);
+	glutTimerFunc(TIME_INTERVAL, timer, 0);
+	glutMainLoop();
+
+	close(socketFD);
+	unlink(path.c_str());
+	return 0;
+}
+#endif
@@ -11,6 +11,9 @@
 #include <istream>
 #include <iomanip>
 #include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #include "defs.h"
 #include "framebuffer.h"
@@ -960,6 +963,68 @@ bool inRectangle(const dvec2& pt, const dvec2& lowerLeft, const dvec2& upperRigh
 		inRangeInclusive(pt.y, lowerLeft.y, upperRight.y);
 }
 
+/**
+* @fn	int elapsedMilliseconds()
+* @brief	Milliseconds since the first call. Unlike glutGet(GLUT_ELAPSED_TIME), this
+*			works without a window, so it can time headless (CONSOLE_ONLY) renders.
+* @return	Elapsed wall clock time, in milliseconds.
+*/
+
+int elapsedMilliseconds() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+	return (int)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+}
+
+/**
+* @fn	int numWorkerThreads()
+* @brief	The number of threads parallelFor uses by default.
+* @return	The number of hardware threads, or 1 if that is unknown.
+*/
+
+int numWorkerThreads() {
+	unsigned int n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : (int)n;
+}
+
+/**
+* @fn	void parallelFor(int begin, int end, const std::function<void(int)> &body, int numThreads)
+* @brief	Calls body(i) for every i in [begin, end), spread across several threads.
+*			Iterations are handed out one at a time, so uneven amounts of work per
+*			iteration still balance. Returns once every iteration has finished.
+* @param	begin	  	First iteration.
+* @param	end		  	One past the last iteration.
+* @param	body	  	The work to do for one iteration. Must be safe to call concurrently.
+* @param	numThreads	Number of threads to use, or 0 for numWorkerThreads().
+*/
+
+void parallelFor(int begin, int end, const std::function<void(int)>& body, int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = numWorkerThreads();
+	}
+	numThreads = glm::min(numThreads, end - begin);
+	if (numThreads <= 1) {
+		for (int i = begin; i < end; i++) {
+			body(i);
+		}
+		return;
+	}
+	std::atomic<int> next(begin);
+	auto worker = [&]() {
+		for (int i = next++; i < end; i = next++) {
+			body(i);
+		}
+	};
+	vector<std::thread> threads;
+	for (int t = 1; t < numThreads; t++) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (std::thread& t : threads) {
+		t.join();
+	}
+}
+
 /**
 * @fn	string extractBaseFilename(const string &str)
 * @brief	Extracts the base filename described by str
@@ -1004,10 +1069,10 @@ void keyboardUtility(unsigned char key, int x, int y) {
 }
 
 void graphicsInit(int argc, char* argv[], const std::string& windowName, int width, int height) {
+#ifndef CONSOLE_ONLY
 #ifndef WINDOWS
 	setenv("DISPLAY", ":0.0", 1);
 #endif
-#ifndef CONSOLE_ONLY
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
 	glutInitWindowSize(width, height);
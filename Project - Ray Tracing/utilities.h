@@ -13,6 +13,7 @@
 #include <vector>
 #include <cmath>
 #include <string>
+#include <functional>
 #include "defs.h"
 
 extern bool DEBUG_PIXEL;
@@ -98,6 +99,10 @@ bool inRangeExclusive(double val, double lo, double hi);
 bool inRectangle(double x, double y, double left, double bottom, double right, double top);
 bool inRectangle(const dvec2& pt, const dvec2& lowerLeft, const dvec2& upperRight);
 
+int elapsedMilliseconds();
+int numWorkerThreads();
+void parallelFor(int begin, int end, const std::function<void(int)>& body, int numThreads = 0);
+
 /**
  * @fn	template <class T> vector< vector<T> > allocate2D(int rows, int cols)
  * @brief	Allocates a vector of vectors.
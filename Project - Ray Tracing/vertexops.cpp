@@ -236,6 +236,25 @@ vector<VertexData> VertexOps::transformVertices(const dmat4& TM, const vector<Ve
 	return transformedVertices;
 }
 
+/**
+ * @fn	static VertexData perspectiveDivide(VertexData v)
+ * @brief	Divides a vertex in clip coordinates by its w.
+ * @param	v	The vertex.
+ * @return	The vertex in normalized device coordinates.
+ */
+
+static VertexData perspectiveDivide(VertexData v) {
+	if (v.pos.w >= 0) {
+		v.pos /= v.pos.w;
+	} else {							// should not happen
+		v.pos.x /= -v.pos.w;
+		v.pos.y /= -v.pos.w;
+		v.pos.z = -std::abs(v.pos.z / -v.pos.w);
+		v.pos.w = 1.0;
+	}
+	return v;
+}
+
 double computeNearPlane(const dmat4& PM) {
 	double alpha = PM[2][2];
 	double beta = PM[3][2];
@@ -277,16 +296,8 @@ void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& e
 	vector<VertexData> projCoords = transformVertices(projectionMatrix, eyeCoordsClippedOnNearPlane);
 	vector<VertexData> clipCoords;
 
-	for (VertexData v : projCoords) {		// Perspective division
-		if (v.pos.w >= 0) {
-			v.pos /= v.pos.w;
-		} else {							// should not happen
-			v.pos.x /= -v.pos.w;
-			v.pos.y /= -v.pos.w;
-			v.pos.z = -std::abs(v.pos.z / -v.pos.w);
-			v.pos.w = 1.0;
-		}
-		clipCoords.push_back(v);
+	for (const VertexData& v : projCoords) {
+		clipCoords.push_back(perspectiveDivide(v));
 	}
 
 	clipCoords = processBackwardFacingTriangles(clipCoords, renderBackfaces);
@@ -298,6 +309,287 @@ void VertexOps::processTriangleVertices(FrameBuffer& frameBuffer, const dvec3& e
 	drawManyFilledTriangles(frameBuffer, eyePos, lights, windowCoords, eyeFrame);
 }
 
+/**
+ * @struct	ClusterView
+ * @brief	What clusterIsVisible needs to know about the view, in object coordinates.
+ */
+
+struct ClusterView {
+	dvec4 planes[6];	//!< The planes of the view volume, facing in.
+	dvec4 viewer;		//!< The eye (w = 1), or for a parallel projection the direction of view (w = 0).
+	double facing;		//!< 1 if the modeling matrix keeps the triangles' winding, -1 if it mirrors it, 0 to keep backfaces.
+};
+
+/**
+ * @fn	static ClusterView makeClusterView(const dmat4 &modelingMatrix,
+ *										const PipelineMatrices &pipeMats, bool renderBackfaces)
+ * @brief	Finds the view volume's planes from the rows of the whole object to clip
+ * 			transformation, and the eye by undoing the viewing and modeling matrices.
+ * @param	modelingMatrix 	The transformation applied to the object.
+ * @param	pipeMats	   	The pipeline matrices.
+ * @param	renderBackfaces	True if backfaces are to be rendered.
+ * @return	The view.
+ */
+
+static ClusterView makeClusterView(const dmat4& modelingMatrix, const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	ClusterView view;
+	const dmat4 objectToClip = pipeMats.projectionMatrix * pipeMats.viewingMatrix * modelingMatrix;
+	for (int axis = 0; axis < 3; axis++) {
+		for (int side = 0; side < 2; side++) {
+			double sign = side == 0 ? 1.0 : -1.0;
+			for (int col = 0; col < 4; col++) {
+				view.planes[2 * axis + side][col] = objectToClip[col][3] + sign * objectToClip[col][axis];
+			}
+		}
+	}
+	const bool isParallel = pipeMats.projectionMatrix[2][3] == 0.0;
+	view.viewer = glm::inverse(pipeMats.viewingMatrix * modelingMatrix) *
+		(isParallel ? dvec4(0.0, 0.0, -1.0, 0.0) : dvec4(0.0, 0.0, 0.0, 1.0));
+	double det = glm::determinant(dmat3(modelingMatrix));
+	view.facing = renderBackfaces || det == 0.0 ? 0.0 : (det > 0.0 ? 1.0 : -1.0);
+	return view;
+}
+
+/**
+ * @fn	static bool clusterIsVisible(const MeshCluster &cluster, const ClusterView &view)
+ * @brief	Tests a whole cluster at once. It cannot be seen if its bounding sphere is
+ * 			entirely outside one of the planes of the view volume, or if every direction
+ * 			from the viewer into the sphere makes less than a right angle with every
+ * 			normal in its cone, so that all of its triangles face away.
+ * @param	cluster	The cluster.
+ * @param	view   	The view, from makeClusterView.
+ * @return	false if nothing in the cluster can be drawn.
+ */
+
+static bool clusterIsVisible(const MeshCluster& cluster, const ClusterView& view) {
+	for (int i = 0; i < 6; i++) {
+		const dvec3 n = view.planes[i].xyz();
+		if (glm::dot(n, cluster.center) + view.planes[i].w < -cluster.radius * glm::length(n)) {
+			return false;
+		}
+	}
+	const double facing = view.facing;
+	const dvec4& viewer = view.viewer;
+	if (facing == 0.0 || cluster.coneCutoff <= 0.0) {
+		return true;
+	}
+	const bool isParallel = viewer.w == 0.0;
+	dvec3 toCluster = isParallel ? viewer.xyz() : cluster.center - viewer.xyz();
+	double distance = glm::length(toCluster);
+	if (distance <= (isParallel ? 0.0 : cluster.radius)) {
+		return true;
+	}
+	const double MARGIN = 1.0E-6;
+	double spread = isParallel ? 0.0 : std::asin(cluster.radius / distance);
+	double cosAngle = facing * glm::dot(toCluster, cluster.coneAxis) / distance;
+	double angle = std::acos(glm::clamp(cosAngle, -1.0, 1.0));
+	return angle + std::acos(cluster.coneCutoff) + spread >= PI_2 - MARGIN;
+}
+
+/**
+ * @fn	void VertexOps::processIndexedTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const IndexedMesh &mesh, int lod, const dmat4 &modelingMatrix,
+ *												const PipelineMatrices &pipeMats, bool renderBackfaces)
+ * @brief	Same as processTriangleVertices, for one level of detail of an indexed mesh. Each vertex is carried
+ * 			through the pipeline, to window coordinates, once. Triangles are then
+ * 			assembled from those, and only the few that cross the near plane or the
+ * 			edges of the view volume are clipped vertex by vertex. The colors are the
+ * 			same as for the equivalent EShapeData, but the depths may not be: clusters
+ * 			reorder the triangles within each submesh, and the last triangle drawn at
+ * 			a pixel sets its depth. Before any of that, clusters that are off-screen
+ * 			or face away are dropped, along with every vertex that only they use.
+ * @param [in,out]	frameBuffer	  	Buffer for frame data.
+ * @param 		  	eyePos		  	The eye position.
+ * @param 		  	lights		  	The lights.
+ * @param 		  	mesh		  	The mesh, in object coordinates.
+ * @param 		  	lod			  	The level of detail to draw, 0 for full detail.
+ * @param 		  	modelingMatrix	The transformation applied to the object.
+ * @param 		  	pipeMats	  	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const IndexedMesh& mesh, int lod,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const MeshLOD& level = mesh.getLOD(lod);
+	if (mesh.materials.empty()) {
+		return;
+	}
+
+	vector<std::pair<uint32_t, uint32_t>> runs;		// (first index, number of indices) to draw.
+	if (level.clusters.empty()) {
+		runs.push_back(std::make_pair(0u, (uint32_t)level.indices.size()));
+	}
+	const ClusterView view = makeClusterView(modelingMatrix, pipeMats, renderBackfaces);
+	for (const MeshCluster& cluster : level.clusters) {
+		if (clusterIsVisible(cluster, view)) {
+			runs.push_back(std::make_pair(cluster.firstIndex, cluster.numIndices));
+		}
+	}
+
+	// Gather the vertices of the runs, each taking the material of the submesh that uses
+	// it, and give them consecutive slots.
+	const int NUM_VERTICES = mesh.getNumVertices();
+	const uint32_t UNUSED = UINT32_MAX;
+	vector<int> materialIds(NUM_VERTICES, 0);
+	for (const Submesh& submesh : level.submeshes) {
+		for (uint32_t i = submesh.firstIndex; i < submesh.firstIndex + submesh.numIndices; i++) {
+			materialIds[level.indices[i]] = submesh.materialId;
+		}
+	}
+	vector<uint32_t> slots(NUM_VERTICES, UNUSED);
+	vector<VertexData> objectCoords;
+	vector<uint32_t> corners;
+	for (const std::pair<uint32_t, uint32_t>& run : runs) {
+		for (uint32_t i = run.first; i < run.first + run.second; i++) {
+			uint32_t v = level.indices[i];
+			if (slots[v] == UNUSED) {
+				slots[v] = (uint32_t)objectCoords.size();
+				const dvec3& P = mesh.positions[v];
+				objectCoords.push_back(VertexData(dvec4(P.x, P.y, P.z, 1.0), mesh.normals[v], mesh.materials[materialIds[v]]));
+				objectCoords.back().normal = mesh.normals[v];
+			}
+		}
+		for (uint32_t t = run.first; t + 2 < run.first + run.second; t += 3) {
+			for (int j = 0; j < 3; j++) {
+				corners.push_back(slots[level.indices[t + j]]);
+			}
+		}
+	}
+	processSharedTriangles(frameBuffer, eyePos, lights, objectCoords, corners, nullptr,
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+/**
+ * @fn	void VertexOps::processSharedTriangles(FrameBuffer &frameBuffer, const dvec3 &eyePos,
+ *												const vector<LightSourcePtr> &lights,
+ *												const vector<VertexData> &objectCoords,
+ *												const vector<uint32_t> &corners,
+ *												const vector<dvec3> *faceNormals,
+ *												const dmat4 &modelingMatrix,
+ *												const PipelineMatrices &pipeMats, bool renderBackfaces)
+ * @brief	The back half of processIndexedTriangles: carries each vertex through the
+ * 			pipeline once, then assembles, culls, clips and draws the triangles.
+ * @param [in,out]	frameBuffer	  	Buffer for frame data.
+ * @param 		  	eyePos		  	The eye position.
+ * @param 		  	lights		  	The lights.
+ * @param 		  	objectCoords  	The vertices, in object coordinates.
+ * @param 		  	corners		  	Three indices into objectCoords per triangle.
+ * @param 		  	faceNormals	  	nullptr to shade with the vertices' normals, or one
+ * 									object coordinate normal per triangle, for flat shading.
+ * @param 		  	modelingMatrix	The transformation applied to the object.
+ * @param 		  	pipeMats	  	The pipeline matrices.
+ * @param 		  	renderBackfaces	True if backfaces are to be rendered.
+ */
+
+void VertexOps::processSharedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+	const vector<LightSourcePtr>& lights,
+	const vector<VertexData>& objectCoords,
+	const vector<uint32_t>& corners,
+	const vector<dvec3>* faceNormals,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& viewingMatrix = pipeMats.viewingMatrix;
+	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
+	const dmat4& viewportMatrix = pipeMats.viewportMatrix;
+	const int NUM_USED = (int)objectCoords.size();
+	const dmat3 G = glm::transpose(glm::inverse(dmat3(modelingMatrix)));
+
+	vector<VertexData> worldCoords = transformVerticesToWorldCoordinates(modelingMatrix, objectCoords);
+	vector<VertexData> eyeCoords = transformVertices(viewingMatrix, worldCoords);
+	vector<VertexData> clipCoords = transformVertices(projectionMatrix, eyeCoords);
+	for (VertexData& v : clipCoords) {
+		v = perspectiveDivide(v);
+	}
+	vector<VertexData> windowCoords = transformVertices(viewportMatrix, clipCoords);
+
+	double nearZ = computeNearPlane(projectionMatrix);
+	vector <IPlane> nearPlane = { IPlane(dvec4(0.0, 0.0, nearZ, 1.0), -Z_AXIS) };
+	vector<bool> inFront(NUM_USED), inView(NUM_USED);
+	for (int i = 0; i < NUM_USED; i++) {
+		inFront[i] = nearPlane[0].onFrontSide(eyeCoords[i].pos.xyz());
+		inView[i] = true;
+		for (const IPlane& plane : allButNearNDCPlanes) {
+			inView[i] = inView[i] && plane.onFrontSide(clipCoords[i].pos.xyz());
+		}
+	}
+
+	vector<VertexData> triangles;
+	triangles.reserve(corners.size());
+	auto setFaceNormal = [&](VertexData* tri, size_t t) {
+		if (faceNormals != nullptr) {
+			const dvec3 n = glm::normalize(G * (*faceNormals)[t]);
+			for (int j = 0; j < 3; j++) {
+				tri[j].normal = n;
+			}
+		}
+	};
+	auto clipAndAdd = [&](vector<VertexData>& tri, bool isFlipped) {
+		if (isFlipped) {
+			for (VertexData& v : tri) {
+				v.normal *= -1;
+			}
+		}
+		vector<VertexData> windowTris = transformVertices(viewportMatrix, clipPolygon(tri, allButNearNDCPlanes));
+		triangles.insert(triangles.end(), windowTris.begin(), windowTris.end());
+	};
+
+	for (size_t t = 0; t + 2 < corners.size(); t += 3) {
+		const uint32_t* corner = &corners[t];
+		if (inFront[corner[0]] && inFront[corner[1]] && inFront[corner[2]]) {
+			// Clipping against the near plane would only rotate the corners, to 1, 2, 0.
+			const VertexData& A = clipCoords[corner[0]];
+			const VertexData& B = clipCoords[corner[1]];
+			const VertexData& C = clipCoords[corner[2]];
+			dvec3 n = normalFrom3Points(B.pos.xyz(), C.pos.xyz(), A.pos.xyz());
+			bool isFlipped = n.z < 0.0;
+			if (isFlipped && !renderBackfaces) {
+				continue;
+			}
+			if (inView[corner[0]] && inView[corner[1]] && inView[corner[2]]) {
+				// Neither would clipping against the view volume, which also
+				// rotates them back into order.
+				const size_t FIRST = triangles.size();
+				for (int j = 0; j < 3; j++) {
+					triangles.push_back(windowCoords[corner[j]]);
+				}
+				setFaceNormal(&triangles[FIRST], t / 3);
+				if (isFlipped) {
+					for (size_t j = FIRST; j < FIRST + 3; j++) {
+						triangles[j].normal *= -1;
+					}
+				}
+			} else {
+				vector<VertexData> tri = { B, C, A };
+				setFaceNormal(tri.data(), t / 3);
+				clipAndAdd(tri, isFlipped);
+			}
+		} else {
+			vector<VertexData> eyeTri = { eyeCoords[corner[0]], eyeCoords[corner[1]], eyeCoords[corner[2]] };
+			setFaceNormal(eyeTri.data(), t / 3);
+			vector<VertexData> projTris = transformVertices(projectionMatrix, clipPolygon(eyeTri, nearPlane));
+			for (size_t i = 0; i + 2 < projTris.size(); i += 3) {
+				vector<VertexData> tri = { perspectiveDivide(projTris[i]), perspectiveDivide(projTris[i + 1]),
+											perspectiveDivide(projTris[i + 2]) };
+				dvec3 n = normalFrom3Points(tri[0].pos.xyz(), tri[1].pos.xyz(), tri[2].pos.xyz());
+				bool isFlipped = n.z < 0.0;
+				if (!isFlipped || renderBackfaces) {
+					clipAndAdd(tri, isFlipped);
+				}
+			}
+		}
+	}
+
+	Frame eyeFrame = Frame::createOrthoNormalBasis(viewingMatrix);
+	drawManyFilledTriangles(frameBuffer, eyePos, lights, triangles, eyeFrame);
+}
+
 /**
  * @fn	void VertexOps::processLineSegments(FrameBuffer &frameBuffer, const dvec3 &eyePos,
  *											const vector<LightSourcePtr> &lights,
@@ -364,6 +656,117 @@ void VertexOps::render(FrameBuffer& frameBuffer, const vector<VertexData>& verts
 		modelingMatrix, pipeMats, renderBackfaces);
 }
 
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, const IndexedMesh &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &modelingMatrix,
+ *								const PipelineMatrices &pipeMats, bool renderBackfaces)
+ * @brief	Renders an indexed mesh, at the coarsest level of detail that looks the same
+ * 			at its size on screen. The size is measured at the point of the mesh's
+ * 			bounding sphere nearest the eye, where one unit covers the most pixels.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param 		  	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, const IndexedMesh& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	const dmat4& projectionMatrix = pipeMats.projectionMatrix;
+	dvec3 eyePos = glm::inverse(pipeMats.viewingMatrix)[3].xyz();
+
+	double scale = glm::max(glm::length(dvec3(modelingMatrix[0])),
+		glm::max(glm::length(dvec3(modelingMatrix[1])), glm::length(dvec3(modelingMatrix[2]))));
+	double pixelsPerUnit = scale * pipeMats.viewportMatrix[1][1] * projectionMatrix[1][1];
+	if (projectionMatrix[2][3] != 0.0) {
+		dvec4 center = pipeMats.viewingMatrix * modelingMatrix * dvec4(mesh.center, 1.0);
+		double nearestDepth = -center.z - scale * mesh.radius;
+		pixelsPerUnit = nearestDepth > 0.0 ? pixelsPerUnit / nearestDepth : DBL_MAX;
+	}
+	VertexOps::processIndexedTriangles(frameBuffer, eyePos, lights, mesh, mesh.selectLOD(pixelsPerUnit),
+		modelingMatrix, pipeMats, renderBackfaces);
+}
+
+const int STREAMING_BATCH_TRIANGLES = 1 << 15;	//!< Triangles of a streaming mesh drawn per batch.
+
+/**
+ * @fn	void VertexOps::render(FrameBuffer &frameBuffer, StreamingMesh &mesh,
+ *								const vector<LightSourcePtr> &lights, const dmat4 &modelingMatrix,
+ *								const PipelineMatrices &pipeMats, bool renderBackfaces)
+ * @brief	Renders a streaming mesh. Groups, and then the clusters of the groups that
+ * 			pass, are culled as processIndexedTriangles culls clusters, and only the
+ * 			clusters that remain are fetched. They are drawn in batches of about
+ * 			STREAMING_BATCH_TRIANGLES, so the mesh's cache may drop clusters of earlier
+ * 			batches while later ones are fetched. Each of a block's shared vertices is
+ * 			carried through the pipeline once, and each triangle is flat shaded with a
+ * 			normal computed from its corners as it is drawn.
+ * @param [in,out]	frameBuffer	Buffer for frame data.
+ * @param [in,out]	mesh	   	The mesh.
+ * @param 		  	lights	   	The lights.
+ * @param           modelingMatrix  The transformation applied to the object
+ * @param 		  	pipeMats    The pipeline matrices
+ * @param           renderBackfaces True if backfaces are to be rendered
+ */
+
+void VertexOps::render(FrameBuffer& frameBuffer, StreamingMesh& mesh,
+	const vector<LightSourcePtr>& lights,
+	const dmat4& modelingMatrix,
+	const PipelineMatrices& pipeMats,
+	bool renderBackfaces) {
+	dvec3 eyePos = glm::inverse(pipeMats.viewingMatrix)[3].xyz();
+	const ClusterView view = makeClusterView(modelingMatrix, pipeMats, renderBackfaces);
+
+	vector<VertexData> objectCoords;
+	vector<uint32_t> corners;
+	vector<dvec3> faceNormals;
+	auto drawBatch = [&]() {
+		if (!corners.empty()) {
+			processSharedTriangles(frameBuffer, eyePos, lights, objectCoords, corners, &faceNormals,
+				modelingMatrix, pipeMats, renderBackfaces);
+			objectCoords.clear();
+			corners.clear();
+			faceNormals.clear();
+		}
+	};
+	const vector<StreamingCluster>& clusters = mesh.getClusters();
+	for (const StreamingGroup& group : mesh.getGroups()) {
+		if (!clusterIsVisible(group.bounds, view)) {
+			continue;
+		}
+		for (uint32_t c = group.firstCluster; c < group.firstCluster + group.numClusters; c++) {
+			if (!clusterIsVisible(clusters[c].bounds, view)) {
+				continue;
+			}
+			std::shared_ptr<const StreamingBlock> block = mesh.fetch((int)c);
+			if (!block) {
+				continue;
+			}
+			const uint32_t FIRST = (uint32_t)objectCoords.size();
+			const vector<float>& P = block->positions;
+			for (size_t i = 0; i + 2 < P.size(); i += 3) {
+				objectCoords.push_back(VertexData(dvec4(P[i], P[i + 1], P[i + 2], 1.0), Z_AXIS, mesh.getMaterial()));
+			}
+			const vector<uint16_t>& I = block->indices;
+			for (size_t t = 0; t + 2 < I.size(); t += 3) {
+				dvec3 corner[3];
+				for (int j = 0; j < 3; j++) {
+					corners.push_back(FIRST + I[t + j]);
+					corner[j] = objectCoords[FIRST + I[t + j]].pos.xyz();
+				}
+				faceNormals.push_back(normalFrom3Points(corner[0], corner[1], corner[2]));
+			}
+			if (faceNormals.size() >= STREAMING_BATCH_TRIANGLES) {
+				drawBatch();
+			}
+		}
+	}
+	drawBatch();
+}
+
 /**
  * @fn	void VertexOps::getViewportTransformation()
  * @brief	Sets viewport transformation based on the current viewport settings.
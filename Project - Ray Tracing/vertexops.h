@@ -15,6 +15,8 @@
 #include "vertexdata.h"
 #include "iscene.h"
 #include "rasterization.h"
+#include "indexedmesh.h"
+#include "streamingmesh.h"
 
  /**
   * @class	PipelineMatrices
@@ -47,12 +49,28 @@ public:
 		const vector<VertexData>& objectCoords,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats);
+	static void processIndexedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const IndexedMesh& mesh, int lod,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static void render(FrameBuffer& frameBuffer, const vector<VertexData>& verts,
 		const vector<LightSourcePtr>& lights,
 		const dmat4& modelingMatrix,
 		const PipelineMatrices& pipeMats,
 		bool renderBackfaces
 	);
+	static void render(FrameBuffer& frameBuffer, const IndexedMesh& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
+	static void render(FrameBuffer& frameBuffer, StreamingMesh& mesh,
+		const vector<LightSourcePtr>& lights,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 	static dmat4 getViewportTransformation(int left, int width, int bottom, int height);
 protected:
 	static vector<VertexData> clipAgainstPlane(vector<VertexData>& verts, const IPlane& plane);
@@ -65,4 +83,12 @@ protected:
 	static vector<VertexData> transformVerticesToWorldCoordinates(const dmat4& modelMatrix,
 		const vector<VertexData>& vertices);
 	static vector<VertexData> transformVertices(const dmat4& TM, const vector<VertexData>& vertices);
+	static void processSharedTriangles(FrameBuffer& frameBuffer, const dvec3& eyePos,
+		const vector<LightSourcePtr>& lights,
+		const vector<VertexData>& objectCoords,
+		const vector<uint32_t>& corners,
+		const vector<dvec3>* faceNormals,
+		const dmat4& modelingMatrix,
+		const PipelineMatrices& pipeMats,
+		bool renderBackfaces);
 };